@@ -0,0 +1,303 @@
+#include "accesslog.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OUT_BUF (256 * 1024)        // formatted bytes per write()
+#define LINE_MAX_BYTES (ACCESS_TARGET_MAX * 6 + 256)    // worst case, every byte escaped
+
+// Single producer (the worker), single consumer (the log thread). The
+// indexes only grow; a slot is recs[index % ACCESS_RING_SIZE]. Each side's
+// index has a cache line to itself so the two threads do not share one.
+struct access_ring {
+    _Alignas(64) atomic_size_t head;        // next slot the worker fills
+    size_t tail_seen;                       // worker's copy of tail
+    _Alignas(64) atomic_size_t tail;        // next slot the log thread reads
+    _Alignas(64) atomic_uint_fast64_t dropped;
+    struct access_record recs[ACCESS_RING_SIZE];
+};
+
+static struct {
+    struct access_ring **rings;
+    int nrings;
+    char *path;
+    int fd;
+    enum access_format format;
+    int flush_ms;
+    uint64_t rotate_bytes;
+    uint64_t file_bytes;            // size of the current file
+    char *out;
+    size_t out_len;
+    atomic_int reopen;
+    int stop;
+    pthread_t tid;
+    pthread_mutex_t lock;           // guards stop, for the timed wait
+    pthread_cond_t wake;
+    atomic_uint_fast64_t written;
+    atomic_uint_fast64_t rotations;
+    atomic_uint_fast64_t write_errors;
+    uint64_t dropped;               // from rings already freed
+    int64_t stamp_sec;              // second the cached stamp is for
+    char stamp[32];
+} alog = {.fd = -1, .lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+struct access_record *access_ring_reserve(struct access_ring *r) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (h - r->tail_seen == ACCESS_RING_SIZE) {
+        r->tail_seen = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (h - r->tail_seen == ACCESS_RING_SIZE) {
+            atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+    }
+    return &r->recs[h % ACCESS_RING_SIZE];
+}
+
+void access_ring_commit(struct access_ring *r) {
+    size_t h = atomic_load_explicit(&r->head, memory_order_relaxed) + 1;
+    atomic_store_explicit(&r->head, h, memory_order_release);
+    // Under load the flush interval is too long for the ring: wake the log
+    // thread early every half ring, which costs one signal per 2048 requests
+    if (h % (ACCESS_RING_SIZE / 2) == 0) {
+        pthread_mutex_lock(&alog.lock);
+        pthread_cond_signal(&alog.wake);
+        pthread_mutex_unlock(&alog.lock);
+    }
+}
+
+struct access_ring *access_log_ring(int i) {
+    return alog.rings && i < alog.nrings ? alog.rings[i] : NULL;
+}
+
+static int open_log(void) {
+    if (strcmp(alog.path, "-") == 0) {
+        alog.fd = STDOUT_FILENO;
+        return 0;
+    }
+    alog.fd = open(alog.path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (alog.fd < 0) return -1;
+    struct stat st;
+    alog.file_bytes = fstat(alog.fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    return 0;
+}
+
+static void close_log(void) {
+    if (alog.fd > STDOUT_FILENO) close(alog.fd);
+    alog.fd = -1;
+}
+
+// FILE.4 -> FILE.5, ..., FILE -> FILE.1, then a fresh FILE
+static void rotate(void) {
+    size_t n = strlen(alog.path) + 16;
+    char from[n], to[n];
+    close_log();
+    for (int i = ACCESS_LOG_KEEP - 1; i >= 1; i--) {
+        snprintf(from, n, "%s.%d", alog.path, i);
+        snprintf(to, n, "%s.%d", alog.path, i + 1);
+        rename(from, to);
+    }
+    snprintf(to, n, "%s.1", alog.path);
+    rename(alog.path, to);
+    atomic_fetch_add_explicit(&alog.rotations, 1, memory_order_relaxed);
+    if (open_log() < 0) perror(alog.path);
+}
+
+static void flush_out(void) {
+    size_t off = 0;
+    while (off < alog.out_len && alog.fd >= 0) {
+        ssize_t w = write(alog.fd, alog.out + off, alog.out_len - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            atomic_fetch_add_explicit(&alog.write_errors, 1, memory_order_relaxed);
+            break;
+        }
+        off += (size_t)w;
+    }
+    alog.file_bytes += off;
+    alog.out_len = 0;
+    if (alog.rotate_bytes && alog.fd > STDOUT_FILENO && alog.file_bytes >= alog.rotate_bytes) rotate();
+}
+
+// Copies s with '"' and '\' escaped, and bytes outside printable ASCII as
+// \xHH (Common) or \u00HH (JSON), so a line can never be split or forged
+static char *put_escaped(char *p, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch == '"' || ch == '\\') {
+            *p++ = '\\';
+            *p++ = (char)ch;
+        } else if (ch < 0x20 || ch >= 0x7f) {
+            if (alog.format == ACCESS_JSON) {
+                memcpy(p, "\\u00", 4);
+                p += 4;
+            } else {
+                memcpy(p, "\\x", 2);
+                p += 2;
+            }
+            *p++ = hex[ch >> 4];
+            *p++ = hex[ch & 15];
+        } else {
+            *p++ = (char)ch;
+        }
+    }
+    return p;
+}
+
+// Records mostly share a second; its timestamp is formatted once
+static const char *stamp(int64_t sec) {
+    if (sec != alog.stamp_sec || !alog.stamp[0]) {
+        time_t t = (time_t)sec;
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        strftime(alog.stamp, sizeof(alog.stamp),
+                 alog.format == ACCESS_JSON ? "%Y-%m-%dT%H:%M:%SZ" : "%d/%b/%Y:%H:%M:%S +0000", &tm);
+        alog.stamp_sec = sec;
+    }
+    return alog.stamp;
+}
+
+static void format_record(const struct access_record *r) {
+    if (OUT_BUF - alog.out_len < LINE_MAX_BYTES) flush_out();
+    char *p = alog.out + alog.out_len;
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in = {.s_addr = r->addr};
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    if (alog.format == ACCESS_JSON) {
+        p += sprintf(p, "{\"time\":\"%s\",\"remote_addr\":\"%s\",\"method\":\"", stamp(r->time), addr);
+        p = put_escaped(p, r->method, strlen(r->method));
+        p += sprintf(p, "\",\"target\":\"");
+        p = put_escaped(p, r->target, r->target_len);
+        p += sprintf(p, "\",\"protocol\":\"HTTP/1.%u\",\"status\":%u,\"bytes\":%llu,\"duration_us\":%u}\n",
+                     r->version_minor, r->status, (unsigned long long)r->bytes, r->duration_us);
+    } else {
+        p += sprintf(p, "%s - - [%s] \"", addr, stamp(r->time));
+        p = put_escaped(p, r->method, strlen(r->method));
+        *p++ = ' ';
+        p = put_escaped(p, r->target, r->target_len);
+        p += sprintf(p, " HTTP/1.%u\" %u %llu\n", r->version_minor, r->status, (unsigned long long)r->bytes);
+    }
+    alog.out_len = (size_t)(p - alog.out);
+}
+
+static void drain(void) {
+    uint64_t n = 0;
+    for (int i = 0; i < alog.nrings; i++) {
+        struct access_ring *r = alog.rings[i];
+        size_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        size_t h = atomic_load_explicit(&r->head, memory_order_acquire);
+        for (; t != h; t++, n++) {
+            format_record(&r->recs[t % ACCESS_RING_SIZE]);
+            // Frees the slot for the worker as soon as it is formatted
+            atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+        }
+    }
+    flush_out();
+    atomic_fetch_add_explicit(&alog.written, n, memory_order_relaxed);
+}
+
+static void *log_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&alog.lock);
+    while (!alog.stop) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += alog.flush_ms / 1000;
+        ts.tv_nsec += (long)(alog.flush_ms % 1000) * 1000000;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&alog.wake, &alog.lock, &ts);
+        pthread_mutex_unlock(&alog.lock);
+
+        drain();
+        if (atomic_exchange(&alog.reopen, 0)) {
+            close_log();
+            if (open_log() < 0) perror(alog.path);
+        }
+        pthread_mutex_lock(&alog.lock);
+    }
+    pthread_mutex_unlock(&alog.lock);
+    drain();
+    return NULL;
+}
+
+int access_log_open(const char *path, enum access_format format, int flush_ms, uint64_t rotate_bytes,
+                    int nrings) {
+    alog.path = strdup(path);
+    alog.out = malloc(OUT_BUF);
+    alog.rings = calloc((size_t)nrings, sizeof(*alog.rings));
+    if (!alog.path || !alog.out || !alog.rings) goto fail;
+    alog.nrings = nrings;
+    for (int i = 0; i < nrings; i++) {
+        alog.rings[i] = aligned_alloc(64, sizeof(struct access_ring));
+        if (!alog.rings[i]) goto fail;
+        memset(alog.rings[i], 0, sizeof(struct access_ring));
+    }
+    alog.format = format;
+    alog.flush_ms = flush_ms > 0 ? flush_ms : 1;
+    alog.rotate_bytes = rotate_bytes;
+    if (open_log() < 0) {
+        perror(path);
+        goto fail;
+    }
+    int err = pthread_create(&alog.tid, NULL, log_main, NULL);
+    if (err) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        close_log();
+        goto fail;
+    }
+    return 0;
+
+fail:
+    for (int i = 0; alog.rings && i < alog.nrings; i++) free(alog.rings[i]);
+    free(alog.rings);
+    free(alog.out);
+    free(alog.path);
+    alog.rings = NULL;
+    alog.nrings = 0;
+    return -1;
+}
+
+void access_log_reopen(void) {
+    atomic_store(&alog.reopen, 1);
+}
+
+void access_log_stats(struct access_log_stats *st) {
+    memset(st, 0, sizeof(*st));
+    st->written = atomic_load_explicit(&alog.written, memory_order_relaxed);
+    st->rotations = atomic_load_explicit(&alog.rotations, memory_order_relaxed);
+    st->write_errors = atomic_load_explicit(&alog.write_errors, memory_order_relaxed);
+    st->dropped = alog.dropped;
+    for (int i = 0; i < alog.nrings; i++) {
+        st->dropped += atomic_load_explicit(&alog.rings[i]->dropped, memory_order_relaxed);
+    }
+}
+
+void access_log_close(void) {
+    if (!alog.rings) return;
+    pthread_mutex_lock(&alog.lock);
+    alog.stop = 1;
+    pthread_cond_signal(&alog.wake);
+    pthread_mutex_unlock(&alog.lock);
+    pthread_join(alog.tid, NULL);
+    close_log();
+    for (int i = 0; i < alog.nrings; i++) {
+        alog.dropped += atomic_load_explicit(&alog.rings[i]->dropped, memory_order_relaxed);
+        free(alog.rings[i]);
+    }
+    free(alog.rings);
+    free(alog.out);
+    free(alog.path);
+    alog.rings = NULL;
+    alog.nrings = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Access log. Every worker fills records in a ring of its own, which only
+// that worker writes and only the log thread reads, so logging a request
+// takes no lock. The log thread wakes every flush interval, or when a ring
+// is half full, formats what the rings hold and writes it with one write().
+// A record that finds its ring full is dropped and counted; the worker
+// never waits for the disk.
+
+#define ACCESS_RING_SIZE 4096       // records per worker, a power of two
+#define ACCESS_TARGET_MAX 256       // longer targets are cut
+#define ACCESS_LOG_KEEP 5           // rotated files kept: FILE.1 .. FILE.5
+
+enum access_format {
+    ACCESS_COMMON,                  // NCSA Common Log Format
+    ACCESS_JSON,                    // one JSON object per line
+};
+
+struct access_record {
+    int64_t time;                   // Unix seconds
+    uint32_t addr;                  // client IPv4 address, network order
+    uint16_t status;
+    uint8_t version_minor;          // HTTP/1.x
+    uint8_t target_len;             // bytes kept, <= ACCESS_TARGET_MAX - 1
+    uint32_t duration_us;           // handler time
+    uint64_t bytes;                 // response size, headers included
+    char method[8];                 // NUL-terminated; "-" if unparsed
+    char target[ACCESS_TARGET_MAX];
+};
+
+struct access_ring;
+
+struct access_log_stats {
+    uint64_t written;               // records written to the file
+    uint64_t dropped;               // records lost to a full ring
+    uint64_t rotations;
+    uint64_t write_errors;
+};
+
+// Opens path ("-" for standard output) and starts the log thread with one
+// ring per worker. rotate_bytes of 0 disables size-based rotation.
+int access_log_open(const char *path, enum access_format format, int flush_ms, uint64_t rotate_bytes,
+                    int nrings);
+
+// Ring i, or NULL when the log is not open
+struct access_ring *access_log_ring(int i);
+
+// A free slot to fill, or NULL (and the record counted as dropped) when
+// the ring is full. Only the ring's worker may call this.
+struct access_record *access_ring_reserve(struct access_ring *r);
+
+// Hands the slot from access_ring_reserve() to the log thread
+void access_ring_commit(struct access_ring *r);
+
+// Makes the log thread reopen the file at its next flush, for external
+// rotation (SIGHUP)
+void access_log_reopen(void);
+
+void access_log_stats(struct access_log_stats *st);
+
+// Writes what is left in the rings, stops the log thread and closes the file
+void access_log_close(void);
+
+#endif // ACCESSLOG_H
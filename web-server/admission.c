@@ -0,0 +1,22 @@
+#include "admission.h"
+
+void admission_init(struct admission *a, uint64_t target_ns, uint64_t interval_ns) {
+    a->target_ns = target_ns;
+    a->interval_ns = interval_ns;
+    a->interval_end = 0;
+    a->min_delay = UINT64_MAX;
+    a->overloaded = 0;
+}
+
+int admission_check(struct admission *a, uint64_t now, uint64_t delay) {
+    if (now >= a->interval_end) {
+        // An interval that saw no work, or ended more than an interval
+        // ago, was idle
+        a->overloaded = a->min_delay != UINT64_MAX && now < a->interval_end + a->interval_ns &&
+                        a->min_delay > a->target_ns;
+        a->min_delay = UINT64_MAX;
+        a->interval_end = now + a->interval_ns;
+    }
+    if (delay < a->min_delay) a->min_delay = delay;
+    return delay > (a->overloaded ? a->target_ns : a->interval_ns);
+}
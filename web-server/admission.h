@@ -0,0 +1,31 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+
+// CoDel-style overload detection for one worker's queue of work. Each
+// request reports how long it waited before the worker got to it. Once in
+// every interval the lowest of those delays is compared with the target: a
+// minimum above target means the queue never drained during the whole
+// interval, a standing queue rather than a burst. While that lasts, work
+// that has waited longer than target is shed; otherwise only work that has
+// waited longer than a whole interval is. Latency thus stays near target
+// under sustained overload, and bursts still get through.
+//
+// Not thread-safe; each worker has its own.
+
+struct admission {
+    uint64_t target_ns;
+    uint64_t interval_ns;
+    uint64_t interval_end;      // when the current interval is judged
+    uint64_t min_delay;         // lowest delay seen in it, UINT64_MAX if none
+    int overloaded;             // the last interval had a standing queue
+};
+
+void admission_init(struct admission *a, uint64_t target_ns, uint64_t interval_ns);
+
+// Records the queueing delay of work about to start at now. Returns 1 if it
+// should be shed instead.
+int admission_check(struct admission *a, uint64_t now, uint64_t delay);
+
+#endif // ADMISSION_H
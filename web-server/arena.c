@@ -0,0 +1,152 @@
+#include "arena.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+struct arena_large {
+    struct arena_large *next;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+void arena_pool_init(struct arena_pool *p, size_t chunk_size, size_t max_free) {
+    memset(p, 0, sizeof(*p));
+    p->chunk_size = (chunk_size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    p->max_free = max_free;
+}
+
+void arena_pool_destroy(struct arena_pool *p) {
+    while (p->free) {
+        struct arena_chunk *c = p->free;
+        p->free = c->next;
+        free(c);
+    }
+    p->nfree = 0;
+}
+
+void arena_init(struct arena *a, struct arena_pool *pool) {
+    memset(a, 0, sizeof(*a));
+    a->pool = pool;
+}
+
+static struct arena_chunk *chunk_get(struct arena_pool *p) {
+    struct arena_chunk *c = p->free;
+    if (c) {
+        p->free = c->next;
+        p->nfree--;
+        p->stats.chunk_reuses++;
+    } else {
+        c = malloc(sizeof(*c) + p->chunk_size);
+        if (!c) return NULL;
+        p->stats.chunk_mallocs++;
+    }
+    c->next = NULL;
+    return c;
+}
+
+static void *alloc_large(struct arena *a, size_t size) {
+    struct arena_large *l = malloc(sizeof(*l) + size);
+    if (!l) return NULL;
+    l->next = a->large;
+    a->large = l;
+    a->pool->stats.large_allocs++;
+    return l->data;
+}
+
+void *arena_alloc(struct arena *a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) size = ARENA_ALIGN;
+    a->used += size;
+    a->pool->stats.bytes += size;
+    if ((size_t)(a->end - a->cur) >= size) {
+        void *p = a->cur;
+        a->cur += size;
+        return p;
+    }
+    // Oversize requests get a block of their own and leave the chunk as is
+    if (size > a->pool->chunk_size) return alloc_large(a, size);
+
+    struct arena_chunk *c = chunk_get(a->pool);
+    if (!c) return NULL;
+    if (a->last) {
+        a->last->next = c;
+    } else {
+        a->first = c;
+    }
+    a->last = c;
+    a->nchunks++;
+    a->cur = c->data + size;
+    a->end = c->data + a->pool->chunk_size;
+    return c->data;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t len) {
+    char *p = arena_alloc(a, len + 1);
+    if (!p) return NULL;
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+char *arena_printf(struct arena *a, size_t *len, const char *fmt, ...) {
+    // Try the space left in the current chunk first; most output fits
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = (size_t)(a->end - a->cur);
+    int n = vsnprintf(a->cur, room, fmt, ap);
+    va_end(ap);
+    if (n < 0) return NULL;
+    size_t need = ((size_t)n + ARENA_ALIGN) & ~(size_t)(ARENA_ALIGN - 1);
+    if (need <= room) {
+        // Claims exactly the bytes just written
+        char *p = arena_alloc(a, (size_t)n + 1);
+        if (len) *len = (size_t)n;
+        return p;
+    }
+    char *p = arena_alloc(a, (size_t)n + 1);
+    if (!p) return NULL;
+    va_start(ap, fmt);
+    vsnprintf(p, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    if (len) *len = (size_t)n;
+    return p;
+}
+
+void arena_reset(struct arena *a) {
+    struct arena_pool *p = a->pool;
+    if (!a->used) return;
+    p->stats.resets++;
+    if (a->used > p->stats.peak_bytes) p->stats.peak_bytes = a->used;
+    if (a->nchunks > 1) p->stats.multi_chunk++;
+
+    while (a->large) {
+        struct arena_large *l = a->large;
+        a->large = l->next;
+        free(l);
+    }
+    if (a->first) {
+        a->last->next = p->free;
+        p->free = a->first;
+        p->nfree += a->nchunks;
+        // Bursts can leave more chunks pooled than the worker needs
+        while (p->nfree > p->max_free) {
+            struct arena_chunk *c = p->free;
+            p->free = c->next;
+            p->nfree--;
+            p->stats.chunk_frees++;
+            free(c);
+        }
+    }
+    a->first = a->last = NULL;
+    a->nchunks = 0;
+    a->cur = a->end = NULL;
+    a->used = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Request-scoped bump allocator. Every connection owns an arena; anything a
+// request needs only while it is being handled comes from there and is
+// released all at once by arena_reset() when the request ends. Arenas take
+// fixed-size chunks from a per-worker pool and hand them back on reset, so
+// steady keep-alive traffic reuses the same chunks and never calls malloc.
+// Neither type is thread-safe; each worker has its own pool.
+
+struct arena_chunk;
+struct arena_large;
+
+struct arena_stats {
+    uint64_t chunk_mallocs;     // chunks obtained from malloc
+    uint64_t chunk_reuses;      // chunks taken from the pool
+    uint64_t chunk_frees;       // chunks freed because the pool was full
+    uint64_t large_allocs;      // allocations too big for a chunk
+    uint64_t resets;            // requests released
+    uint64_t bytes;             // bytes handed out, padding included
+    uint64_t peak_bytes;        // most bytes held by one request
+    uint64_t multi_chunk;       // requests that needed more than one chunk
+};
+
+struct arena_pool {
+    struct arena_chunk *free;
+    size_t nfree;
+    size_t max_free;            // pooled chunks kept beyond this are freed
+    size_t chunk_size;          // usable bytes per chunk
+    struct arena_stats stats;
+};
+
+struct arena {
+    struct arena_pool *pool;
+    struct arena_chunk *first;  // chunks in use, oldest first
+    struct arena_chunk *last;
+    size_t nchunks;
+    char *cur;                  // free space in the last chunk
+    char *end;
+    struct arena_large *large;  // oversize blocks, freed on reset
+    size_t used;
+};
+
+void arena_pool_init(struct arena_pool *p, size_t chunk_size, size_t max_free);
+void arena_pool_destroy(struct arena_pool *p);
+
+// An arena holds no memory until its first allocation
+void arena_init(struct arena *a, struct arena_pool *pool);
+
+// Returns size bytes aligned for any type, or NULL when out of memory
+void *arena_alloc(struct arena *a, size_t size);
+
+char *arena_strndup(struct arena *a, const char *s, size_t len);
+
+// Formats into the arena; *len gets the length without the terminator
+char *arena_printf(struct arena *a, size_t *len, const char *fmt, ...) __attribute__((format(printf, 3, 4)));
+
+// Releases everything allocated since the last reset. The chunks go back
+// to the pool as one list splice; only oversize blocks are freed one by one.
+void arena_reset(struct arena *a);
+
+#endif // ARENA_H
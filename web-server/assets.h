@@ -0,0 +1,37 @@
+#ifndef ASSETS_H
+#define ASSETS_H
+
+#include <stddef.h>
+
+// The files under static/, compiled into the server. At build time
+// tools/bundle strips the indentation from text files, compresses them with
+// brotli and gzip, and serializes every response head into the generated
+// assets.c, so serving one is a matter of pointing at memory. Nothing is
+// read, hashed or compressed at run time.
+
+enum asset_coding { ASSET_IDENTITY, ASSET_BR, ASSET_GZIP, ASSET_CODINGS };
+
+struct asset_variant {
+    const char *head;           // status line and headers up to Date; NULL if the coding was not smaller
+    size_t head_len;
+    const char *not_modified;   // the 304 head, validators included
+    size_t not_modified_len;
+    const char *etag;           // quoted
+    const char *body;
+    size_t body_len;
+};
+
+struct asset {
+    const char *path;           // relative to static/, e.g. "css/app.css"
+    long long mtime;            // Last-Modified, from the file
+    int compressible;           // kept in several codings, so answers carry Vary
+    struct asset_variant v[ASSET_CODINGS];
+};
+
+extern const struct asset assets[];
+extern const size_t assets_count;
+
+// The asset at path (relative, no leading '/'), or NULL
+const struct asset *asset_find(const char *path, size_t len);
+
+#endif // ASSETS_H
@@ -0,0 +1,73 @@
+#!/bin/sh
+# Loopback load test: starts ./webserver, runs bench/loadgen against /,
+# /echo and /time in closed loop with and without keep-alive and in open
+# loop at a fixed rate, and prints one tab-separated line per run.
+#
+#   bench/load.sh [-o results.tsv] [-b baseline.tsv]
+#
+# With -b, every run is compared with the same run in the baseline file
+# (an earlier -o): closed-loop runs by throughput, open-loop runs by p99,
+# since at a fixed rate throughput is fixed too. The script fails if either
+# got worse by more than the tolerance. Settings come from the environment:
+#   PORT (18080)  SECS (5)  CONNS (32)  THREADS (1)  RATE (20000)
+#   WORKERS (1)   TOLERANCE (20, percent)
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-18080}
+SECS=${SECS:-5}
+CONNS=${CONNS:-32}
+THREADS=${THREADS:-1}
+RATE=${RATE:-20000}
+WORKERS=${WORKERS:-1}
+TOLERANCE=${TOLERANCE:-20}
+out=
+baseline=
+
+while getopts o:b: opt; do
+    case $opt in
+    o) out=$OPTARG ;;
+    b) baseline=$OPTARG ;;
+    *) echo "usage: $0 [-o results.tsv] [-b baseline.tsv]" >&2; exit 1 ;;
+    esac
+done
+
+make -s webserver bench/loadgen
+./webserver -w "$WORKERS" 127.0.0.1 "$PORT" >/dev/null &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT
+sleep 0.5
+
+results=$(mktemp)
+printf 'path\tmode\tconnection\treq/s\tp50_us\tp99_us\tp999_us\tfailed\n'
+for path in / '/echo?msg=hello' /time; do
+    for args in "" "-n" "-r $RATE"; do
+        # A failed request still yields a line; the failed column shows it
+        # shellcheck disable=SC2086
+        bench/loadgen -s -t "$THREADS" -c "$CONNS" -d "$SECS" $args 127.0.0.1 "$PORT" "$path" | tee -a "$results" ||
+            true
+    done
+done
+
+[ -n "$out" ] && cp "$results" "$out"
+status=0
+if [ -n "$baseline" ]; then
+    echo
+    awk -F '\t' -v tol="$TOLERANCE" '
+        NR == FNR { rps[$1 FS $2 FS $3] = $4; p99[$1 FS $2 FS $3] = $6; next }
+        {
+            key = $1 FS $2 FS $3
+            if (!(key in rps)) next
+            verdict = "ok"
+            if ($2 == "closed" && $4 < rps[key] * (1 - tol / 100)) verdict = "REGRESSION (req/s)"
+            if ($2 != "closed" && $6 > p99[key] * (1 + tol / 100)) verdict = "REGRESSION (p99)"
+            if ($8 > 0) verdict = "FAILED REQUESTS"
+            printf "%-16s %-12s %-10s %8.0f -> %8.0f req/s  p99 %8.1f -> %8.1f us  %s\n",
+                   $1, $2, $3, rps[key], $4, p99[key], $6, verdict
+            if (verdict != "ok") bad = 1
+        }
+        END { exit bad }
+    ' "$baseline" "$results" || status=1
+fi
+rm -f "$results"
+exit $status
@@ -0,0 +1,482 @@
+// HTTP load generator. Each thread drives its share of the connections from
+// its own epoll loop, one request in flight per connection.
+//
+// Closed loop (default): every connection sends its next request as soon as
+// the previous response is in, so the offered load follows the server.
+// Open loop (-r RATE): requests are due at a fixed rate whether or not the
+// server keeps up. Latency is measured from when a request was due, not
+// from when a connection was free to send it, so a stalled server shows up
+// in the tail instead of silently lowering the load (coordinated omission).
+//
+// -n opens a new connection for every request. Latency then includes the
+// TCP handshake.
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RBUF_SIZE 16384
+#define MAX_EVENTS 256
+#define PENDING_MAX (1 << 20)       // due requests waiting for a free connection
+
+// Latencies in ns, 16 buckets per power of two: within 6.25% up to ~36 min
+#define HIST_SUB 16
+#define HIST_BUCKETS (HIST_SUB * 39)
+
+struct hist {
+    uint64_t count[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+};
+
+enum conn_state {
+    CONN_CLOSED,
+    CONN_IDLE,
+    CONN_CONNECTING,
+    CONN_SENDING,
+    CONN_READING,
+};
+
+struct lconn {
+    int fd;
+    enum conn_state state;
+    uint32_t events;
+    long long start;                // when the request was due
+    size_t sent;
+    char buf[RBUF_SIZE];            // response head, then scratch for the body
+    size_t len;
+    int head_done;
+    int status;
+    int server_close;               // Connection: close, or no Content-Length
+    int until_eof;                  // no Content-Length: the body ends at EOF
+    long long body_left;
+};
+
+struct worker {
+    pthread_t tid;
+    int nconns;
+    double rate;                    // requests/s for this thread, 0 for closed loop
+    struct hist hist;
+    uint64_t done, errors, non_2xx, missed, bytes;
+};
+
+static struct {
+    struct sockaddr_in addr;
+    const char *path;
+    char *request;
+    size_t request_len;
+    int keepalive;
+    double duration;
+    double rate;
+    int threads;
+    int conns;
+    int summary;
+    char headers[1024];     // extra request header lines from -H
+} cfg = {.keepalive = 1, .duration = 5, .threads = 1, .conns = 32};
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t v) {
+    if (v < HIST_SUB) return (int)v;
+    int k = 63 - __builtin_clzll(v);
+    int i = HIST_SUB * (k - 3) + (int)((v >> (k - 4)) & (HIST_SUB - 1));
+    return i < HIST_BUCKETS ? i : HIST_BUCKETS - 1;
+}
+
+// Middle of bucket i
+static double hist_value(int i) {
+    if (i < HIST_SUB) return i;
+    int k = i / HIST_SUB + 3;
+    double width = (double)(1ull << (k - 4));
+    return (HIST_SUB + i % HIST_SUB) * width + width / 2;
+}
+
+static void hist_add(struct hist *h, uint64_t v) {
+    h->count[hist_bucket(v)]++;
+    h->total++;
+    if (v > h->max) h->max = v;
+}
+
+static double hist_quantile(const struct hist *h, double q) {
+    if (!h->total) return 0;
+    uint64_t rank = (uint64_t)(q * (double)h->total + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen >= rank) return hist_value(i) < (double)h->max ? hist_value(i) : (double)h->max;
+    }
+    return (double)h->max;
+}
+
+static void conn_want(int ep, struct lconn *c, uint32_t events) {
+    if (c->events == events) return;
+    struct epoll_event ev = {.events = events, .data.ptr = c};
+    epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = events;
+}
+
+static void conn_drop(struct lconn *c) {
+    if (c->fd >= 0) close(c->fd);      // also leaves the epoll set
+    c->fd = -1;
+    c->state = CONN_CLOSED;
+}
+
+static int conn_send(int ep, struct lconn *c) {
+    while (c->sent < cfg.request_len) {
+        ssize_t n = write(c->fd, cfg.request + c->sent, cfg.request_len - c->sent);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) {
+                c->state = CONN_SENDING;
+                conn_want(ep, c, EPOLLOUT);
+                return 0;
+            }
+            return -1;
+        }
+        c->sent += (size_t)n;
+    }
+    c->state = CONN_READING;
+    c->len = 0;
+    c->head_done = 0;
+    conn_want(ep, c, EPOLLIN);
+    return 0;
+}
+
+static int conn_open(int ep, struct lconn *c) {
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd < 0) return -1;
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    c->events = EPOLLOUT;
+    struct epoll_event ev = {.events = c->events, .data.ptr = c};
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, c->fd, &ev) < 0) return -1;
+    if (connect(c->fd, (struct sockaddr *)&cfg.addr, sizeof(cfg.addr)) == 0) return conn_send(ep, c);
+    if (errno != EINPROGRESS) return -1;
+    c->state = CONN_CONNECTING;
+    return 0;
+}
+
+// Starts a request that was due at start. Returns -1 if it failed at once.
+static int conn_start(int ep, struct lconn *c, long long start) {
+    c->start = start;
+    c->sent = 0;
+    if (c->fd < 0) return conn_open(ep, c);
+    return conn_send(ep, c);
+}
+
+// Reads the status code, Content-Length and Connection from a complete head
+static void parse_head(struct lconn *c, size_t head_len) {
+    c->status = c->len > 12 && memcmp(c->buf, "HTTP/1.", 7) == 0 ? atoi(c->buf + 9) : 0;
+    c->until_eof = 1;
+    c->server_close = 0;
+    const char *p = c->buf, *end = c->buf + head_len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) break;
+        if (strncasecmp(p, "content-length:", 15) == 0) {
+            c->body_left = atoll(p + 15);
+            c->until_eof = 0;
+        } else if (strncasecmp(p, "connection:", 11) == 0) {
+            const char *v = p + 11;
+            while (*v == ' ') v++;
+            if (strncasecmp(v, "close", 5) == 0) c->server_close = 1;
+        }
+        p = eol + 1;
+    }
+    // These never have a body, whatever the head says (RFC 9112 6.3)
+    if (c->status == 204 || c->status == 304) {
+        c->body_left = 0;
+        c->until_eof = 0;
+    }
+    if (c->until_eof) c->server_close = 1;
+    else c->body_left -= (long long)(c->len - head_len);
+}
+
+// Returns 1 when the response is complete, 0 for more, -1 on error
+static int conn_read(struct worker *w, struct lconn *c) {
+    for (;;) {
+        size_t room = sizeof(c->buf) - c->len;
+        if (room == 0) return -1;
+        ssize_t n = read(c->fd, c->buf + c->len, room);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+        if (n == 0) return c->head_done && c->until_eof ? 1 : -1;
+        w->bytes += (uint64_t)n;
+        if (c->head_done) {
+            c->body_left -= n;
+            c->len = 0;
+        } else {
+            c->len += (size_t)n;
+            char *end = memmem(c->buf, c->len, "\r\n\r\n", 4);
+            if (!end) continue;
+            c->head_done = 1;
+            parse_head(c, (size_t)(end + 4 - c->buf));
+            c->len = 0;
+        }
+        if (c->until_eof) continue;
+        if (c->body_left == 0) return 1;
+        if (c->body_left < 0) return -1;       // more than announced
+    }
+}
+
+// epoll_wait() with a timeout in nanoseconds, so the open loop can sleep
+// until the next request is due instead of spinning on a 1 ms timeout
+static int wait_events(int ep, struct epoll_event *evs, long long timeout_ns) {
+    static int no_pwait2;
+    if (!no_pwait2) {
+        struct timespec ts = {timeout_ns / 1000000000, timeout_ns % 1000000000};
+        int n = epoll_pwait2(ep, evs, MAX_EVENTS, &ts, NULL);
+        if (n >= 0 || errno != ENOSYS) return n;
+        no_pwait2 = 1;
+    }
+    return epoll_wait(ep, evs, MAX_EVENTS, (int)((timeout_ns + 999999) / 1000000));
+}
+
+struct pending {
+    long long *due;
+    size_t head, tail;
+};
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    struct lconn *conns = calloc((size_t)w->nconns, sizeof(*conns));
+    struct lconn **idle = calloc((size_t)w->nconns, sizeof(*idle));
+    struct pending q = {.due = w->rate > 0 ? malloc(PENDING_MAX * sizeof(long long)) : NULL};
+    if (ep < 0 || !conns || !idle || (w->rate > 0 && !q.due)) {
+        perror("loadgen");
+        exit(1);
+    }
+    int nidle = 0;
+    long long start = now_ns();
+    long long deadline = start + (long long)(cfg.duration * 1e9);
+    double interval = w->rate > 0 ? 1e9 / w->rate : 0;
+    double next_due = (double)start;
+
+    for (int i = 0; i < w->nconns; i++) {
+        conns[i].fd = -1;
+        if (w->rate > 0) {
+            conns[i].state = CONN_IDLE;
+            idle[nidle++] = &conns[i];
+        } else if (conn_start(ep, &conns[i], start) < 0) {
+            w->errors++;
+            conn_drop(&conns[i]);
+            idle[nidle++] = &conns[i];
+        }
+    }
+
+    struct epoll_event evs[MAX_EVENTS];
+    for (;;) {
+        long long now = now_ns();
+        if (now >= deadline) break;
+        long long timeout = deadline - now;
+        if (w->rate > 0) {
+            while (next_due <= (double)now) {
+                if (q.tail - q.head < PENDING_MAX) q.due[q.tail++ % PENDING_MAX] = (long long)next_due;
+                else w->missed++;
+                next_due += interval;
+            }
+            if ((long long)next_due - now < timeout) timeout = (long long)next_due - now;
+        }
+        // Due requests go to free connections; closed loop reopens dropped ones
+        while (nidle > 0 && (w->rate <= 0 || q.head != q.tail)) {
+            struct lconn *c = idle[--nidle];
+            long long due = w->rate > 0 ? q.due[q.head++ % PENDING_MAX] : now;
+            if (conn_start(ep, c, due) < 0) {
+                w->errors++;
+                conn_drop(c);
+                idle[nidle++] = c;
+                break;                  // retry on the next round
+            }
+        }
+
+        int n = wait_events(ep, evs, timeout);
+        for (int i = 0; i < n; i++) {
+            struct lconn *c = evs[i].data.ptr;
+            int rc = 0;
+            if (c->state == CONN_CONNECTING || c->state == CONN_SENDING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                if (c->state == CONN_CONNECTING &&
+                    (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)) {
+                    rc = -1;
+                } else if (conn_send(ep, c) < 0) {
+                    rc = -1;
+                }
+                if (rc == 0) continue;
+            } else if (c->state == CONN_READING) {
+                rc = conn_read(w, c);
+                if (rc == 0) continue;
+            } else {
+                // The server closed an idle keep-alive connection
+                conn_drop(c);
+                continue;
+            }
+
+            if (rc < 0) {
+                w->errors++;
+                conn_drop(c);
+            } else {
+                hist_add(&w->hist, (uint64_t)(now_ns() - c->start));
+                w->done++;
+                // A 304 is what a conditional request hopes for
+                if ((c->status < 200 || c->status > 299) && c->status != 304) w->non_2xx++;
+                if (!cfg.keepalive || c->server_close) conn_drop(c);
+                else c->state = CONN_IDLE;
+            }
+            idle[nidle++] = c;
+        }
+    }
+
+    // Requests still waiting for a connection were never sent
+    w->missed += q.tail - q.head;
+    for (int i = 0; i < w->nconns; i++) conn_drop(&conns[i]);
+    close(ep);
+    free(conns);
+    free(idle);
+    free(q.due);
+    return NULL;
+}
+
+static void print_latency(const char *name, double ns) {
+    if (ns < 1e6) printf("%s %.0f us", name, ns / 1e3);
+    else printf("%s %.2f ms", name, ns / 1e6);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-c connections] [-d seconds] [-r rate] [-n] [-s] [-H header]... ip port path\n"
+            "  -t N   threads, each with its own epoll loop (default 1)\n"
+            "  -c N   connections in total (default 32)\n"
+            "  -d S   seconds to run (default 5)\n"
+            "  -r R   open loop: R requests per second in total (default: closed loop)\n"
+            "  -n     no keep-alive, a new connection per request\n"
+            "  -s     print one tab-separated summary line instead of the report\n"
+            "  -H H   add header line H to every request, e.g. 'If-None-Match: \"...\"'\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:d:r:nsH:h")) != -1) {
+        switch (opt) {
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'c':
+            cfg.conns = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration = atof(optarg);
+            break;
+        case 'r':
+            cfg.rate = atof(optarg);
+            break;
+        case 'n':
+            cfg.keepalive = 0;
+            break;
+        case 's':
+            cfg.summary = 1;
+            break;
+        case 'H': {
+            size_t n = strlen(cfg.headers);
+            if (snprintf(cfg.headers + n, sizeof(cfg.headers) - n, "%s\r\n", optarg) >= (int)(sizeof(cfg.headers) - n)) {
+                fprintf(stderr, "Too many headers\n");
+                return 1;
+            }
+            break;
+        }
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (argc - optind != 3 || cfg.threads < 1 || cfg.conns < cfg.threads || cfg.duration <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    cfg.addr.sin_family = AF_INET;
+    cfg.addr.sin_port = htons((uint16_t)atoi(argv[optind + 1]));
+    if (inet_pton(AF_INET, argv[optind], &cfg.addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IPv4 address: %s\n", argv[optind]);
+        return 1;
+    }
+    cfg.path = argv[optind + 2];
+    if (asprintf(&cfg.request, "GET %s HTTP/1.1\r\nHost: %s\r\n%s%s\r\n", cfg.path, argv[optind], cfg.headers,
+                 cfg.keepalive ? "" : "Connection: close\r\n") < 0) {
+        return 1;
+    }
+    cfg.request_len = strlen(cfg.request);
+
+    struct worker *workers = calloc((size_t)cfg.threads, sizeof(*workers));
+    if (!workers) return 1;
+    for (int i = 0; i < cfg.threads; i++) {
+        workers[i].nconns = cfg.conns / cfg.threads + (i < cfg.conns % cfg.threads);
+        workers[i].rate = cfg.rate / cfg.threads;
+        if (pthread_create(&workers[i].tid, NULL, worker_main, &workers[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    struct hist *all = calloc(1, sizeof(*all));
+    uint64_t done = 0, errors = 0, non_2xx = 0, missed = 0, bytes = 0;
+    for (int i = 0; i < cfg.threads; i++) {
+        struct worker *w = &workers[i];
+        pthread_join(w->tid, NULL);
+        for (int b = 0; b < HIST_BUCKETS; b++) all->count[b] += w->hist.count[b];
+        all->total += w->hist.total;
+        if (w->hist.max > all->max) all->max = w->hist.max;
+        done += w->done;
+        errors += w->errors;
+        non_2xx += w->non_2xx;
+        missed += w->missed;
+        bytes += w->bytes;
+    }
+
+    double rps = (double)done / cfg.duration;
+    double p50 = hist_quantile(all, 0.50), p99 = hist_quantile(all, 0.99), p999 = hist_quantile(all, 0.999);
+    if (cfg.summary) {
+        char mode[32] = "closed";
+        if (cfg.rate > 0) snprintf(mode, sizeof(mode), "open@%.0f", cfg.rate);
+        printf("%s\t%s\t%s\t%.0f\t%.1f\t%.1f\t%.1f\t%llu\n", cfg.path, mode, cfg.keepalive ? "keep-alive" : "close",
+               rps, p50 / 1e3, p99 / 1e3, p999 / 1e3, (unsigned long long)(errors + non_2xx + missed));
+    } else {
+        printf("GET %s: %s loop", cfg.path, cfg.rate > 0 ? "open" : "closed");
+        if (cfg.rate > 0) printf(" at %.0f/s", cfg.rate);
+        printf(", %s, %d thread%s, %d connections, %.1f s\n", cfg.keepalive ? "keep-alive" : "no keep-alive",
+               cfg.threads, cfg.threads == 1 ? "" : "s", cfg.conns, cfg.duration);
+        printf("  requests  %llu (%.0f/s, %.1f MB/s read)\n", (unsigned long long)done, rps,
+               (double)bytes / cfg.duration / 1e6);
+        printf("  failures  %llu errors, %llu non-2xx", (unsigned long long)errors, (unsigned long long)non_2xx);
+        if (cfg.rate > 0) printf(", %llu never sent", (unsigned long long)missed);
+        printf("\n  latency  ");
+        print_latency(" p50", p50);
+        print_latency("  p99", p99);
+        print_latency("  p999", p999);
+        print_latency("  max", (double)all->max);
+        printf("\n");
+    }
+    free(all);
+    free(workers);
+    free(cfg.request);
+    return errors || non_2xx ? 2 : 0;
+}
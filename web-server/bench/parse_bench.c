@@ -0,0 +1,92 @@
+// Parser micro-benchmark: parses a set of captured-looking requests in a
+// tight loop and reports requests and megabytes per second. Each request is
+// parsed whole and again fed in 64-byte pieces, as a slow client would send it,
+// once with each version of the scanning kernels.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "http_parser.h"
+#include "scan.h"
+
+static const char *const requests[] = {
+    "GET /time HTTP/1.1\r\nHost: localhost:8080\r\n\r\n",
+
+    "GET /echo?msg=hello%20world HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n\r\n",
+
+    "GET /static/css/site.css HTTP/1.1\r\n"
+    "Host: example.test\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+    "Accept: text/css,*/*;q=0.1\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Referer: https://example.test/\r\n"
+    "Connection: keep-alive\r\n"
+    "Cookie: session=3f2a9c1e0b7d4e6f8a1b2c3d4e5f6071; theme=dark; lang=en\r\n"
+    "Sec-Fetch-Dest: style\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "If-Modified-Since: Tue, 01 Oct 2024 10:00:00 GMT\r\n"
+    "Cache-Control: max-age=0\r\n\r\n",
+};
+
+#define NREQ (sizeof(requests) / sizeof(requests[0]))
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Parses every request iters times, in pieces of chunk bytes (0 = whole)
+static void run(const char *name, long iters, size_t chunk) {
+    size_t lens[NREQ], bytes = 0;
+    for (size_t i = 0; i < NREQ; i++) {
+        lens[i] = strlen(requests[i]);
+        bytes += lens[i];
+    }
+    struct http_request req;
+    volatile unsigned sink = 0;
+    double start = now_sec();
+    for (long it = 0; it < iters; it++) {
+        for (size_t i = 0; i < NREQ; i++) {
+            http_request_init(&req);
+            enum http_parse_status st = HTTP_PARSE_PARTIAL;
+            if (!chunk) {
+                st = http_parse_request(&req, requests[i], lens[i]);
+            } else {
+                for (size_t fed = 0; st == HTTP_PARSE_PARTIAL && fed < lens[i];) {
+                    fed = fed + chunk < lens[i] ? fed + chunk : lens[i];
+                    st = http_parse_request(&req, requests[i], fed);
+                }
+            }
+            if (st != HTTP_PARSE_DONE) {
+                fprintf(stderr, "request %zu did not parse\n", i);
+                return;
+            }
+            sink += req.nheaders;
+        }
+    }
+    double secs = now_sec() - start;
+    double n = (double)iters * NREQ;
+    printf("%-22s %6.2f M req/s  %7.1f MB/s\n", name, n / secs / 1e6,
+           (double)iters * bytes / secs / 1e6);
+}
+
+int main(void) {
+    long iters = 2000000;
+    const struct scan_ops *impls[4];
+    int n = scan_available(impls, 4);
+    for (int k = 0; k < n; k++) {
+        char name[64];
+        scan = *impls[k];
+        snprintf(name, sizeof(name), "%s, whole", impls[k]->name);
+        run(name, iters, 0);
+        snprintf(name, sizeof(name), "%s, 64B pieces", impls[k]->name);
+        run(name, iters, 64);
+    }
+    return 0;
+}
@@ -0,0 +1,170 @@
+// Scanning-kernel micro-benchmark: runs every kernel version the CPU
+// supports on realistic request pieces and on adversarial inputs (long
+// runs, a match in every byte, dense escapes) and prints MB/s per version.
+// The libc column is memmem/memchr where an equivalent exists, and a
+// byte-at-a-time loop for WebSocket unmasking.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "scan.h"
+
+#define MAX_IMPLS 4
+#define MIN_SECS 0.15
+
+enum kernel {
+    K_HEAD_END, K_FIND_AMP_EQ, K_FIND_QMARK, K_TARGET_END, K_CTL, K_DECODE_FORM, K_DECODE_STRICT, K_UNMASK,
+};
+
+struct bench_case {
+    const char *name;
+    enum kernel kernel;
+    char *data;
+    size_t len;
+};
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static char *repeat(const char *unit, size_t len) {
+    char *s = malloc(len + 1);
+    size_t n = strlen(unit);
+    for (size_t i = 0; i < len; i++) s[i] = unit[i % n];
+    s[len] = '\0';
+    return s;
+}
+
+static volatile size_t sink;
+static char out[1 << 16];
+
+// One call of the kernel on the case; impl NULL selects the libc reference
+static void run_once(const struct scan_ops *impl, const struct bench_case *bc) {
+    const char *d = bc->data;
+    size_t n = bc->len;
+    switch (bc->kernel) {
+    case K_HEAD_END:
+        if (impl) {
+            sink += impl->head_end(d, n);
+        } else {
+            const char *p = memmem(d, n, "\r\n\r\n", 4);
+            sink += p ? (size_t)(p - d) : n;
+        }
+        break;
+    case K_FIND_AMP_EQ:
+        // Tokenise the whole string the way query parsing does
+        for (size_t i = 0; i < n; i++) i += impl->find2(d + i, n - i, '&', '=');
+        sink += n;
+        break;
+    case K_FIND_QMARK:
+        if (impl) {
+            sink += impl->find2(d, n, '?', '?');
+        } else {
+            const char *p = memchr(d, '?', n);
+            sink += p ? (size_t)(p - d) : n;
+        }
+        break;
+    case K_TARGET_END:
+        sink += impl->target_end(d, n);
+        break;
+    case K_CTL:
+        sink += impl->ctl(d, n);
+        break;
+    case K_DECODE_FORM:
+        sink += (size_t)impl->pct_decode(out, d, n, SCAN_FORM);
+        break;
+    case K_DECODE_STRICT:
+        sink += (size_t)impl->pct_decode(out, d, n, SCAN_STRICT);
+        break;
+    case K_UNMASK: {
+        // Unmasking is in place; toggling the case data back and forth
+        // leaves it unchanged for the next round
+        static const unsigned char mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+        char *p = bc->data;
+        if (impl) {
+            impl->unmask(p, n, mask, 1);
+        } else {
+            for (size_t i = 0; i < n; i++) p[i] ^= (char)mask[(i + 1) & 3];
+        }
+        sink += (unsigned char)p[0];
+        break;
+    }
+    }
+}
+
+static double measure(const struct scan_ops *impl, const struct bench_case *bc) {
+    long iters = 1;
+    for (;;) {
+        double start = now_sec();
+        for (long i = 0; i < iters; i++) run_once(impl, bc);
+        double secs = now_sec() - start;
+        if (secs >= MIN_SECS) return (double)bc->len * iters / secs / 1e6;
+        iters *= 2;
+    }
+}
+
+static int has_libc(enum kernel k) {
+    return k == K_HEAD_END || k == K_FIND_QMARK || k == K_UNMASK;
+}
+
+int main(void) {
+    const char *browser_head =
+        "GET /static/css/site.css?v=3 HTTP/1.1\r\n"
+        "Host: example.test\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"
+        "Accept: text/css,*/*;q=0.1\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+        "Referer: https://example.test/\r\n"
+        "Connection: keep-alive\r\n"
+        "Cookie: session=3f2a9c1e0b7d4e6f8a1b2c3d4e5f6071; theme=dark; lang=en\r\n"
+        "Sec-Fetch-Dest: style\r\n"
+        "Sec-Fetch-Mode: no-cors\r\n"
+        "Sec-Fetch-Site: same-origin\r\n\r\n";
+    struct bench_case cases[] = {
+        {"head end, browser request", K_HEAD_END, strdup(browser_head), 0},
+        {"head end, 8K of CRLF lines", K_HEAD_END, repeat("\r\nX", 8192), 0},
+        {"'?' in a short target", K_FIND_QMARK, strdup("/static/css/site.css?v=3"), 0},
+        {"'?' in a 4K target", K_FIND_QMARK, repeat("/abcdefgh", 4096), 0},
+        {"'&'/'=' split, form query", K_FIND_AMP_EQ, strdup("msg=hello+world&lang=en&page=2&sort=date&q=c%20web%20server"), 0},
+        {"'&'/'=' split, all delimiters", K_FIND_AMP_EQ, repeat("&=", 2048), 0},
+        {"target end, short path", K_TARGET_END, strdup("/static/css/site.css?v=3 HTTP/1.1\r\n"), 0},
+        {"target end, 4K path", K_TARGET_END, repeat("/a%2Fb-c_d", 4096), 0},
+        {"value end, user agent", K_CTL, strdup("Mozilla/5.0 (X11; Linux x86_64; rv:128.0) Gecko/20100101 Firefox/128.0\r\n"), 0},
+        {"value end, 4K cookie", K_CTL, repeat("k=v0123456789; ", 4096), 0},
+        {"decode, form message", K_DECODE_FORM, strdup("hello+world%21+this+is+a+typical+echo+message+with+a+few+words"), 0},
+        {"decode, plain 4K", K_DECODE_FORM, repeat("abcdefghijklmnopqrstuvwxyz0123456789", 4096), 0},
+        {"decode, 4K all escapes", K_DECODE_FORM, repeat("%41", 4095), 0},
+        {"decode, path", K_DECODE_STRICT, strdup("/static/img/my%20photo%20(1).jpg"), 0},
+        {"unmask, chat message", K_UNMASK, strdup("hello from the browser, how is everyone?"), 0},
+        {"unmask, 64K frame", K_UNMASK, repeat("payload ", 65536), 0},
+    };
+    size_t ncases = sizeof(cases) / sizeof(cases[0]);
+    for (size_t i = 0; i < ncases; i++) {
+        if (!cases[i].len) cases[i].len = strlen(cases[i].data);
+    }
+
+    const struct scan_ops *impls[MAX_IMPLS];
+    int n = scan_available(impls, MAX_IMPLS);
+
+    printf("%-32s %6s %9s", "MB/s", "bytes", "libc");
+    for (int k = 0; k < n; k++) printf(" %9s", impls[k]->name);
+    printf("\n");
+    for (size_t i = 0; i < ncases; i++) {
+        const struct bench_case *bc = &cases[i];
+        printf("%-32s %6zu", bc->name, bc->len);
+        if (has_libc(bc->kernel)) {
+            printf(" %9.0f", measure(NULL, bc));
+        } else {
+            printf(" %9s", "-");
+        }
+        for (int k = 0; k < n; k++) printf(" %9.0f", measure(impls[k], bc));
+        printf("\n");
+    }
+    for (size_t i = 0; i < ncases; i++) free(cases[i].data);
+    return 0;
+}
@@ -0,0 +1,66 @@
+// Timer wheel micro-benchmark: the cost of scheduling, rescheduling,
+// cancelling and firing timers with 1k to 4M of them pending, set 1 ms to
+// 60 s out like connection timeouts in ms ticks. Flat numbers across sizes
+// are the point.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "timerwheel.h"
+
+#define SPAN_MS 60000
+
+static long fired;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_expire(struct timer *t, void *arg) {
+    (void)t;
+    (void)arg;
+    fired++;
+}
+
+static void bench(long n) {
+    struct timer *timers = calloc((size_t)n, sizeof(*timers));
+    uint32_t *delays = malloc((size_t)n * sizeof(*delays));
+    struct timer_wheel *w = malloc(sizeof(*w));
+    if (!timers || !delays || !w) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    srand(1);
+    for (long i = 0; i < n; i++) delays[i] = 1 + (uint32_t)rand() % SPAN_MS;
+    uint64_t base = 1000000;
+    timer_wheel_init(w, base);
+
+    double t0 = now_sec();
+    for (long i = 0; i < n; i++) timer_add(w, &timers[i], base + delays[i]);
+    double t1 = now_sec();
+    // Like a keep-alive connection pushing its deadline out after a request
+    for (long i = 0; i < n; i++) timer_add(w, &timers[i], base + delays[n - 1 - i]);
+    double t2 = now_sec();
+    for (long i = 0; i < n; i += 2) timer_del(w, &timers[i]);
+    double t3 = now_sec();
+    // Moving timers down the levels on the way is part of the cost
+    fired = 0;
+    timer_wheel_advance(w, base + SPAN_MS, on_expire, NULL);
+    double t4 = now_sec();
+
+    printf("%-8ld %10.1f %10.1f %10.1f %10.1f\n", n, (t1 - t0) / n * 1e9, (t2 - t1) / n * 1e9,
+           (t3 - t2) / (n / 2) * 1e9, (t4 - t3) / (fired ? fired : 1) * 1e9);
+    if (fired != n / 2) fprintf(stderr, "fired %ld timers, expected %ld\n", fired, n / 2);
+    free(timers);
+    free(delays);
+    free(w);
+}
+
+int main(void) {
+    static const long sizes[] = {1000, 100000, 1000000, 4000000};
+    printf("%-8s %10s %10s %10s %10s   (ns per timer)\n", "timers", "add", "re-add", "cancel", "fire");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) bench(sizes[i]);
+    return 0;
+}
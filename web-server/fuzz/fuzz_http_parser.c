@@ -0,0 +1,386 @@
+// Fuzz target for the incremental request parser.
+//
+// Every input is parsed twice: in one call, and fed in pseudo-random pieces
+// the way reads arrive on a socket. Both runs must agree, and every slice of
+// a parsed request must lie inside its head. The whole parse uses the
+// scalar scanning kernels and the split one the widest the CPU has, and
+// every kernel version is checked against the scalar one on the raw input.
+// Whatever follows a parsed head is run through the body decoder the same
+// two ways, and the decoded body, where it ends and whether its framing
+// was bad must agree too. A table of chunked bodies with known outcomes
+// pins down which framing is accepted at all.
+// Built with -DUSE_LIBFUZZER the
+// file is a plain libFuzzer target; otherwise it carries a small driver that
+// replays a corpus and then mutates it, so it also runs under gcc + ASan.
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "http_parser.h"
+#include "scan.h"
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                             \
+        }                                                                        \
+    } while (0)
+
+static void check_slice(struct http_slice s, uint32_t head_len) {
+    CHECK(s.off <= head_len && s.len <= head_len - s.off);
+}
+
+static int same_slice(struct http_slice a, struct http_slice b) {
+    return a.off == b.off && a.len == b.len;
+}
+
+static const struct scan_ops *impls[4];
+static int nimpls;
+
+static void check_decode(const struct scan_ops *impl, const char *buf, size_t size, int mode, char *want, char *got) {
+    long n = impls[0]->pct_decode(want, buf, size, mode);
+    // In place, as the server's callers may do
+    memcpy(got, buf, size);
+    long m = impl->pct_decode(got, got, size, mode);
+    CHECK(n == m);
+    CHECK(n < 0 || (size_t)n <= size);
+    if (n > 0) CHECK(memcmp(want, got, (size_t)n) == 0);
+}
+
+static void check_kernels(const char *buf, size_t size) {
+    char *want = malloc(size + 1), *got = malloc(size + 1);
+    const struct scan_ops *ref = impls[0];
+    for (int i = 1; i < nimpls; i++) {
+        const struct scan_ops *impl = impls[i];
+        // Odd offsets exercise unaligned loads and short tails
+        for (size_t off = 0; off < 3 && off <= size; off++) {
+            const char *b = buf + off;
+            size_t n = size - off;
+            CHECK(impl->head_end(b, n) == ref->head_end(b, n));
+            CHECK(impl->find2(b, n, '?', '?') == ref->find2(b, n, '?', '?'));
+            CHECK(impl->find2(b, n, '&', '=') == ref->find2(b, n, '&', '='));
+            CHECK(impl->find2(b, n, '%', '+') == ref->find2(b, n, '%', '+'));
+            CHECK(impl->target_end(b, n) == ref->target_end(b, n));
+            CHECK(impl->ctl(b, n) == ref->ctl(b, n));
+        }
+        check_decode(impl, buf, size, SCAN_FORM, want, got);
+        check_decode(impl, buf, size, SCAN_STRICT, want, got);
+        // Unmasking from every starting phase of the key
+        static const unsigned char mask[4] = {0x12, 0x80, 0xff, 0x5a};
+        for (size_t pos = 0; pos < 4; pos++) {
+            memcpy(want, buf, size);
+            memcpy(got, buf, size);
+            ref->unmask(want, size, mask, pos);
+            impl->unmask(got, size, mask, pos);
+            CHECK(memcmp(want, got, size) == 0);
+            for (size_t j = 0; j < size; j++) CHECK((want[j] ^ buf[j]) == (char)mask[(pos + j) & 3]);
+        }
+    }
+    free(want);
+    free(got);
+}
+
+struct body_result {
+    enum http_body_status st;   // DONE, ERROR, or PARTIAL if input ran out
+    size_t end;                 // input consumed
+    uint64_t len;               // body bytes
+    uint32_t hash;
+};
+
+// Decodes buf[0, size) as a server would with reads of up to max_step
+// bytes: each call sees what arrived and was not consumed yet. A zero seed
+// hands everything over at once.
+static struct body_result decode_body(const struct http_request *req, const char *buf, size_t size,
+                                      uint32_t seed) {
+    struct http_body b;
+    http_body_init(&b, req);
+    struct body_result r = {HTTP_BODY_PARTIAL, 0, 0, 2166136261u};
+    size_t avail = seed ? 0 : size;
+    for (;;) {
+        size_t used = 0;
+        const char *data = NULL;
+        size_t data_len = 0;
+        enum http_body_status st = http_body_decode(&b, buf + r.end, avail - r.end, &used, &data, &data_len);
+        CHECK(used <= avail - r.end);
+        if (st == HTTP_BODY_DATA) {
+            CHECK(data >= buf + r.end && data + data_len <= buf + r.end + used && data_len > 0);
+            for (size_t i = 0; i < data_len; i++) r.hash = (r.hash ^ (unsigned char)data[i]) * 16777619u;
+            r.len += data_len;
+        }
+        r.end += used;
+        if (st == HTTP_BODY_DONE || st == HTTP_BODY_ERROR) {
+            r.st = st;
+            return r;
+        }
+        if (st == HTTP_BODY_PARTIAL) {
+            CHECK(r.end == avail);
+            if (avail == size) return r;
+            seed = seed * 1103515245u + 12345u;
+            size_t step = 1 + (seed >> 16) % 32;
+            avail = avail + step < size ? avail + step : size;
+        }
+    }
+}
+
+static void check_body(const struct http_request *req, const char *buf, size_t size, uint32_t seed) {
+    if (!http_has_body(req)) return;
+    struct body_result whole = decode_body(req, buf, size, 0);
+    struct body_result split = decode_body(req, buf, size, seed | 1);
+    CHECK(whole.st == split.st);
+    CHECK(whole.len == split.len && whole.hash == split.hash);
+    if (whole.st == HTTP_BODY_DONE) CHECK(whole.end == split.end);
+    if (req->content_length >= 0) {
+        CHECK(whole.st != HTTP_BODY_ERROR);
+        CHECK(whole.len <= (uint64_t)req->content_length);
+        if (whole.st == HTTP_BODY_DONE) CHECK(whole.len == (uint64_t)req->content_length);
+    }
+}
+
+// Chunked framing that must be accepted, or rejected because a peer could
+// read it differently
+static const struct {
+    const char *body;
+    enum http_body_status st;
+} framing[] = {
+    {"5\r\nhello\r\n0\r\n\r\n", HTTP_BODY_DONE},
+    {"005;a=b\r\nhello\r\n0\r\n\r\n", HTTP_BODY_DONE},
+    {"5 \t; a = \"b\"\r\nhello\r\n0\r\nX-T: 1\r\n\r\n", HTTP_BODY_DONE},
+    {"5zzz\r\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"0x5\r\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"5 \r\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {";\r\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"5\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"5;a\nb\r\nhello\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"5\r\nhello\n0\r\n\r\n", HTTP_BODY_ERROR},
+    {"5\r\nhelloX\r\n0\r\n\r\n", HTTP_BODY_ERROR},
+};
+
+static void check_framing(void) {
+    static const char head[] = "POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\n\r\n";
+    struct http_request req;
+    http_request_init(&req);
+    CHECK(http_parse_request(&req, head, sizeof(head) - 1) == HTTP_PARSE_DONE && req.chunked);
+    for (size_t i = 0; i < sizeof(framing) / sizeof(framing[0]); i++) {
+        const char *body = framing[i].body;
+        // Whole and in pieces
+        for (uint32_t seed = 0; seed < 2; seed++) {
+            struct body_result r = decode_body(&req, body, strlen(body), seed);
+            if (r.st != framing[i].st) {
+                fprintf(stderr, "framing case %zu decoded to %d, not %d\n", i, r.st, framing[i].st);
+                abort();
+            }
+            if (r.st == HTTP_BODY_DONE) CHECK(r.len == 5 && r.end == strlen(body));
+        }
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    const char *buf = (const char *)data;
+    if (!nimpls) {
+        nimpls = scan_available(impls, 4);
+        check_framing();
+    }
+    check_kernels(buf, size);
+
+    struct http_request whole;
+    http_request_init(&whole);
+    scan = *impls[0];
+    enum http_parse_status st = http_parse_request(&whole, buf, size);
+    scan = *impls[nimpls - 1];
+
+    // Split points come from a seed derived from the input itself, so a
+    // crash reproduces from the input alone
+    uint32_t seed = 2166136261u;
+    for (size_t i = 0; i < size && i < 64; i++) seed = (seed ^ data[i]) * 16777619u;
+    struct http_request split;
+    http_request_init(&split);
+    enum http_parse_status st2 = HTTP_PARSE_PARTIAL;
+    size_t fed = 0;
+    while (st2 == HTTP_PARSE_PARTIAL && fed < size) {
+        seed = seed * 1103515245u + 12345u;
+        size_t step = 1 + (seed >> 16) % 32;
+        fed = fed + step < size ? fed + step : size;
+        st2 = http_parse_request(&split, buf, fed);
+    }
+
+    CHECK(st == st2);
+    if (st == HTTP_PARSE_ERROR) {
+        CHECK(whole.error == split.error);
+        CHECK(whole.error >= 400 && whole.error < 600);
+        return 0;
+    }
+    if (st != HTTP_PARSE_DONE) return 0;
+
+    CHECK(whole.head_len <= size && whole.head_len <= HTTP_MAX_HEAD);
+    CHECK(whole.head_len == split.head_len);
+    CHECK(whole.nheaders == split.nheaders && whole.nheaders <= HTTP_MAX_HEADERS);
+    CHECK(same_slice(whole.method, split.method));
+    CHECK(same_slice(whole.target, split.target));
+    CHECK(same_slice(whole.path, split.path));
+    CHECK(same_slice(whole.query, split.query));
+    CHECK(whole.method.len > 0 && whole.method.len <= HTTP_MAX_METHOD);
+    CHECK(whole.target.len > 0 && whole.target.len <= HTTP_MAX_TARGET);
+    check_slice(whole.method, whole.head_len);
+    check_slice(whole.target, whole.head_len);
+    check_slice(whole.path, whole.head_len);
+    check_slice(whole.query, whole.head_len);
+    for (unsigned i = 0; i < whole.nheaders; i++) {
+        CHECK(same_slice(whole.headers[i].name, split.headers[i].name));
+        CHECK(same_slice(whole.headers[i].value, split.headers[i].value));
+        check_slice(whole.headers[i].name, whole.head_len);
+        check_slice(whole.headers[i].value, whole.head_len);
+        CHECK(whole.headers[i].name.len > 0);
+        if (whole.headers[i].value.len) {
+            char first = buf[whole.headers[i].value.off];
+            char last = buf[whole.headers[i].value.off + whole.headers[i].value.len - 1];
+            CHECK(first != ' ' && first != '\t' && last != ' ' && last != '\t');
+        }
+    }
+    CHECK(!(whole.has_transfer_encoding && whole.content_length >= 0));
+    CHECK(whole.content_length == split.content_length && whole.chunked == split.chunked);
+    check_body(&whole, buf + whole.head_len, size - whole.head_len, seed);
+    return 0;
+}
+
+#ifndef USE_LIBFUZZER
+
+#define FUZZ_MAX_INPUT (HTTP_MAX_HEAD + 1024)
+#define MAX_CORPUS 1024
+
+static unsigned char *corpus[MAX_CORPUS];
+static size_t corpus_len[MAX_CORPUS];
+static int corpus_n;
+
+static void load_file(const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f || corpus_n == MAX_CORPUS) {
+        if (f) fclose(f);
+        return;
+    }
+    unsigned char *data = malloc(FUZZ_MAX_INPUT);
+    size_t n = fread(data, 1, FUZZ_MAX_INPUT, f);
+    fclose(f);
+    corpus[corpus_n] = data;
+    corpus_len[corpus_n++] = n;
+}
+
+static void load_path(const char *path) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        perror(path);
+        exit(1);
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        load_file(path);
+        return;
+    }
+    DIR *d = opendir(path);
+    struct dirent *de;
+    while (d && (de = readdir(d))) {
+        if (de->d_name[0] == '.') continue;
+        char full[4096];
+        snprintf(full, sizeof(full), "%s/%s", path, de->d_name);
+        load_file(full);
+    }
+    if (d) closedir(d);
+}
+
+static uint64_t rng_state = 88172645463325252ull;
+
+static uint32_t rnd(uint32_t n) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state % n);
+}
+
+// Tokens that steer mutations toward parser edge cases
+static const char *const dict[] = {
+    "\r\n", "\n", "\r", "\r\n\r\n", " ", "\t", ":", "?", "%", "HTTP/1.1", "HTTP/1.0",
+    "Content-Length: ", "Transfer-Encoding: chunked", "Connection: close", "\0",
+    "0\r\n\r\n", ";", "ffffffff",
+};
+
+static size_t mutate(unsigned char *buf, size_t len) {
+    int rounds = 1 + (int)rnd(4);
+    for (int r = 0; r < rounds; r++) {
+        switch (rnd(5)) {
+        case 0:     // flip a byte
+            if (len) buf[rnd((uint32_t)len)] = (unsigned char)rnd(256);
+            break;
+        case 1:     // delete a run
+            if (len) {
+                size_t at = rnd((uint32_t)len);
+                size_t n = 1 + rnd(16);
+                if (n > len - at) n = len - at;
+                memmove(buf + at, buf + at + n, len - at - n);
+                len -= n;
+            }
+            break;
+        case 2: {   // insert a dictionary token
+            const char *tok = dict[rnd(sizeof(dict) / sizeof(dict[0]))];
+            size_t n = tok[0] ? strlen(tok) : 1;
+            size_t at = rnd((uint32_t)len + 1);
+            if (len + n > FUZZ_MAX_INPUT) break;
+            memmove(buf + at + n, buf + at, len - at);
+            memcpy(buf + at, tok, n);
+            len += n;
+            break;
+        }
+        case 3: {   // duplicate a run, growing toward the limits
+            if (!len) break;
+            size_t at = rnd((uint32_t)len);
+            size_t n = 1 + rnd(512);
+            if (n > len - at) n = len - at;
+            if (len + n > FUZZ_MAX_INPUT) break;
+            memmove(buf + at + n, buf + at, len - at);
+            len += n;
+            break;
+        }
+        default: {  // splice in the tail of another input
+            int other = (int)rnd((uint32_t)corpus_n);
+            size_t at = rnd((uint32_t)len + 1);
+            size_t from = rnd((uint32_t)corpus_len[other] + 1);
+            size_t n = corpus_len[other] - from;
+            if (at + n > FUZZ_MAX_INPUT) n = FUZZ_MAX_INPUT - at;
+            memcpy(buf + at, corpus[other] + from, n);
+            len = at + n;
+            break;
+        }
+        }
+    }
+    return len;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <corpus dir or file>... (FUZZ_ITERS=n, FUZZ_SEED=n)\n", argv[0]);
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) load_path(argv[i]);
+    if (!corpus_n) {
+        fprintf(stderr, "empty corpus\n");
+        return 1;
+    }
+    for (int i = 0; i < corpus_n; i++) LLVMFuzzerTestOneInput(corpus[i], corpus_len[i]);
+    printf("replayed %d corpus inputs\n", corpus_n);
+
+    long iters = getenv("FUZZ_ITERS") ? atol(getenv("FUZZ_ITERS")) : 200000;
+    if (getenv("FUZZ_SEED")) rng_state = strtoull(getenv("FUZZ_SEED"), NULL, 10) | 1;
+    unsigned char *buf = malloc(FUZZ_MAX_INPUT);
+    for (long i = 0; i < iters; i++) {
+        int pick = (int)rnd((uint32_t)corpus_n);
+        memcpy(buf, corpus[pick], corpus_len[pick]);
+        size_t len = mutate(buf, corpus_len[pick]);
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    printf("ran %ld mutated inputs\n", iters);
+    free(buf);
+    return 0;
+}
+
+#endif // USE_LIBFUZZER
@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "handoff.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define HANDOFF_BATCH 64    // descriptors per message; the kernel takes at most 253
+
+extern char **environ;
+
+// Each message carries the total count and how many descriptors ride on it
+struct handoff_hdr {
+    uint32_t total;
+    uint32_t count;
+};
+
+pid_t handoff_spawn(const char *exe, char *const argv[], int *sock) {
+    // Sequenced packets keep each batch of descriptors with its header
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) return -1;
+
+    // The environment is built before forking, as the child of a threaded
+    // process may only make async-signal-safe calls
+    size_t n = 0;
+    while (environ[n]) n++;
+    char **envp = malloc((n + 2) * sizeof(*envp));
+    if (!envp) {
+        close(sv[0]);
+        close(sv[1]);
+        return -1;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strncmp(environ[i], HANDOFF_ENV "=", sizeof(HANDOFF_ENV)) != 0) envp[k++] = environ[i];
+    }
+    char var[sizeof(HANDOFF_ENV) + 16];
+    snprintf(var, sizeof(var), HANDOFF_ENV "=%d", sv[1]);
+    envp[k++] = var;
+    envp[k] = NULL;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // The successor starts with no signals blocked, and sv[1] is the
+        // only descriptor that survives the exec
+        sigset_t none;
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        if (fcntl(sv[1], F_SETFD, 0) == 0) execve(exe, argv, envp);
+        _exit(127);
+    }
+    int err = errno;
+    free(envp);
+    close(sv[1]);
+    if (pid < 0) {
+        close(sv[0]);
+        errno = err;
+        return -1;
+    }
+    *sock = sv[0];
+    return pid;
+}
+
+int handoff_send_fds(int sock, const int *fds, int n) {
+    for (int off = 0; off < n; off += HANDOFF_BATCH) {
+        int batch = n - off < HANDOFF_BATCH ? n - off : HANDOFF_BATCH;
+        struct handoff_hdr hdr = {.total = (uint32_t)n, .count = (uint32_t)batch};
+        union {
+            char buf[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+            struct cmsghdr align;
+        } u;
+        memset(&u, 0, sizeof(u));
+        struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = u.buf,
+            .msg_controllen = CMSG_SPACE(sizeof(int) * (size_t)batch),
+        };
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * (size_t)batch);
+        memcpy(CMSG_DATA(cm), fds + off, sizeof(int) * (size_t)batch);
+        if (sendmsg(sock, &msg, MSG_NOSIGNAL) < 0) return -1;
+    }
+    return 0;
+}
+
+int handoff_wait_ready(int sock, int timeout_ms) {
+    struct pollfd pfd = {.fd = sock, .events = POLLIN};
+    int rc;
+    do rc = poll(&pfd, 1, timeout_ms);
+    while (rc < 0 && errno == EINTR);
+    if (rc <= 0) return -1;
+    char c;
+    return recv(sock, &c, 1, 0) == 1 ? 0 : -1;
+}
+
+int handoff_inherited(void) {
+    const char *v = getenv(HANDOFF_ENV);
+    if (!v) return -1;
+    char *end;
+    long fd = strtol(v, &end, 10);
+    int ok = end != v && *end == '\0' && fd >= 0 && fd <= INT32_MAX;
+    // Not passed on to anything this process starts
+    unsetenv(HANDOFF_ENV);
+    if (!ok || fcntl((int)fd, F_SETFD, FD_CLOEXEC) < 0) return -1;
+    return (int)fd;
+}
+
+int handoff_recv_fds(int sock, int *fds, int max) {
+    int got = 0;
+    uint32_t seen = 0, total = 1;
+    while (seen < total) {
+        struct handoff_hdr hdr;
+        union {
+            char buf[CMSG_SPACE(sizeof(int) * HANDOFF_BATCH)];
+            struct cmsghdr align;
+        } u;
+        struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = u.buf, .msg_controllen = sizeof(u.buf)};
+        ssize_t r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        if (r != (ssize_t)sizeof(hdr) || (msg.msg_flags & MSG_CTRUNC) || hdr.count == 0) goto fail;
+        total = hdr.total;
+        uint32_t carried = 0;
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+            size_t k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < k; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cm) + i * sizeof(int), sizeof(int));
+                if (got < max) fds[got++] = fd;
+                else close(fd);
+                carried++;
+            }
+        }
+        if (carried != hdr.count) goto fail;
+        seen += carried;
+    }
+    return got;
+fail:
+    while (got > 0) close(fds[--got]);
+    return -1;
+}
+
+int handoff_ready(int sock) {
+    return send(sock, "R", 1, MSG_NOSIGNAL) == 1 ? 0 : -1;
+}
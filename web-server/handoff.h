@@ -0,0 +1,39 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <sys/types.h>
+
+// Listening socket handoff for restarts without downtime. The running
+// server starts its successor with handoff_spawn(), which passes a Unix
+// socket in the environment, and sends it the listeners with SCM_RIGHTS.
+// The successor takes them over instead of binding its own, so the accept
+// queues carry on and no connection is refused. Once its workers run it
+// reports ready; only then does the old server stop accepting and drain.
+
+#define HANDOFF_ENV "WEBSERVER_HANDOFF_FD"
+#define HANDOFF_FDS_MAX 1024
+
+// Forks and executes exe with argv, handing it one end of a new socket
+// pair through HANDOFF_ENV. Sets *sock to the other end and returns the
+// child's pid, or -1.
+pid_t handoff_spawn(const char *exe, char *const argv[], int *sock);
+
+// Sends the n descriptors in fds. Returns 0, or -1 with errno set.
+int handoff_send_fds(int sock, const int *fds, int n);
+
+// Waits up to timeout_ms for the successor's ready message. Returns 0, or -1
+// if it exited or ran out of time.
+int handoff_wait_ready(int sock, int timeout_ms);
+
+// In the successor: the socket from HANDOFF_ENV, removed from the
+// environment, or -1 if this is not a handoff
+int handoff_inherited(void);
+
+// Receives up to max descriptors sent by handoff_send_fds(). Returns how
+// many, or -1.
+int handoff_recv_fds(int sock, int *fds, int max);
+
+// Tells the old server to stop accepting
+int handoff_ready(int sock);
+
+#endif // HANDOFF_H
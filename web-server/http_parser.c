@@ -0,0 +1,432 @@
+#include "http_parser.h"
+
+#include <string.h>
+#include <strings.h>
+
+#include "scan.h"
+
+enum {
+    S_START,            // skipping empty lines before the request line
+    S_METHOD,
+    S_TARGET,
+    S_VERSION,
+    S_LINE_LF,          // CR ended the request line, LF must follow
+    S_HDR_START,        // start of a header line or of the blank line
+    S_HDR_NAME,
+    S_HDR_OWS,          // whitespace between colon and value
+    S_HDR_VALUE,
+    S_HDR_LF,           // CR ended a header line
+    S_HEAD_LF,          // CR of the blank line
+    S_DONE,
+    S_ERROR,
+};
+
+// RFC 9110 tchar: the bytes allowed in methods and header names
+static const unsigned char tchar[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 0, 1, 1, 1, 1, 1, 0, 0, 1, 1, 0, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0, 1, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+static struct http_slice slice(size_t off, size_t len) {
+    struct http_slice s = {(uint32_t)off, (uint32_t)len};
+    return s;
+}
+
+void http_request_init(struct http_request *req) {
+    memset(req, 0, sizeof(*req));
+    req->state = S_START;
+    req->content_length = -1;
+}
+
+static enum http_parse_status fail(struct http_request *req, size_t pos, int status) {
+    req->state = S_ERROR;
+    req->pos = (uint32_t)pos;
+    req->error = status;
+    return HTTP_PARSE_ERROR;
+}
+
+int http_slice_eq(const char *buf, struct http_slice s, const char *str) {
+    size_t n = strlen(str);
+    return s.len == n && memcmp(buf + s.off, str, n) == 0;
+}
+
+const struct http_header *http_find_header(const struct http_request *req, const char *buf, const char *name) {
+    size_t n = strlen(name);
+    for (unsigned i = 0; i < req->nheaders; i++) {
+        const struct http_header *h = &req->headers[i];
+        if (h->name.len == n && strncasecmp(buf + h->name.off, name, n) == 0) return h;
+    }
+    return NULL;
+}
+
+int http_value_has_token(const char *value, size_t len, const char *token) {
+    size_t tlen = strlen(token);
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && value[i] != ',') i++;
+        size_t end = i;
+        while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t')) end--;
+        if (end - start == tlen && strncasecmp(value + start, token, tlen) == 0) return 1;
+    }
+    return 0;
+}
+
+// Whether the last coding in a Transfer-Encoding value is chunked
+static int ends_in_chunked(const char *value, size_t len) {
+    while (len && (value[len - 1] == ' ' || value[len - 1] == '\t' || value[len - 1] == ',')) len--;
+    size_t start = len;
+    while (start && value[start - 1] != ',' && value[start - 1] != ' ' && value[start - 1] != '\t') start--;
+    return len - start == 7 && strncasecmp(value + start, "chunked", 7) == 0;
+}
+
+// Whether a Transfer-Encoding value names codings other than chunked
+static int has_other_coding(const char *value, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ',')) i++;
+        size_t start = i;
+        while (i < len && value[i] != ',') i++;
+        size_t end = i;
+        while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t')) end--;
+        if (end > start && !(end - start == 7 && strncasecmp(value + start, "chunked", 7) == 0)) return 1;
+    }
+    return 0;
+}
+
+// Extracts the framing and connection headers once the head is complete
+static enum http_parse_status finish(struct http_request *req, const char *buf) {
+    const char *target = buf + req->target.off;
+    const char *q = memchr(target, '?', req->target.len);
+    if (q) {
+        size_t path_len = (size_t)(q - target);
+        req->path = slice(req->target.off, path_len);
+        req->query = slice(req->target.off + path_len + 1, req->target.len - path_len - 1);
+    } else {
+        req->path = req->target;
+        req->query = slice(req->target.off + req->target.len, 0);
+    }
+
+    int other_coding = 0, hosts = 0;
+    for (unsigned i = 0; i < req->nheaders; i++) {
+        const struct http_header *h = &req->headers[i];
+        const char *name = buf + h->name.off;
+        const char *value = buf + h->value.off;
+        if (h->name.len == 14 && strncasecmp(name, "Content-Length", 14) == 0) {
+            if (h->value.len == 0 || h->value.len > 18) return fail(req, req->head_len, 400);
+            long long n = 0;
+            for (uint32_t k = 0; k < h->value.len; k++) {
+                if (value[k] < '0' || value[k] > '9') return fail(req, req->head_len, 400);
+                n = n * 10 + (value[k] - '0');
+            }
+            // Repeated Content-Length headers must agree
+            if (req->content_length >= 0 && req->content_length != n) return fail(req, req->head_len, 400);
+            req->content_length = n;
+        } else if (h->name.len == 17 && strncasecmp(name, "Transfer-Encoding", 17) == 0) {
+            // A later header continues the list, so its last coding counts
+            req->has_transfer_encoding = 1;
+            req->chunked = ends_in_chunked(value, h->value.len);
+            if (has_other_coding(value, h->value.len)) other_coding = 1;
+        } else if (h->name.len == 10 && strncasecmp(name, "Connection", 10) == 0) {
+            if (http_value_has_token(value, h->value.len, "close")) req->conn_close = 1;
+            if (http_value_has_token(value, h->value.len, "keep-alive")) req->conn_keep_alive = 1;
+        } else if (h->name.len == 4 && strncasecmp(name, "Host", 4) == 0) {
+            hosts++;
+        }
+    }
+    // An HTTP/1.1 request names exactly one host; none, or two that could
+    // disagree, is refused (RFC 9112 3.2)
+    if (hosts > 1 || (hosts == 0 && req->version_minor >= 1)) return fail(req, req->head_len, 400);
+    if (req->has_transfer_encoding) {
+        // Both framings at once is a smuggling vector; refuse it (RFC 9112
+        // 6.1). Without chunked last the body has no end (6.3), and
+        // HTTP/1.0 framing with Transfer-Encoding is not to be trusted.
+        if (req->content_length >= 0 || !req->chunked || req->version_minor == 0) {
+            return fail(req, req->head_len, 400);
+        }
+        // Codings under chunked, gzip and the like, are not decoded
+        if (other_coding) return fail(req, req->head_len, 501);
+    }
+
+    req->state = S_DONE;
+    return HTTP_PARSE_DONE;
+}
+
+enum http_parse_status http_parse_request(struct http_request *req, const char *buf, size_t len) {
+    if (req->state == S_DONE) return HTTP_PARSE_DONE;
+    if (req->state == S_ERROR) return HTTP_PARSE_ERROR;
+
+    const unsigned char *b = (const unsigned char *)buf;
+    size_t limit = len < HTTP_MAX_HEAD ? len : HTTP_MAX_HEAD;
+    size_t p = req->pos;
+    size_t mark = req->mark;
+
+    while (p < limit) {
+        switch (req->state) {
+        case S_START:
+            // RFC 9112 2.2: ignore empty lines ahead of the request line
+            if (b[p] == '\r' || b[p] == '\n') {
+                p++;
+                continue;
+            }
+            mark = p;
+            req->state = S_METHOD;
+            // fall through
+        case S_METHOD:
+            while (p < limit && tchar[b[p]]) p++;
+            if (p - mark > HTTP_MAX_METHOD) return fail(req, p, 501);
+            if (p == limit) break;
+            if (b[p] != ' ' || p == mark) return fail(req, p, 400);
+            req->method = slice(mark, p - mark);
+            mark = ++p;
+            req->state = S_TARGET;
+            continue;
+        case S_TARGET:
+            p += scan.target_end(buf + p, limit - p);
+            if (p - mark > HTTP_MAX_TARGET) return fail(req, p, 414);
+            if (p == limit) break;
+            if (b[p] != ' ' || p == mark) return fail(req, p, 400);
+            req->target = slice(mark, p - mark);
+            mark = ++p;
+            req->state = S_VERSION;
+            continue;
+        case S_VERSION:
+            while (p < limit && b[p] != '\r' && b[p] != '\n') {
+                if (p - mark >= 8) return fail(req, p, 400);
+                p++;
+            }
+            if (p == limit) break;
+            if (p - mark != 8 || memcmp(buf + mark, "HTTP/", 5) != 0 || buf[mark + 6] != '.' ||
+                b[mark + 5] < '0' || b[mark + 5] > '9' || b[mark + 7] < '0' || b[mark + 7] > '9') {
+                return fail(req, p, 400);
+            }
+            if (buf[mark + 5] != '1') return fail(req, p, 505);
+            req->version_minor = buf[mark + 7] - '0';
+            req->state = b[p] == '\r' ? S_LINE_LF : S_HDR_START;
+            p++;
+            continue;
+        case S_LINE_LF:
+        case S_HDR_LF:
+            if (b[p] != '\n') return fail(req, p, 400);
+            p++;
+            req->state = S_HDR_START;
+            continue;
+        case S_HDR_START:
+            if (b[p] == '\r') {
+                p++;
+                req->state = S_HEAD_LF;
+                continue;
+            }
+            if (b[p] == '\n') {
+                p++;
+                req->head_len = (uint32_t)p;
+                req->pos = (uint32_t)p;
+                return finish(req, buf);
+            }
+            // Line folding (obs-fold) is rejected, RFC 9112 5.2
+            if (b[p] == ' ' || b[p] == '\t') return fail(req, p, 400);
+            if (req->nheaders == HTTP_MAX_HEADERS) return fail(req, p, 431);
+            mark = p;
+            req->state = S_HDR_NAME;
+            // fall through
+        case S_HDR_NAME:
+            while (p < limit && tchar[b[p]]) p++;
+            if (p == limit) break;
+            // No whitespace is allowed between the name and the colon
+            if (b[p] != ':' || p == mark) return fail(req, p, 400);
+            req->headers[req->nheaders].name = slice(mark, p - mark);
+            p++;
+            req->state = S_HDR_OWS;
+            continue;
+        case S_HDR_OWS:
+            while (p < limit && (b[p] == ' ' || b[p] == '\t')) p++;
+            if (p == limit) break;
+            mark = p;
+            req->value_end = (uint32_t)p;
+            req->state = S_HDR_VALUE;
+            // fall through
+        case S_HDR_VALUE:
+            // Skip to the next control byte, then trim the spaces before it
+            while (p < limit) {
+                size_t stop = p + scan.ctl(buf + p, limit - p);
+                size_t end = stop;
+                while (end > p && b[end - 1] == ' ') end--;
+                if (end > p) req->value_end = (uint32_t)end;
+                p = stop;
+                if (p == limit || b[p] != '\t') break;
+                p++;
+            }
+            if (p == limit) break;
+            if (b[p] != '\r' && b[p] != '\n') return fail(req, p, 400);
+            req->headers[req->nheaders].value = slice(mark, req->value_end - mark);
+            req->nheaders++;
+            req->state = b[p] == '\r' ? S_HDR_LF : S_HDR_START;
+            p++;
+            continue;
+        case S_HEAD_LF:
+            if (b[p] != '\n') return fail(req, p, 400);
+            p++;
+            req->head_len = (uint32_t)p;
+            req->pos = (uint32_t)p;
+            return finish(req, buf);
+        }
+        break;
+    }
+
+    req->pos = (uint32_t)p;
+    req->mark = (uint32_t)mark;
+    if (p >= HTTP_MAX_HEAD) {
+        return fail(req, p, req->state == S_TARGET ? 414 : 431);
+    }
+    return HTTP_PARSE_PARTIAL;
+}
+
+// Body decoder states
+enum {
+    B_LENGTH,           // Content-Length bytes
+    B_SIZE,             // hex digits of a chunk size
+    B_SIZE_BWS,         // blank space after the size, which only ';' may follow
+    B_EXT,              // chunk extensions, skipped to the end of the line
+    B_SIZE_LF,          // CR ended the chunk-size line
+    B_DATA,             // chunk data
+    B_DATA_CR,          // the line break after the data
+    B_DATA_LF,
+    B_TRAILER,          // start of a trailer line or of the final blank line
+    B_TRAILER_LINE,     // a trailer field, skipped
+    B_TRAILER_LF,       // CR ended a trailer line
+    B_END_LF,           // CR of the final blank line
+    B_DONE,
+    B_ERROR,
+};
+
+#define CHUNK_LINE_MAX 4096
+
+int http_has_body(const struct http_request *req) {
+    return req->chunked || req->content_length > 0;
+}
+
+void http_body_init(struct http_body *b, const struct http_request *req) {
+    memset(b, 0, sizeof(*b));
+    if (req->chunked) {
+        b->state = B_SIZE;
+    } else if (req->content_length > 0) {
+        b->state = B_LENGTH;
+        b->left = (uint64_t)req->content_length;
+    } else {
+        b->state = B_DONE;
+    }
+}
+
+static int hex_value(unsigned char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'f') return (ch | 0x20) - 'a' + 10;
+    return -1;
+}
+
+// The chunk-size line has ended; the zero-size chunk ends the body, though
+// trailers may follow
+static void chunk_begin(struct http_body *b) {
+    b->line_len = 0;
+    b->state = b->left ? B_DATA : B_TRAILER;
+}
+
+enum http_body_status http_body_decode(struct http_body *b, const char *buf, size_t len, size_t *used,
+                                       const char **data, size_t *data_len) {
+    const unsigned char *u = (const unsigned char *)buf;
+    size_t p = 0;
+    for (;;) {
+        if (b->state == B_LENGTH && b->left == 0) b->state = B_DONE;
+        if (b->state == B_DONE || b->state == B_ERROR || p == len) break;
+        switch (b->state) {
+        case B_LENGTH:
+        case B_DATA: {
+            size_t n = len - p < b->left ? len - p : (size_t)b->left;
+            *data = buf + p;
+            *data_len = n;
+            b->left -= n;
+            if (b->state == B_DATA && b->left == 0) b->state = B_DATA_CR;
+            *used = p + n;
+            return HTTP_BODY_DATA;
+        }
+        case B_SIZE: {
+            int d = hex_value(u[p]);
+            if (d < 0) {
+                // Anything but the end of the line or an extension after the
+                // digits is an error: "5zzz" and "0x5" are sizes a lenient
+                // peer would read differently
+                if (!b->line_len) b->state = B_ERROR;
+                else if (u[p] == '\r') b->state = B_SIZE_LF;
+                else if (u[p] == ';') b->state = B_EXT;
+                else if (u[p] == ' ' || u[p] == '\t') b->state = B_SIZE_BWS;
+                else b->state = B_ERROR;
+                p++;
+                continue;
+            }
+            // Sixty bits of size is more than anyone sends
+            if (b->left >> 60) {
+                b->state = B_ERROR;
+                continue;
+            }
+            b->left = b->left << 4 | (uint64_t)d;
+            b->line_len++;
+            p++;
+            continue;
+        }
+        case B_SIZE_BWS:
+            if (u[p] == ';') b->state = B_EXT;
+            else if (u[p] != ' ' && u[p] != '\t') b->state = B_ERROR;
+            else if (++b->line_len > CHUNK_LINE_MAX) b->state = B_ERROR;
+            p++;
+            continue;
+        case B_EXT:
+            // line_len counts the size digits too, limiting the whole line.
+            // The line ends in CRLF; no other control character belongs in it.
+            if (u[p] == '\r') b->state = B_SIZE_LF;
+            else if ((u[p] < 0x20 && u[p] != '\t') || u[p] == 0x7f) b->state = B_ERROR;
+            else if (++b->line_len > CHUNK_LINE_MAX) b->state = B_ERROR;
+            p++;
+            continue;
+        case B_SIZE_LF:
+            if (u[p++] == '\n') chunk_begin(b);
+            else b->state = B_ERROR;
+            continue;
+        case B_DATA_CR:
+            b->state = u[p] == '\r' ? B_DATA_LF : B_ERROR;
+            p++;
+            continue;
+        case B_DATA_LF:
+            b->state = u[p++] == '\n' ? B_SIZE : B_ERROR;
+            continue;
+        case B_TRAILER:
+            if (u[p] == '\r' || u[p] == '\n') {
+                b->state = u[p] == '\r' ? B_END_LF : B_DONE;
+                p++;
+            } else {
+                b->state = B_TRAILER_LINE;
+            }
+            continue;
+        case B_TRAILER_LINE:
+            if (u[p] == '\r') b->state = B_TRAILER_LF;
+            else if (u[p] == '\n') b->state = B_TRAILER;
+            else if (++b->trailer_len > HTTP_MAX_HEAD) b->state = B_ERROR;
+            p++;
+            continue;
+        case B_TRAILER_LF:
+        case B_END_LF:
+            if (u[p++] != '\n') b->state = B_ERROR;
+            else b->state = b->state == B_END_LF ? B_DONE : B_TRAILER;
+            continue;
+        }
+    }
+    *used = p;
+    if (b->state == B_DONE) return HTTP_BODY_DONE;
+    if (b->state == B_ERROR) return HTTP_BODY_ERROR;
+    return HTTP_BODY_PARTIAL;
+}
@@ -0,0 +1,111 @@
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Incremental HTTP/1.x request-head parser. It is fed the connection's
+// receive buffer as it grows and picks up where the previous call stopped,
+// so a request split across any number of reads parses the same as one
+// that arrived whole. Nothing is copied: the method, target and headers
+// are recorded as offsets into that buffer, which must therefore keep
+// the bytes in place until the request has been handled.
+
+#define HTTP_MAX_METHOD 16
+#define HTTP_MAX_TARGET 4096
+#define HTTP_MAX_HEADERS 64
+#define HTTP_MAX_HEAD 8192
+
+enum http_parse_status {
+    HTTP_PARSE_PARTIAL,     // need more bytes
+    HTTP_PARSE_DONE,        // head complete, see head_len
+    HTTP_PARSE_ERROR,       // malformed or over a limit, see error
+};
+
+// A byte range in the receive buffer
+struct http_slice {
+    uint32_t off;
+    uint32_t len;
+};
+
+struct http_header {
+    struct http_slice name;
+    struct http_slice value;    // surrounding whitespace removed
+};
+
+struct http_request {
+    // Parser state; private
+    int state;
+    uint32_t pos;           // next byte to look at
+    uint32_t mark;          // start of the token being scanned
+    uint32_t value_end;     // end of the header value without trailing space
+
+    // Results, valid once HTTP_PARSE_DONE is returned
+    struct http_slice method;
+    struct http_slice target;   // as sent, path plus query
+    struct http_slice path;     // target up to '?'
+    struct http_slice query;    // after '?', empty if none
+    int version_minor;          // HTTP/1.x
+    struct http_header headers[HTTP_MAX_HEADERS];
+    unsigned nheaders;
+    uint32_t head_len;          // bytes through the blank line
+
+    // Framing and connection headers, filled in when the head completes.
+    // Transfer-Encoding other than plain chunked, or in HTTP/1.0, is
+    // refused, so a body is framed by exactly one of the two.
+    long long content_length;   // -1 when absent
+    int chunked;                // Transfer-Encoding: chunked
+    int has_transfer_encoding;
+    int conn_close;             // Connection: close
+    int conn_keep_alive;        // Connection: keep-alive
+
+    int error;              // HTTP status to answer with on HTTP_PARSE_ERROR
+};
+
+void http_request_init(struct http_request *req);
+
+// Parses buf[0, len), continuing from the previous call on the same
+// request. len must not shrink between calls.
+enum http_parse_status http_parse_request(struct http_request *req, const char *buf, size_t len);
+
+// Case-insensitive lookup of the first header called name, or NULL
+const struct http_header *http_find_header(const struct http_request *req, const char *buf, const char *name);
+
+// Whether a comma-separated header value lists token (case-insensitive)
+int http_value_has_token(const char *value, size_t len, const char *token);
+
+int http_slice_eq(const char *buf, struct http_slice s, const char *str);
+
+// Incremental decoder for the body that follows a parsed head, framed by
+// Content-Length or by the chunked coding (RFC 9112 7.1). It is fed the
+// bytes after the head as they arrive and hands the body back as spans of
+// that input, so however large the body, nothing is copied or kept: the
+// caller consumes each span and drops the input it has used. Chunk
+// extensions and trailer fields are skipped.
+
+enum http_body_status {
+    HTTP_BODY_DATA,         // a span of body bytes, see data and data_len
+    HTTP_BODY_PARTIAL,      // need more bytes
+    HTTP_BODY_DONE,         // the body is complete
+    HTTP_BODY_ERROR,        // malformed chunked framing
+};
+
+struct http_body {
+    int state;              // private
+    uint64_t left;          // bytes left in the body or the current chunk
+    uint32_t line_len;      // of the chunk-size or trailer line being skipped
+    uint32_t trailer_len;
+};
+
+// Whether a parsed request has a body to read
+int http_has_body(const struct http_request *req);
+
+void http_body_init(struct http_body *b, const struct http_request *req);
+
+// Decodes from buf[0, len) and sets *used to the bytes consumed, which
+// must be dropped before the next call. HTTP_BODY_DATA points *data at
+// *data_len body bytes within buf; the other results leave them unset.
+enum http_body_status http_body_decode(struct http_body *b, const char *buf, size_t len, size_t *used,
+                                       const char **data, size_t *data_len);
+
+#endif // HTTP_PARSER_H
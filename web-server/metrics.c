@@ -0,0 +1,230 @@
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Counters are atomic only so that the scrape may read them while the
+// worker writes: the worker updates them with a relaxed load and store,
+// which compile to a plain add.
+struct metrics_route {
+    _Alignas(64) atomic_uint_fast64_t requests;
+    atomic_uint_fast64_t bytes;
+    atomic_uint_fast64_t sum_ns;
+    atomic_uint_fast64_t overflow;  // above the last bucket
+    atomic_uint_fast64_t hist[METRICS_HIST_BUCKETS];
+};
+
+struct metrics_shard {
+    _Alignas(64) atomic_int_fast64_t connections;
+    atomic_uint_fast64_t status[METRICS_STATUS_MAX];
+    atomic_uint_fast64_t timeouts[METRICS_TIMEOUT_KINDS];
+    atomic_uint_fast64_t shed[METRICS_SHED_REASONS];
+    struct metrics_route routes[];
+};
+
+static struct {
+    struct metrics_shard **shards;
+    int nshards;
+    const char *const *route_names;
+    int nroutes;
+} mx;
+
+static void bump(atomic_uint_fast64_t *p, uint64_t n) {
+    atomic_store_explicit(p, atomic_load_explicit(p, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static uint64_t get(const atomic_uint_fast64_t *p) {
+    return atomic_load_explicit(p, memory_order_relaxed);
+}
+
+static int bucket_of(uint64_t ns) {
+    if (ns < 4) return (int)ns;
+    int k = 63 - __builtin_clzll(ns);
+    return 4 * (k - 1) + (int)((ns >> (k - 2)) & 3);
+}
+
+// Exclusive upper bound of bucket i in nanoseconds
+static uint64_t bucket_limit(int i) {
+    if (i < 4) return (uint64_t)i + 1;
+    int k = i / 4 + 1;
+    return (uint64_t)(4 + i % 4 + 1) << (k - 2);
+}
+
+int metrics_init(int nshards, const char *const *route_names, int nroutes) {
+    mx.shards = calloc((size_t)nshards, sizeof(*mx.shards));
+    if (!mx.shards) return -1;
+    mx.nshards = nshards;
+    mx.route_names = route_names;
+    mx.nroutes = nroutes;
+    size_t size = sizeof(struct metrics_shard) + (size_t)nroutes * sizeof(struct metrics_route);
+    size = (size + 63) & ~(size_t)63;
+    for (int i = 0; i < nshards; i++) {
+        mx.shards[i] = aligned_alloc(64, size);
+        if (!mx.shards[i]) {
+            metrics_free();
+            return -1;
+        }
+        memset(mx.shards[i], 0, size);
+    }
+    return 0;
+}
+
+struct metrics_shard *metrics_shard(int i) {
+    return mx.shards && i < mx.nshards ? mx.shards[i] : NULL;
+}
+
+void metrics_record(struct metrics_shard *s, int route, int status, uint64_t bytes, uint64_t duration_ns) {
+    struct metrics_route *r = &s->routes[route];
+    bump(&r->requests, 1);
+    bump(&r->bytes, bytes);
+    bump(&r->sum_ns, duration_ns);
+    int b = bucket_of(duration_ns);
+    bump(b < METRICS_HIST_BUCKETS ? &r->hist[b] : &r->overflow, 1);
+    bump(&s->status[status >= 0 && status < METRICS_STATUS_MAX ? status : 0], 1);
+}
+
+void metrics_connections(struct metrics_shard *s, int delta) {
+    atomic_store_explicit(&s->connections, atomic_load_explicit(&s->connections, memory_order_relaxed) + delta,
+                          memory_order_relaxed);
+}
+
+void metrics_timeout(struct metrics_shard *s, enum metrics_timeout kind) {
+    bump(&s->timeouts[kind], 1);
+}
+
+void metrics_shed(struct metrics_shard *s, enum metrics_shed reason) {
+    bump(&s->shed[reason], 1);
+}
+
+char *metrics_render(size_t *len, const struct metrics_file_cache *fc) {
+    char *buf = NULL;
+    size_t n = 0;
+    FILE *f = open_memstream(&buf, &n);
+    if (!f) return NULL;
+
+    fprintf(f, "# HELP webserver_requests_total Requests handled, by route.\n"
+               "# TYPE webserver_requests_total counter\n");
+    for (int r = 0; r < mx.nroutes; r++) {
+        uint64_t v = 0;
+        for (int i = 0; i < mx.nshards; i++) v += get(&mx.shards[i]->routes[r].requests);
+        fprintf(f, "webserver_requests_total{route=\"%s\"} %llu\n", mx.route_names[r], (unsigned long long)v);
+    }
+
+    fprintf(f, "# HELP webserver_responses_total Responses sent, by status code.\n"
+               "# TYPE webserver_responses_total counter\n");
+    for (int code = 0; code < METRICS_STATUS_MAX; code++) {
+        uint64_t v = 0;
+        for (int i = 0; i < mx.nshards; i++) v += get(&mx.shards[i]->status[code]);
+        if (v) fprintf(f, "webserver_responses_total{code=\"%d\"} %llu\n", code, (unsigned long long)v);
+    }
+
+    fprintf(f, "# HELP webserver_response_bytes_total Response bytes queued, headers included, by route.\n"
+               "# TYPE webserver_response_bytes_total counter\n");
+    for (int r = 0; r < mx.nroutes; r++) {
+        uint64_t v = 0;
+        for (int i = 0; i < mx.nshards; i++) v += get(&mx.shards[i]->routes[r].bytes);
+        fprintf(f, "webserver_response_bytes_total{route=\"%s\"} %llu\n", mx.route_names[r],
+                (unsigned long long)v);
+    }
+
+    long long conns = 0;
+    for (int i = 0; i < mx.nshards; i++) {
+        conns += (long long)atomic_load_explicit(&mx.shards[i]->connections, memory_order_relaxed);
+    }
+    fprintf(f, "# HELP webserver_connections Open client connections.\n"
+               "# TYPE webserver_connections gauge\n"
+               "webserver_connections %lld\n", conns);
+
+    static const char *const timeout_names[METRICS_TIMEOUT_KINDS] = {"header", "body", "idle", "write"};
+    fprintf(f, "# HELP webserver_timeouts_total Connections closed for timing out, by what they waited on.\n"
+               "# TYPE webserver_timeouts_total counter\n");
+    for (int k = 0; k < METRICS_TIMEOUT_KINDS; k++) {
+        uint64_t v = 0;
+        for (int i = 0; i < mx.nshards; i++) v += get(&mx.shards[i]->timeouts[k]);
+        fprintf(f, "webserver_timeouts_total{kind=\"%s\"} %llu\n", timeout_names[k], (unsigned long long)v);
+    }
+
+    static const char *const shed_names[METRICS_SHED_REASONS] = {"connections", "inflight", "delay"};
+    fprintf(f, "# HELP webserver_shed_total Connections and requests turned away with 503, by the limit hit.\n"
+               "# TYPE webserver_shed_total counter\n");
+    for (int k = 0; k < METRICS_SHED_REASONS; k++) {
+        uint64_t v = 0;
+        for (int i = 0; i < mx.nshards; i++) v += get(&mx.shards[i]->shed[k]);
+        fprintf(f, "webserver_shed_total{reason=\"%s\"} %llu\n", shed_names[k], (unsigned long long)v);
+    }
+
+    if (fc) {
+        fprintf(f,
+                "# HELP webserver_file_cache_hits_total Static file requests served from the cache.\n"
+                "# TYPE webserver_file_cache_hits_total counter\n"
+                "webserver_file_cache_hits_total %llu\n"
+                "# HELP webserver_file_cache_misses_total Small static files read because the cache lacked them.\n"
+                "# TYPE webserver_file_cache_misses_total counter\n"
+                "webserver_file_cache_misses_total %llu\n"
+                "# HELP webserver_file_cache_evictions_total Cache entries dropped to make room.\n"
+                "# TYPE webserver_file_cache_evictions_total counter\n"
+                "webserver_file_cache_evictions_total %llu\n"
+                "# HELP webserver_file_cache_invalidations_total Cache entries dropped because their file changed.\n"
+                "# TYPE webserver_file_cache_invalidations_total counter\n"
+                "webserver_file_cache_invalidations_total %llu\n"
+                "# HELP webserver_file_cache_entries Files in the cache.\n"
+                "# TYPE webserver_file_cache_entries gauge\n"
+                "webserver_file_cache_entries %llu\n"
+                "# HELP webserver_file_cache_bytes Memory held by cached files and their compressed variants.\n"
+                "# TYPE webserver_file_cache_bytes gauge\n"
+                "webserver_file_cache_bytes %llu\n"
+                "# HELP webserver_file_cache_capacity_bytes Most memory the cache may hold.\n"
+                "# TYPE webserver_file_cache_capacity_bytes gauge\n"
+                "webserver_file_cache_capacity_bytes %llu\n",
+                (unsigned long long)fc->hits, (unsigned long long)fc->misses, (unsigned long long)fc->evictions,
+                (unsigned long long)fc->invalidations, (unsigned long long)fc->entries,
+                (unsigned long long)fc->bytes, (unsigned long long)fc->capacity);
+    }
+
+    // Only the span of buckets that ever saw a request is written. Counts
+    // never go down, so a bucket, once written, stays in every later scrape.
+    fprintf(f, "# HELP webserver_request_duration_seconds Time spent handling a request, by route.\n"
+               "# TYPE webserver_request_duration_seconds histogram\n");
+    for (int r = 0; r < mx.nroutes; r++) {
+        uint64_t hist[METRICS_HIST_BUCKETS] = {0};
+        uint64_t overflow = 0, sum_ns = 0;
+        for (int i = 0; i < mx.nshards; i++) {
+            const struct metrics_route *mr = &mx.shards[i]->routes[r];
+            for (int b = 0; b < METRICS_HIST_BUCKETS; b++) hist[b] += get(&mr->hist[b]);
+            overflow += get(&mr->overflow);
+            sum_ns += get(&mr->sum_ns);
+        }
+        int lo = 0, hi = METRICS_HIST_BUCKETS - 1;
+        while (lo <= hi && !hist[lo]) lo++;
+        while (hi >= lo && !hist[hi]) hi--;
+        uint64_t count = 0;
+        for (int b = lo; b <= hi; b++) {
+            count += hist[b];
+            fprintf(f, "webserver_request_duration_seconds_bucket{route=\"%s\",le=\"%.9g\"} %llu\n",
+                    mx.route_names[r], (double)bucket_limit(b) * 1e-9, (unsigned long long)count);
+        }
+        count += overflow;
+        fprintf(f,
+                "webserver_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n"
+                "webserver_request_duration_seconds_sum{route=\"%s\"} %.9f\n"
+                "webserver_request_duration_seconds_count{route=\"%s\"} %llu\n",
+                mx.route_names[r], (unsigned long long)count, mx.route_names[r], (double)sum_ns * 1e-9,
+                mx.route_names[r], (unsigned long long)count);
+    }
+
+    if (fclose(f) != 0) {
+        free(buf);
+        return NULL;
+    }
+    if (len) *len = n;
+    return buf;
+}
+
+void metrics_free(void) {
+    for (int i = 0; mx.shards && i < mx.nshards; i++) free(mx.shards[i]);
+    free(mx.shards);
+    mx.shards = NULL;
+    mx.nshards = 0;
+}
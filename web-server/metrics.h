@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Request metrics in Prometheus text format. Every worker records into a
+// shard of its own, which only it writes, so recording a request is a few
+// plain additions with no lock and no atomic read-modify-write. Shards are
+// cache-line aligned so workers never share a line. metrics_render() sums
+// the shards when /metrics is scraped.
+//
+// Latencies go into HDR-style histograms: below 4 ns one bucket per
+// nanosecond, then four buckets per power of two, so every bucket is within
+// 25% of its value from 4 ns up to 2^36 ns, about 68.7 s.
+
+#define METRICS_HIST_BUCKETS 140    // 4 + 4 per octave from 2^2 to 2^35 ns
+#define METRICS_STATUS_MAX 600      // codes at or above are counted as 0
+
+// Connections closed for taking too long, by what they were waiting on
+enum metrics_timeout {
+    METRICS_TIMEOUT_HEADER,
+    METRICS_TIMEOUT_BODY,
+    METRICS_TIMEOUT_IDLE,
+    METRICS_TIMEOUT_WRITE,
+    METRICS_TIMEOUT_KINDS,
+};
+
+// Work turned away with a 503, by the limit that was hit
+enum metrics_shed {
+    METRICS_SHED_CONNECTIONS,
+    METRICS_SHED_INFLIGHT,
+    METRICS_SHED_DELAY,
+    METRICS_SHED_REASONS,
+};
+
+struct metrics_shard;
+
+// The static file cache, as read when rendering
+struct metrics_file_cache {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;         // dropped to make room
+    uint64_t invalidations;     // dropped because the file changed
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t capacity;
+};
+
+// Allocates nshards shards with a counter set for each of the nroutes route
+// labels. The names are not copied.
+int metrics_init(int nshards, const char *const *route_names, int nroutes);
+
+// Shard i, or NULL before metrics_init()
+struct metrics_shard *metrics_shard(int i);
+
+// Counts one request on route, its status code, response bytes and the time
+// it took in nanoseconds. Only the shard's worker may call this.
+void metrics_record(struct metrics_shard *s, int route, int status, uint64_t bytes, uint64_t duration_ns);
+
+// Adds delta (+1 or -1) to the shard's open connection count
+void metrics_connections(struct metrics_shard *s, int delta);
+
+void metrics_timeout(struct metrics_shard *s, enum metrics_timeout kind);
+
+void metrics_shed(struct metrics_shard *s, enum metrics_shed reason);
+
+// The merged metrics, and fc if not NULL, as a malloc'ed Prometheus text
+// exposition, or NULL when out of memory
+char *metrics_render(size_t *len, const struct metrics_file_cache *fc);
+
+void metrics_free(void);
+
+#endif // METRICS_H
@@ -0,0 +1,59 @@
+#include "mime.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+
+struct mime_type {
+    const char *ext;
+    const char *type;
+};
+
+static const struct mime_type mime_types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"avif", "image/avif"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"otf", "font/otf"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+    {"mp3", "audio/mpeg"},
+    {"ogg", "audio/ogg"},
+    {"wav", "audio/wav"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+};
+
+const char *mime_type_for(const char *path) {
+    const char *slash = strrchr(path, '/');
+    const char *dot = strrchr(slash ? slash : path, '.');
+    if (dot && dot[1]) {
+        for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+            if (strcasecmp(dot + 1, mime_types[i].ext) == 0) return mime_types[i].type;
+        }
+    }
+    return "application/octet-stream";
+}
+
+int mime_compressible(const char *mime) {
+    return strncmp(mime, "text/", 5) == 0 || strncmp(mime, "application/json", 16) == 0 ||
+           strncmp(mime, "application/xml", 15) == 0 || strncmp(mime, "application/wasm", 16) == 0 ||
+           strncmp(mime, "image/svg+xml", 13) == 0;
+}
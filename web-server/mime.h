@@ -0,0 +1,14 @@
+#ifndef MIME_H
+#define MIME_H
+
+// Content types by file extension, shared by the server and the asset
+// bundler (tools/bundle.c)
+
+// The type for path's extension, application/octet-stream if unknown
+const char *mime_type_for(const char *path);
+
+// Text-like types are worth precompressing; images, fonts and media
+// usually are compressed already
+int mime_compressible(const char *mime);
+
+#endif // MIME_H
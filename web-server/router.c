@@ -0,0 +1,330 @@
+#include "router.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+struct node {
+    char *label;                // literal segment leading here
+    uint32_t label_len;
+    uint32_t hash;
+    int param_child;            // ":name" child, or -1
+    int wild_child;             // "*" child, or -1
+    int *kids;                  // literal children while building
+    int nkids;                  // kept after compiling
+    int first_slot;             // literal children once compiled
+    uint32_t slot_mask;
+    unsigned methods;
+    const void *targets[HTTP_METHOD_COUNT];
+    char *param_names[ROUTE_MAX_PARAMS];
+    unsigned nparams;
+};
+
+struct router {
+    struct node *nodes;
+    int nnodes;
+    int cap;
+    int *slots;                 // open-addressed child tables, -1 when empty
+    int compiled;
+};
+
+static const char *const method_names[HTTP_METHOD_COUNT] = {
+    "GET", "HEAD", "POST", "PUT", "DELETE", "OPTIONS", "PATCH",
+};
+
+static uint32_t hash_segment(const char *s, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int node_new(struct router *r, const char *label, size_t len) {
+    if (r->nnodes == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 16;
+        struct node *nodes = realloc(r->nodes, (size_t)cap * sizeof(*nodes));
+        if (!nodes) return -1;
+        r->nodes = nodes;
+        r->cap = cap;
+    }
+    struct node *n = &r->nodes[r->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->label = strndup(label, len);
+    if (!n->label) return -1;
+    n->label_len = (uint32_t)len;
+    n->hash = hash_segment(label, len);
+    n->param_child = -1;
+    n->wild_child = -1;
+    return r->nnodes++;
+}
+
+struct router *router_new(void) {
+    struct router *r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    if (node_new(r, "", 0) < 0) {
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+// The literal child of parent labelled seg, created if missing
+static int literal_child(struct router *r, int parent, const char *seg, size_t len) {
+    struct node *p = &r->nodes[parent];
+    for (int i = 0; i < p->nkids; i++) {
+        struct node *k = &r->nodes[p->kids[i]];
+        if (k->label_len == len && memcmp(k->label, seg, len) == 0) return p->kids[i];
+    }
+    int *kids = realloc(p->kids, (size_t)(p->nkids + 1) * sizeof(*kids));
+    if (!kids) return -1;
+    p->kids = kids;
+    int child = node_new(r, seg, len);
+    if (child < 0) return -1;
+    // node_new may have moved the array
+    p = &r->nodes[parent];
+    p->kids[p->nkids++] = child;
+    return child;
+}
+
+int router_add(struct router *r, unsigned methods, const char *pattern, const void *target) {
+    if (r->compiled || pattern[0] != '/' || !methods || methods >> HTTP_METHOD_COUNT) return -1;
+    char *names[ROUTE_MAX_PARAMS];
+    unsigned nnames = 0;
+    int n = 0;
+    const char *p = pattern + 1;
+    for (;;) {
+        const char *slash = strchr(p, '/');
+        size_t len = slash ? (size_t)(slash - p) : strlen(p);
+        int child;
+        if (len == 1 && p[0] == '*') {
+            if (slash) goto fail;  // "*" only as the last segment
+            child = r->nodes[n].wild_child;
+            if (child < 0) {
+                child = node_new(r, "*", 1);
+                if (child < 0) goto fail;
+                r->nodes[n].wild_child = child;
+            }
+        } else if (len > 1 && p[0] == ':') {
+            if (nnames == ROUTE_MAX_PARAMS) goto fail;
+            names[nnames] = strndup(p + 1, len - 1);
+            if (!names[nnames]) goto fail;
+            nnames++;
+            child = r->nodes[n].param_child;
+            if (child < 0) {
+                child = node_new(r, ":", 1);
+                if (child < 0) goto fail;
+                r->nodes[n].param_child = child;
+            }
+        } else {
+            child = literal_child(r, n, p, len);
+            if (child < 0) goto fail;
+        }
+        n = child;
+        if (!slash) break;
+        p = slash + 1;
+    }
+
+    struct node *leaf = &r->nodes[n];
+    if (leaf->methods & methods) goto fail;
+    if (leaf->methods) {
+        // Routes on one path share their capture names
+        if (leaf->nparams != nnames) goto fail;
+        for (unsigned i = 0; i < nnames; i++) {
+            if (strcmp(leaf->param_names[i], names[i]) != 0) goto fail;
+        }
+        for (unsigned i = 0; i < nnames; i++) free(names[i]);
+    } else {
+        memcpy(leaf->param_names, names, nnames * sizeof(names[0]));
+        leaf->nparams = nnames;
+    }
+    leaf->methods |= methods;
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+        if (methods & ROUTE_METHOD(m)) leaf->targets[m] = target;
+    }
+    return 0;
+
+fail:
+    for (unsigned i = 0; i < nnames; i++) free(names[i]);
+    return -1;
+}
+
+// Gives every node with literal children a power-of-two table, at most
+// half full, so a probe sequence stays short
+int router_compile(struct router *r) {
+    int total = 0;
+    for (int i = 0; i < r->nnodes; i++) {
+        struct node *n = &r->nodes[i];
+        uint32_t size = n->nkids ? 1 : 0;
+        while (size < (uint32_t)n->nkids * 2) size <<= 1;
+        n->first_slot = total;
+        n->slot_mask = size - 1;
+        total += (int)size;
+    }
+    r->slots = malloc((size_t)(total ? total : 1) * sizeof(*r->slots));
+    if (!r->slots) return -1;
+    memset(r->slots, 0xff, (size_t)total * sizeof(*r->slots));
+    for (int i = 0; i < r->nnodes; i++) {
+        struct node *n = &r->nodes[i];
+        for (int k = 0; k < n->nkids; k++) {
+            uint32_t h = r->nodes[n->kids[k]].hash;
+            while (r->slots[n->first_slot + (int)(h & n->slot_mask)] >= 0) h++;
+            r->slots[n->first_slot + (int)(h & n->slot_mask)] = n->kids[k];
+        }
+        free(n->kids);
+        n->kids = NULL;
+    }
+    r->compiled = 1;
+    return 0;
+}
+
+void router_free(struct router *r) {
+    if (!r) return;
+    for (int i = 0; i < r->nnodes; i++) {
+        struct node *n = &r->nodes[i];
+        free(n->label);
+        free(n->kids);
+        for (unsigned k = 0; k < n->nparams; k++) free(n->param_names[k]);
+    }
+    free(r->nodes);
+    free(r->slots);
+    free(r);
+}
+
+enum http_method http_method_parse(const char *s, size_t len) {
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+        if (strlen(method_names[m]) == len && memcmp(method_names[m], s, len) == 0) return (enum http_method)m;
+    }
+    return HTTP_METHOD_UNKNOWN;
+}
+
+const char *http_method_name(enum http_method m) {
+    return m < HTTP_METHOD_COUNT ? method_names[m] : "";
+}
+
+static int find_literal(const struct router *r, const struct node *n, const char *seg, size_t len) {
+    uint32_t h = hash_segment(seg, len);
+    for (;; h++) {
+        int child = r->slots[n->first_slot + (int)(h & n->slot_mask)];
+        if (child < 0) return -1;
+        const struct node *k = &r->nodes[child];
+        if (k->label_len == len && memcmp(k->label, seg, len) == 0) return child;
+    }
+}
+
+// Matches path[pos, len) below node n, where pos starts a segment. Returns
+// the node reached, or -1. Captures are recorded in m as they are taken.
+static int match_from(const struct router *r, int n, const char *path, size_t pos, size_t len,
+                      struct route_match *m) {
+    const struct node *node = &r->nodes[n];
+    const char *slash = memchr(path + pos, '/', len - pos);
+    size_t end = slash ? (size_t)(slash - path) : len;
+    int last = slash == NULL;
+
+    if (node->nkids) {
+        int child = find_literal(r, node, path + pos, end - pos);
+        if (child >= 0) {
+            int found = last ? (r->nodes[child].methods ? child : -1) : match_from(r, child, path, end + 1, len, m);
+            if (found >= 0) return found;
+        }
+    }
+    if (node->param_child >= 0 && end > pos && m->nparams < ROUTE_MAX_PARAMS) {
+        unsigned saved = m->nparams;
+        m->params[m->nparams].off = (uint32_t)pos;
+        m->params[m->nparams].len = (uint32_t)(end - pos);
+        m->nparams++;
+        int child = node->param_child;
+        int found = last ? (r->nodes[child].methods ? child : -1) : match_from(r, child, path, end + 1, len, m);
+        if (found >= 0) return found;
+        m->nparams = saved;
+    }
+    if (node->wild_child >= 0) {
+        m->rest.off = (uint32_t)(pos - 1);
+        m->rest.len = (uint32_t)(len - pos + 1);
+        return node->wild_child;
+    }
+    return -1;
+}
+
+// Splits the query string into name=value pairs; a pair without '=' has an
+// empty value
+static void parse_query(const char *buf, struct http_slice q, struct route_match *m) {
+    const char *s = buf + q.off;
+    size_t pos = 0;
+    m->nquery = 0;
+    while (pos < q.len && m->nquery < ROUTE_MAX_QUERY) {
+        size_t key_end = pos + scan.find2(s + pos, q.len - pos, '=', '&');
+        size_t pair_end = key_end;
+        size_t value = key_end;
+        if (key_end < q.len && s[key_end] == '=') {
+            value = key_end + 1;
+            const char *amp = memchr(s + value, '&', q.len - value);
+            pair_end = amp ? (size_t)(amp - s) : q.len;
+        }
+        if (key_end > pos || pair_end > value) {
+            struct route_query_pair *qp = &m->query[m->nquery++];
+            qp->name.off = q.off + (uint32_t)pos;
+            qp->name.len = (uint32_t)(key_end - pos);
+            qp->value.off = q.off + (uint32_t)value;
+            qp->value.len = (uint32_t)(pair_end - value);
+        }
+        pos = pair_end + 1;
+    }
+}
+
+enum route_status router_match(const struct router *r, const char *buf, const struct http_request *req,
+                               struct route_match *m) {
+    m->target = NULL;
+    m->allowed = 0;
+    m->param_names = NULL;
+    m->nparams = 0;
+    m->rest.off = req->path.off + req->path.len;
+    m->rest.len = 0;
+    m->nquery = 0;
+    m->method = http_method_parse(buf + req->method.off, req->method.len);
+
+    const char *path = buf;
+    size_t start = req->path.off;
+    size_t len = start + req->path.len;
+    if (req->path.len == 0 || path[start] != '/') return ROUTE_NOT_FOUND;
+    int n = match_from(r, 0, path, start + 1, len, m);
+    if (n < 0) return ROUTE_NOT_FOUND;
+
+    const struct node *leaf = &r->nodes[n];
+    // A GET route answers HEAD too, unless HEAD has a route of its own
+    // (RFC 9110 9.3.2)
+    enum http_method method = m->method;
+    m->allowed = leaf->methods;
+    if (m->allowed & ROUTE_METHOD(HTTP_GET)) m->allowed |= ROUTE_METHOD(HTTP_HEAD);
+    if (method == HTTP_HEAD && !(leaf->methods & ROUTE_METHOD(HTTP_HEAD))) method = HTTP_GET;
+    if (method == HTTP_METHOD_UNKNOWN || !(leaf->methods & ROUTE_METHOD(method))) {
+        return ROUTE_METHOD_NOT_ALLOWED;
+    }
+    m->target = leaf->targets[method];
+    m->param_names = (const char *const *)leaf->param_names;
+    parse_query(buf, req->query, m);
+    return ROUTE_FOUND;
+}
+
+int route_param(const struct route_match *m, const char *name, struct http_slice *value) {
+    for (unsigned i = 0; i < m->nparams; i++) {
+        if (strcmp(m->param_names[i], name) == 0) {
+            *value = m->params[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int route_query(const struct route_match *m, const char *buf, const char *name, struct http_slice *value) {
+    for (unsigned i = 0; i < m->nquery; i++) {
+        if (http_slice_eq(buf, m->query[i].name, name)) {
+            *value = m->query[i].value;
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,89 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include "http_parser.h"
+
+// Request router. Routes are registered with router_add() at startup and
+// router_compile() packs them into a trie of path segments. Each node keeps
+// its literal children in a small hash table, so a lookup costs one probe
+// per path segment however many routes exist. The compiled router is only
+// read afterwards and can be shared by all workers.
+//
+// Patterns are split on '/'. A segment ":name" captures one path segment.
+// A final "*" captures the rest of the path, which must have at least one
+// more segment (it may be empty, as in "/static/"). Any other segment
+// matches literally, case-sensitively. Literal segments are preferred over
+// captures. "/echo" matches only "/echo", not "/echo/" or "/echoXYZ".
+
+enum http_method {
+    HTTP_GET,
+    HTTP_HEAD,
+    HTTP_POST,
+    HTTP_PUT,
+    HTTP_DELETE,
+    HTTP_OPTIONS,
+    HTTP_PATCH,
+    HTTP_METHOD_COUNT,
+    HTTP_METHOD_UNKNOWN = HTTP_METHOD_COUNT,
+};
+
+#define ROUTE_METHOD(m) (1u << (m))
+
+#define ROUTE_MAX_PARAMS 8
+#define ROUTE_MAX_QUERY 16
+
+enum route_status {
+    ROUTE_FOUND,
+    ROUTE_NOT_FOUND,
+    ROUTE_METHOD_NOT_ALLOWED,   // the path exists, see allowed
+};
+
+struct route_query_pair {
+    struct http_slice name;
+    struct http_slice value;    // still percent-encoded
+};
+
+// Result of a lookup. Slices point into the request buffer.
+struct route_match {
+    const void *target;             // as given to router_add
+    enum http_method method;
+    unsigned allowed;               // ROUTE_METHOD() mask of the path's methods
+    const char *const *param_names;
+    struct http_slice params[ROUTE_MAX_PARAMS];
+    unsigned nparams;
+    struct http_slice rest;         // what "*" matched, from its leading '/'
+    struct route_query_pair query[ROUTE_MAX_QUERY];    // pairs past the limit are dropped
+    unsigned nquery;
+};
+
+struct router;
+
+struct router *router_new(void);
+
+// Registers target for the methods in the ROUTE_METHOD() mask. Returns -1
+// for a malformed pattern, a method already taken on the same path, or a
+// router that is already compiled.
+int router_add(struct router *r, unsigned methods, const char *pattern, const void *target);
+
+int router_compile(struct router *r);
+
+void router_free(struct router *r);
+
+enum http_method http_method_parse(const char *s, size_t len);
+
+const char *http_method_name(enum http_method m);
+
+// Looks up the request's method and path. On ROUTE_FOUND the captures and
+// the query string pairs are filled in as well. HEAD finds the GET route
+// of a path that has no HEAD route, and m->method stays HTTP_HEAD so the
+// caller can leave the body out.
+enum route_status router_match(const struct router *r, const char *buf, const struct http_request *req,
+                               struct route_match *m);
+
+// The capture called name, or -1
+int route_param(const struct route_match *m, const char *name, struct http_slice *value);
+
+// The first query pair called name, or -1
+int route_query(const struct route_match *m, const char *buf, const char *name, struct http_slice *value);
+
+#endif // ROUTER_H
@@ -0,0 +1,373 @@
+#include "scan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+static int hex_digit(unsigned char ch) {
+    if (ch >= '0' && ch <= '9') return ch - '0';
+    if (ch >= 'a' && ch <= 'f') return ch - 'a' + 10;
+    if (ch >= 'A' && ch <= 'F') return ch - 'A' + 10;
+    return -1;
+}
+
+// Value of the escape "%XY" at src[i], or -1 if it is malformed or cut off
+static int escape_value(const char *src, size_t i, size_t len) {
+    if (i + 2 >= len) return -1;
+    int hi = hex_digit((unsigned char)src[i + 1]);
+    int lo = hex_digit((unsigned char)src[i + 2]);
+    return hi < 0 || lo < 0 ? -1 : hi * 16 + lo;
+}
+
+// ---- Scalar ----
+
+static size_t head_end_scalar(const char *buf, size_t len) {
+    for (size_t i = 0; i + 3 < len; i++) {
+        if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n') return i;
+    }
+    return len;
+}
+
+static size_t find2_scalar(const char *buf, size_t len, char a, char b) {
+    for (size_t i = 0; i < len; i++) {
+        if (buf[i] == a || buf[i] == b) return i;
+    }
+    return len;
+}
+
+static size_t target_end_scalar(const char *buf, size_t len) {
+    const unsigned char *b = (const unsigned char *)buf;
+    for (size_t i = 0; i < len; i++) {
+        if (b[i] <= ' ' || b[i] == 0x7f) return i;
+    }
+    return len;
+}
+
+static size_t ctl_scalar(const char *buf, size_t len) {
+    const unsigned char *b = (const unsigned char *)buf;
+    for (size_t i = 0; i < len; i++) {
+        if (b[i] < ' ' || b[i] == 0x7f) return i;
+    }
+    return len;
+}
+
+// Decodes the single byte at src[*i], which may start an escape. Shared by
+// every version for the bytes their vector loops stop at.
+static int decode_one(char *dst, size_t *o, const char *src, size_t *i, size_t len, int mode) {
+    char ch = src[*i];
+    if (ch == '%') {
+        int v = escape_value(src, *i, len);
+        if (v >= 0) {
+            dst[(*o)++] = (char)v;
+            *i += 3;
+            return 0;
+        }
+        if (mode == SCAN_STRICT) return -1;
+    } else if (ch == '+' && mode == SCAN_FORM) {
+        ch = ' ';
+    }
+    dst[(*o)++] = ch;
+    (*i)++;
+    return 0;
+}
+
+// Decodes the vector block src[*i, *i + width) whose '%' (and '+') bytes
+// are the set bits of m. Plain runs between them are copied as they are;
+// an escape may run past the end of the block.
+static int decode_block(char *dst, size_t *o, const char *src, size_t *i, size_t len, int mode,
+                        unsigned m, size_t width) {
+    size_t base = *i, end = base + width;
+    while (m) {
+        size_t pos = base + (size_t)__builtin_ctz(m);
+        m &= m - 1;
+        if (pos < *i) continue;     // inside an escape decoded already
+        if (pos > *i) {
+            memmove(dst + *o, src + *i, pos - *i);
+            *o += pos - *i;
+            *i = pos;
+        }
+        if (decode_one(dst, o, src, i, len, mode) < 0) return -1;
+    }
+    if (*i < end) {
+        memmove(dst + *o, src + *i, end - *i);
+        *o += end - *i;
+        *i = end;
+    }
+    return 0;
+}
+
+static long pct_decode_scalar(char *dst, const char *src, size_t len, int mode) {
+    size_t i = 0, o = 0;
+    while (i < len) {
+        if (decode_one(dst, &o, src, &i, len, mode) < 0) return -1;
+    }
+    return (long)o;
+}
+
+// The mask as a 32-bit word that lines up with buf[0], given its payload
+// offset pos. Each wider word is this one repeated.
+static uint32_t mask_word(const unsigned char mask[4], size_t pos) {
+    unsigned char k[4];
+    for (int j = 0; j < 4; j++) k[j] = mask[(pos + (size_t)j) & 3];
+    uint32_t w;
+    memcpy(&w, k, sizeof(w));
+    return w;
+}
+
+// Eight bytes per step; the masks of the wider versions finish here too
+static void unmask_words(char *buf, size_t len, uint32_t w) {
+    uint64_t w64 = (uint64_t)w << 32 | w;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, buf + i, sizeof(v));
+        v ^= w64;
+        memcpy(buf + i, &v, sizeof(v));
+    }
+    const unsigned char *k = (const unsigned char *)&w;
+    for (; i < len; i++) buf[i] ^= (char)k[i & 3];
+}
+
+static void unmask_scalar(char *buf, size_t len, const unsigned char mask[4], size_t pos) {
+    unmask_words(buf, len, mask_word(mask, pos));
+}
+
+static const struct scan_ops scan_scalar = {
+    "scalar", head_end_scalar, find2_scalar, target_end_scalar, ctl_scalar, pct_decode_scalar, unmask_scalar,
+};
+
+#ifdef SCAN_X86
+
+// ---- SSE2 (baseline on x86-64) ----
+
+static size_t head_end_sse2(const char *buf, size_t len) {
+    const __m128i cr = _mm_set1_epi8('\r'), lf = _mm_set1_epi8('\n');
+    size_t i = 0;
+    // Each block looks at 16 candidate starts and the 3 bytes after them
+    for (; i + 19 <= len; i += 16) {
+        __m128i m0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i)), cr);
+        __m128i m1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 1)), lf);
+        __m128i m2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 2)), cr);
+        __m128i m3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(buf + i + 3)), lf);
+        int m = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(m0, m1), _mm_and_si128(m2, m3)));
+        if (m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+    return i + head_end_scalar(buf + i, len - i);
+}
+
+static size_t find2_sse2(const char *buf, size_t len, char a, char b) {
+    const __m128i va = _mm_set1_epi8(a), vb = _mm_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        int m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)));
+        if (m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+    return i + find2_scalar(buf + i, len - i, a, b);
+}
+
+// Bytes <= max (unsigned) or equal to DEL
+static inline int below_or_del_sse2(__m128i v, __m128i max) {
+    __m128i low = _mm_cmpeq_epi8(_mm_min_epu8(v, max), v);
+    return _mm_movemask_epi8(_mm_or_si128(low, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f))));
+}
+
+static size_t target_end_sse2(const char *buf, size_t len) {
+    const __m128i max = _mm_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        int m = below_or_del_sse2(_mm_loadu_si128((const __m128i *)(buf + i)), max);
+        if (m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+    return i + target_end_scalar(buf + i, len - i);
+}
+
+static size_t ctl_sse2(const char *buf, size_t len) {
+    const __m128i max = _mm_set1_epi8(' ' - 1);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        int m = below_or_del_sse2(_mm_loadu_si128((const __m128i *)(buf + i)), max);
+        if (m) return i + (size_t)__builtin_ctz((unsigned)m);
+    }
+    return i + ctl_scalar(buf + i, len - i);
+}
+
+// Stores 16-byte runs without '%' (or '+') straight through and decodes
+// the other blocks byte by byte at their special positions. When decoding
+// in place, o <= i always holds, so a store never overwrites input that has
+// not been loaded yet.
+static long pct_decode_sse2(char *dst, const char *src, size_t len, int mode) {
+    const __m128i pct = _mm_set1_epi8('%');
+    const __m128i plus = _mm_set1_epi8(mode == SCAN_FORM ? '+' : '%');
+    size_t i = 0, o = 0;
+    while (len - i >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, pct), _mm_cmpeq_epi8(v, plus)));
+        if (!m) {
+            _mm_storeu_si128((__m128i *)(dst + o), v);
+            i += 16;
+            o += 16;
+        } else if (decode_block(dst, &o, src, &i, len, mode, m, 16) < 0) {
+            return -1;
+        }
+    }
+    while (i < len) {
+        if (decode_one(dst, &o, src, &i, len, mode) < 0) return -1;
+    }
+    return (long)o;
+}
+
+static void unmask_sse2(char *buf, size_t len, const unsigned char mask[4], size_t pos) {
+    uint32_t w = mask_word(mask, pos);
+    const __m128i k = _mm_set1_epi32((int)w);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(v, k));
+    }
+    unmask_words(buf + i, len - i, w);
+}
+
+static const struct scan_ops scan_sse2 = {
+    "sse2", head_end_sse2, find2_sse2, target_end_sse2, ctl_sse2, pct_decode_sse2, unmask_sse2,
+};
+
+// ---- AVX2 ----
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static size_t head_end_avx2(const char *buf, size_t len) {
+    const __m256i cr = _mm256_set1_epi8('\r'), lf = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 35 <= len; i += 32) {
+        __m256i m0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i)), cr);
+        __m256i m1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 1)), lf);
+        __m256i m2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 2)), cr);
+        __m256i m3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(buf + i + 3)), lf);
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(m0, m1),
+                                                                     _mm256_and_si256(m2, m3)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + head_end_sse2(buf + i, len - i);
+}
+
+AVX2 static size_t find2_avx2(const char *buf, size_t len, char a, char b) {
+    const __m256i va = _mm256_set1_epi8(a), vb = _mm256_set1_epi8(b);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                                    _mm256_cmpeq_epi8(v, vb)));
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + find2_sse2(buf + i, len - i, a, b);
+}
+
+AVX2 static inline unsigned below_or_del_avx2(__m256i v, __m256i max) {
+    __m256i low = _mm256_cmpeq_epi8(_mm256_min_epu8(v, max), v);
+    return (unsigned)_mm256_movemask_epi8(_mm256_or_si256(low, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f))));
+}
+
+AVX2 static size_t target_end_avx2(const char *buf, size_t len) {
+    const __m256i max = _mm256_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        unsigned m = below_or_del_avx2(_mm256_loadu_si256((const __m256i *)(buf + i)), max);
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + target_end_sse2(buf + i, len - i);
+}
+
+AVX2 static size_t ctl_avx2(const char *buf, size_t len) {
+    const __m256i max = _mm256_set1_epi8(' ' - 1);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        unsigned m = below_or_del_avx2(_mm256_loadu_si256((const __m256i *)(buf + i)), max);
+        if (m) return i + (size_t)__builtin_ctz(m);
+    }
+    _mm256_zeroupper();
+    return i + ctl_sse2(buf + i, len - i);
+}
+
+AVX2 static long pct_decode_avx2(char *dst, const char *src, size_t len, int mode) {
+    const __m256i pct = _mm256_set1_epi8('%');
+    const __m256i plus = _mm256_set1_epi8(mode == SCAN_FORM ? '+' : '%');
+    size_t i = 0, o = 0;
+    while (len - i >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, pct),
+                                                                    _mm256_cmpeq_epi8(v, plus)));
+        if (!m) {
+            _mm256_storeu_si256((__m256i *)(dst + o), v);
+            i += 32;
+            o += 32;
+        } else if (decode_block(dst, &o, src, &i, len, mode, m, 32) < 0) {
+            return -1;
+        }
+    }
+    while (i < len) {
+        if (decode_one(dst, &o, src, &i, len, mode) < 0) return -1;
+    }
+    return (long)o;
+}
+
+AVX2 static void unmask_avx2(char *buf, size_t len, const unsigned char mask[4], size_t pos) {
+    uint32_t w = mask_word(mask, pos);
+    const __m256i k = _mm256_set1_epi32((int)w);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i));
+        _mm256_storeu_si256((__m256i *)(buf + i), _mm256_xor_si256(v, k));
+    }
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        _mm_storeu_si128((__m128i *)(buf + i), _mm_xor_si128(v, _mm256_castsi256_si128(k)));
+        i += 16;
+    }
+    _mm256_zeroupper();
+    unmask_words(buf + i, len - i, w);
+}
+
+static const struct scan_ops scan_avx2 = {
+    "avx2", head_end_avx2, find2_avx2, target_end_avx2, ctl_avx2, pct_decode_avx2, unmask_avx2,
+};
+
+#endif // SCAN_X86
+
+struct scan_ops scan = {
+    "scalar", head_end_scalar, find2_scalar, target_end_scalar, ctl_scalar, pct_decode_scalar, unmask_scalar,
+};
+
+int scan_available(const struct scan_ops **out, int max) {
+    int n = 0;
+    if (n < max) out[n++] = &scan_scalar;
+#ifdef SCAN_X86
+    if (n < max) out[n++] = &scan_sse2;
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("avx2")) out[n++] = &scan_avx2;
+#endif
+    return n;
+}
+
+int scan_init(const char *name) {
+    const struct scan_ops *avail[4];
+    int n = scan_available(avail, 4);
+    if (!name) {
+        scan = *avail[n - 1];
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (strcmp(avail[i]->name, name) == 0) {
+            scan = *avail[i];
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,45 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+// Byte-scanning kernels for the request path, in scalar, SSE2 and AVX2
+// versions. scan_init() points `scan` at the widest version the CPU
+// supports; until then the scalar one is used, so calling the kernels
+// early is safe, just slower. Every search returns the offset of the first
+// match, or len when there is none.
+
+// Percent-decoding modes
+#define SCAN_FORM 1     // query string: '+' is a space, bad escapes kept as-is
+#define SCAN_STRICT 0   // path: '+' kept, a bad escape is an error
+
+struct scan_ops {
+    const char *name;
+    // First "\r\n\r\n"
+    size_t (*head_end)(const char *buf, size_t len);
+    // First byte equal to a or b; pass the same byte twice to look for one
+    size_t (*find2)(const char *buf, size_t len, char a, char b);
+    // First byte that cannot be part of a request target: SP, CTL or DEL
+    size_t (*target_end)(const char *buf, size_t len);
+    // First control byte (tab included) or DEL: where a header value stops
+    size_t (*ctl)(const char *buf, size_t len);
+    // Decodes src[0, len) into dst and returns the decoded length, or -1 for
+    // a malformed escape in SCAN_STRICT mode. dst may equal src.
+    long (*pct_decode)(char *dst, const char *src, size_t len, int mode);
+    // XORs buf[0, len) with a WebSocket masking key, in place. pos is the
+    // offset of buf[0] in the frame payload, so a payload can be unmasked
+    // in pieces as it arrives.
+    void (*unmask)(char *buf, size_t len, const unsigned char mask[4], size_t pos);
+};
+
+extern struct scan_ops scan;
+
+// Selects the kernels: the named version ("scalar", "sse2", "avx2"), or the
+// best one the CPU supports when name is NULL. Returns -1 if the named
+// version is unknown or unsupported here.
+int scan_init(const char *name);
+
+// Versions usable on this CPU, scalar first; returns how many were stored
+int scan_available(const struct scan_ops **out, int max);
+
+#endif // SCAN_H
@@ -0,0 +1,132 @@
+#include "sse.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "websocket.h"
+
+// "id: <20 digits>\nevent: \ndata: " without the event name
+#define MSG_HEAD_MAX 48
+
+static struct {
+    pthread_mutex_t lock;
+    uint64_t last_id;
+    struct sse_msg *history[SSE_HISTORY];   // message id lives at id % SSE_HISTORY
+    int *watch;
+    int nwatch;
+} bus = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void sse_msg_get(struct sse_msg *m) {
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+}
+
+void sse_msg_put(struct sse_msg *m) {
+    if (atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) free(m);
+}
+
+int sse_watch(int fd) {
+    pthread_mutex_lock(&bus.lock);
+    int *watch = realloc(bus.watch, (size_t)(bus.nwatch + 1) * sizeof(*watch));
+    if (watch) {
+        bus.watch = watch;
+        bus.watch[bus.nwatch++] = fd;
+    }
+    pthread_mutex_unlock(&bus.lock);
+    return watch ? 0 : -1;
+}
+
+// Upper bound on the bytes the data: lines of data take
+static size_t data_lines_len(const char *data, size_t len) {
+    size_t n = sizeof("data: \n") - 1;
+    for (size_t i = 0; i < len; i++) n += data[i] == '\n' || data[i] == '\r' ? sizeof("data: \n") - 1 : 1;
+    return n;
+}
+
+size_t sse_event_size(const char *event, const char *data, size_t len, int flags) {
+    if (!event) event = "message";
+    size_t n = MSG_HEAD_MAX + strlen(event) + data_lines_len(data, len) + 1;
+    if ((flags & SSE_WS) && WS_FRAME_HEAD_MAX + len > n) n = WS_FRAME_HEAD_MAX + len;
+    return n;
+}
+
+uint64_t sse_publish(const char *event, const char *data, size_t len, int flags) {
+    if (!event) event = "message";
+    size_t max = MSG_HEAD_MAX + strlen(event) + data_lines_len(data, len) + 1;
+    if (flags & SSE_WS) max += WS_FRAME_HEAD_MAX + len;
+    struct sse_msg *m = malloc(sizeof(*m) + max);
+    if (!m) return 0;
+    atomic_init(&m->refs, 1);
+
+    pthread_mutex_lock(&bus.lock);
+    m->id = ++bus.last_id;
+    int n = snprintf(m->data, max, "id: %llu\nevent: %s\ndata: ", (unsigned long long)m->id, event);
+    char *p = m->data + n;
+    for (size_t i = 0; i < len; i++) {
+        // CR, LF and CRLF all end a line in an event stream
+        if (data[i] == '\r' && i + 1 < len && data[i + 1] == '\n') continue;
+        if (data[i] == '\n' || data[i] == '\r') {
+            memcpy(p, "\ndata: ", 7);
+            p += 7;
+        } else {
+            *p++ = data[i];
+        }
+    }
+    *p++ = '\n';
+    *p++ = '\n';
+    m->len = (size_t)(p - m->data);
+    m->ws_off = m->len;
+    m->ws_len = 0;
+    if (flags & SSE_WS) {
+        m->ws_len = ws_frame_head_build(p, WS_TEXT, len);
+        memcpy(p + m->ws_len, data, len);
+        m->ws_len += len;
+    }
+
+    struct sse_msg **slot = &bus.history[m->id % SSE_HISTORY];
+    if (*slot) sse_msg_put(*slot);
+    *slot = m;
+    uint64_t one = 1;
+    for (int i = 0; i < bus.nwatch; i++) {
+        // A full counter already means "wake up"
+        if (write(bus.watch[i], &one, sizeof(one)) < 0) continue;
+    }
+    uint64_t id = m->id;
+    pthread_mutex_unlock(&bus.lock);
+    return id;
+}
+
+int sse_fetch(uint64_t after, struct sse_msg **out, int max) {
+    int n = 0;
+    pthread_mutex_lock(&bus.lock);
+    uint64_t first = bus.last_id > SSE_HISTORY ? bus.last_id - SSE_HISTORY + 1 : 1;
+    if (after + 1 > first) first = after + 1;
+    for (uint64_t id = first; id <= bus.last_id && n < max; id++) {
+        struct sse_msg *m = bus.history[id % SSE_HISTORY];
+        sse_msg_get(m);
+        out[n++] = m;
+    }
+    pthread_mutex_unlock(&bus.lock);
+    return n;
+}
+
+uint64_t sse_last_id(void) {
+    pthread_mutex_lock(&bus.lock);
+    uint64_t id = bus.last_id;
+    pthread_mutex_unlock(&bus.lock);
+    return id;
+}
+
+void sse_shutdown(void) {
+    pthread_mutex_lock(&bus.lock);
+    for (int i = 0; i < SSE_HISTORY; i++) {
+        if (bus.history[i]) sse_msg_put(bus.history[i]);
+        bus.history[i] = NULL;
+    }
+    free(bus.watch);
+    bus.watch = NULL;
+    bus.nwatch = 0;
+    pthread_mutex_unlock(&bus.lock);
+}
@@ -0,0 +1,56 @@
+#ifndef SSE_H
+#define SSE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Server-Sent Events bus. sse_publish() serializes an event once into a
+// reference-counted message, keeps it in a short history and signals every
+// watching eventfd. Each worker then collects the new messages with
+// sse_fetch() and queues the same bytes on all of its subscribers, so a
+// broadcast costs one allocation however many streams are open. Events
+// published with SSE_WS also carry their data as a WebSocket text frame, so
+// WebSocket clients share the same fan-out.
+// All functions are thread-safe.
+
+#define SSE_HISTORY 64              // messages kept for Last-Event-ID replay
+
+#define SSE_WS 1                    // sse_publish(): add a WebSocket frame
+
+struct sse_msg {
+    atomic_int refs;
+    uint64_t id;                    // increasing from 1, no gaps
+    size_t len;
+    size_t ws_off;                  // WebSocket frame in data, ws_len 0 if none
+    size_t ws_len;
+    char data[];                    // "id: ...\nevent: ...\ndata: ...\n\n"
+};
+
+void sse_msg_get(struct sse_msg *m);
+void sse_msg_put(struct sse_msg *m);
+
+// Adds an eventfd that is written to after every publish
+int sse_watch(int fd);
+
+// Publishes data under the event name (NULL for the default "message").
+// Data with newlines is sent as several data: lines. flags is 0 or SSE_WS.
+// Returns the event id, or 0 when out of memory.
+uint64_t sse_publish(const char *event, const char *data, size_t len, int flags);
+
+// Most bytes the event takes in either form, the stream's or with SSE_WS
+// the WebSocket frame: what one subscriber has to queue for it
+size_t sse_event_size(const char *event, const char *data, size_t len, int flags);
+
+// Stores referenced messages with an id above after into out, oldest
+// first, and returns how many. Messages that left the history are skipped:
+// the first id is then above after + 1.
+int sse_fetch(uint64_t after, struct sse_msg **out, int max);
+
+// Id of the newest message, 0 if none yet
+uint64_t sse_last_id(void);
+
+// Drops the history and the watch list
+void sse_shutdown(void);
+
+#endif // SSE_H
@@ -0,0 +1,30 @@
+#!/bin/sh
+# End-to-end checks against a live ./webserver on loopback, run once on
+# epoll and once on io_uring. Each check is a program or script in tests/
+# that exits non-zero on failure.
+#
+#   tests/check.sh
+#
+# PORT (18090) comes from the environment; the restart check also uses the
+# port after it.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=${PORT:-18090}
+make -s webserver tests/ws_check bench/loadgen
+
+status=0
+for backend in "" "-u"; do
+    # shellcheck disable=SC2086
+    ./webserver $backend 127.0.0.1 "$PORT" >/dev/null &
+    server=$!
+    trap 'kill $server 2>/dev/null || true' EXIT
+    sleep 0.5
+    echo "== ws_check ${backend:-(epoll)}"
+    tests/ws_check 127.0.0.1 "$PORT" || status=1
+    kill -INT $server
+    wait $server || true
+    echo "== handoff ${backend:-(epoll)}"
+    tests/handoff.sh $((PORT + 1)) $backend || status=1
+done
+exit $status
@@ -0,0 +1,69 @@
+#!/bin/sh
+# Restarts a server on SIGUSR2 under load, into a successor with fewer
+# workers than it. No request may fail, and the successor has to serve
+# every listener it was handed, not just one per worker.
+#
+#   tests/handoff.sh port [-u]
+#
+# Runs from a copy of ./webserver in a temporary directory, which is then
+# replaced by a script that stops the old server and starts ./webserver
+# with "-w 1" added. While the old server is stopped, the connections are
+# down to the successor. -S 0 keeps the old server from shedding what
+# waited on it meanwhile.
+set -e
+cd "$(dirname "$0")/.."
+
+PORT=$1
+BACKEND=$2
+tmp=$(mktemp -d)
+trap 'kill -CONT $server 2>/dev/null || true; kill $server $load 2>/dev/null || true; rm -rf "$tmp"' EXIT
+
+cp webserver "$tmp/webserver"
+# shellcheck disable=SC2086
+"$tmp/webserver" $BACKEND -w 3 -S 0 -g 5 127.0.0.1 "$PORT" >"$tmp/out" &
+server=$!
+sleep 0.5
+
+bench/loadgen -t 2 -c 16 -d 4 -n 127.0.0.1 "$PORT" /time >"$tmp/load" &
+load=$!
+sleep 1
+
+# The successor's parent is the old server, waiting for it to be ready.
+# GNU getopt takes the options after the address too; the last -w wins.
+printf '#!/bin/sh\nkill -STOP $PPID\nexec "%s" "$@" -w 1\n' "$(pwd)/webserver" >"$tmp/next"
+chmod +x "$tmp/next"
+mv "$tmp/next" "$tmp/webserver"
+kill -USR2 $server
+sleep 0.5
+
+status=0
+# A stopped server's io_uring accepts still hold their listeners' wakeups,
+# so only on epoll does the successor get every connection meanwhile. Field
+# 4 is requests per second, here the number served in the second.
+if [ -z "$BACKEND" ]; then
+    served=$(bench/loadgen -t 1 -c 8 -d 1 -n -s 127.0.0.1 "$PORT" /time | cut -f 4)
+    if [ "$served" -ge 100 ]; then
+        echo "ok   the successor serves every listener"
+    else
+        echo "FAIL the successor served $served requests with the old server stopped"
+        status=1
+    fi
+fi
+
+kill -CONT $server
+wait $server || true
+if wait $load; then
+    echo "ok   no request failed across the restart"
+else
+    echo "FAIL requests failed across the restart:"
+    cat "$tmp/load"
+    status=1
+fi
+
+successor=$(sed -n 's/^Handed over to process \([0-9]*\).*/\1/p' "$tmp/out")
+if [ -z "$successor" ]; then
+    echo "FAIL restart: no successor"
+    exit 1
+fi
+kill -INT "$successor"
+exit $status
@@ -0,0 +1,220 @@
+// Checks the chat fan-out against a running server: a text message too big
+// for the subscribers' queues closes only its sender with 1009, while the
+// other WebSocket clients and event streams stay open and get the messages
+// that fit. A burst of more messages than the bus history holds reaches the
+// other clients whole and in order, or closes them; it never leaves a hole.
+//
+//   tests/ws_check ip port
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define OVERSIZED 20000     // over SSE_QUEUE_MAX in either form
+#define FITS 15000          // under it, prefix and framing included
+#define BURST 150           // messages in one write, over SSE_HISTORY (64)
+
+static struct sockaddr_in server;
+static int failures;
+
+static void check(const char *what, int ok) {
+    printf("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok) failures++;
+}
+
+static int dial(const char *request) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct timeval tv = {.tv_sec = 3};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (fd < 0 || connect(fd, (struct sockaddr *)&server, sizeof(server)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    if (write(fd, request, strlen(request)) != (ssize_t)strlen(request)) {
+        perror("write");
+        exit(1);
+    }
+    // The response head, read a byte at a time so nothing after it is lost
+    char head[1024];
+    size_t n = 0;
+    while (n < sizeof(head) - 1 && (n < 4 || memcmp(head + n - 4, "\r\n\r\n", 4) != 0)) {
+        if (read(fd, head + n, 1) != 1) {
+            fprintf(stderr, "no response head\n");
+            exit(1);
+        }
+        n++;
+    }
+    head[n] = '\0';
+    if (strncmp(head, "HTTP/1.1 101", 12) != 0 && strncmp(head, "HTTP/1.1 200", 12) != 0) {
+        fprintf(stderr, "unexpected response: %s\n", head);
+        exit(1);
+    }
+    return fd;
+}
+
+static int ws_open(void) {
+    return dial("GET /ws HTTP/1.1\r\nHost: x\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n");
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    for (size_t got = 0; got < len;) {
+        ssize_t r = read(fd, (char *)buf + got, len - got);
+        if (r <= 0) return -1;
+        got += (size_t)r;
+    }
+    return 0;
+}
+
+// Builds a masked text frame of the len bytes at p into f, which has room
+// for len + 8. Returns its size.
+static size_t ws_text_frame(unsigned char *f, const char *p, size_t len) {
+    size_t h = 0;
+    f[h++] = 0x81;
+    if (len < 126) {
+        f[h++] = (unsigned char)(0x80 | len);
+    } else {
+        f[h++] = 0x80 | 126;
+        f[h++] = (unsigned char)(len >> 8);
+        f[h++] = (unsigned char)len;
+    }
+    static const unsigned char mask[4] = {1, 2, 3, 4};
+    memcpy(f + h, mask, 4);
+    h += 4;
+    for (size_t i = 0; i < len; i++) f[h + i] = (unsigned char)p[i] ^ mask[i & 3];
+    return h + len;
+}
+
+// Sends a masked text frame of len bytes of c
+static void ws_send_text(int fd, char c, size_t len) {
+    char *p = malloc(len);
+    unsigned char *f = malloc(len + 8);
+    memset(p, c, len);
+    size_t n = ws_text_frame(f, p, len);
+    if (write(fd, f, n) != (ssize_t)n) perror("write");
+    free(p);
+    free(f);
+}
+
+// Reads server frames until one with opcode op. Returns its payload
+// length and copies the start of it into out, or -1 on EOF or timeout.
+static long ws_read_frame(int fd, int op, unsigned char *out, size_t out_max) {
+    for (;;) {
+        unsigned char h[2];
+        if (read_full(fd, h, 2) < 0) return -1;
+        uint64_t len = h[1] & 0x7f;
+        if (len == 126) {
+            unsigned char e[2];
+            if (read_full(fd, e, 2) < 0) return -1;
+            len = (uint64_t)e[0] << 8 | e[1];
+        } else if (len == 127) {
+            unsigned char e[8];
+            if (read_full(fd, e, 8) < 0) return -1;
+            len = 0;
+            for (int i = 0; i < 8; i++) len = len << 8 | e[i];
+        }
+        unsigned char *p = malloc(len + 1);
+        if (read_full(fd, p, len) < 0) {
+            free(p);
+            return -1;
+        }
+        if ((h[0] & 0x0f) == op) {
+            memcpy(out, p, len < out_max ? len : out_max);
+            free(p);
+            return (long)len;
+        }
+        free(p);
+    }
+}
+
+// Reads the event stream until a chat event of at least min bytes
+// arrives. Returns its length, or -1 on EOF or timeout.
+static long sse_read_chat(int fd, size_t min) {
+    static char buf[1 << 16];
+    static size_t n;
+    for (;;) {
+        char *ev;
+        while ((ev = memmem(buf, n, "event: chat\ndata: ", 18))) {
+            char *end = memmem(ev, n - (size_t)(ev - buf), "\n\n", 2);
+            if (!end) break;
+            long len = end - (ev + 18);
+            size_t used = (size_t)(end + 2 - buf);
+            memmove(buf, buf + used, n - used);
+            n -= used;
+            if ((size_t)len >= min) return len;
+        }
+        if (n == sizeof(buf)) n = 0;
+        ssize_t r = read(fd, buf + n, sizeof(buf) - n);
+        if (r <= 0) return -1;
+        n += (size_t)r;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s ip port\n", argv[0]);
+        return 1;
+    }
+    server.sin_family = AF_INET;
+    server.sin_port = htons((uint16_t)atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &server.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IPv4 address: %s\n", argv[1]);
+        return 1;
+    }
+
+    int events = dial("GET /events HTTP/1.1\r\nHost: x\r\n\r\n");
+    int sender = ws_open();
+    int other = ws_open();
+    unsigned char payload[64];
+
+    ws_send_text(sender, 'x', OVERSIZED);
+    long len = ws_read_frame(sender, 0x8, payload, sizeof(payload));
+    check("oversized message closes its sender with 1009",
+          len == 2 && (payload[0] << 8 | payload[1]) == 1009);
+
+    ws_send_text(other, 'y', FITS);
+    len = ws_read_frame(other, 0x1, payload, sizeof(payload));
+    // The first chat frame it sees is its own, prefixed "[Client N]: "
+    check("other client stays open and gets the next message",
+          len > FITS && len < OVERSIZED && memchr(payload, 'y', sizeof(payload)));
+    len = sse_read_chat(events, FITS);
+    check("event stream stays open and gets the next message", len > FITS && len < OVERSIZED);
+
+    int burster = ws_open();
+    int reader = ws_open();
+    static unsigned char burst[BURST * 16];
+    size_t burst_len = 0;
+    for (int i = 0; i < BURST; i++) {
+        char text[8];
+        int n = snprintf(text, sizeof(text), "b%03d", i);
+        burst_len += ws_text_frame(burst + burst_len, text, (size_t)n);
+    }
+    if (write(burster, burst, burst_len) != (ssize_t)burst_len) perror("write");
+    int next = 0;
+    while (next < BURST) {
+        len = ws_read_frame(reader, 0x1, payload, sizeof(payload) - 1);
+        if (len < 0) break;
+        payload[len < (long)sizeof(payload) - 1 ? len : (long)sizeof(payload) - 1] = '\0';
+        // "[Client N]: bNNN"
+        char *b = strstr((char *)payload, ": b");
+        if (!b || atoi(b + 3) != next) break;
+        next++;
+    }
+    // Short of the whole burst only if the server closed it, not timed out
+    char byte;
+    check("a burst over the history arrives whole or closes the reader",
+          next == BURST || (len < 0 && read(reader, &byte, 1) == 0));
+
+    close(events);
+    close(sender);
+    close(other);
+    close(burster);
+    close(reader);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+#include "timerwheel.h"
+
+#include <string.h>
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now) {
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+static void place(struct timer_wheel *w, struct timer *t) {
+    uint64_t at = t->expires > w->now ? t->expires : w->now;
+    uint64_t delta = at - w->now;
+    if (delta >= WHEEL_SPAN) {
+        at = w->now + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+    unsigned level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >> (TIMER_WHEEL_BITS * (level + 1))) level++;
+    unsigned idx = (unsigned)(at >> (TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    struct timer **head = &w->slots[level][idx];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->slot = level * TIMER_WHEEL_SLOTS + idx;
+    w->occupied[level] |= (uint64_t)1 << idx;
+}
+
+static void unlink_timer(struct timer_wheel *w, struct timer *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+    unsigned level = t->slot / TIMER_WHEEL_SLOTS, idx = t->slot % TIMER_WHEEL_SLOTS;
+    if (!w->slots[level][idx]) w->occupied[level] &= ~((uint64_t)1 << idx);
+}
+
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t expires) {
+    if (t->pprev) unlink_timer(w, t);
+    t->expires = expires;
+    place(w, t);
+}
+
+void timer_del(struct timer_wheel *w, struct timer *t) {
+    if (t->pprev) unlink_timer(w, t);
+}
+
+// Takes the whole list out of a slot. Its timers keep pointing into it
+// through the first one's pprev, which now refers to *list.
+static void take_slot(struct timer_wheel *w, unsigned level, unsigned idx, struct timer **list) {
+    *list = w->slots[level][idx];
+    w->slots[level][idx] = NULL;
+    w->occupied[level] &= ~((uint64_t)1 << idx);
+    if (*list) (*list)->pprev = list;
+}
+
+// At the start of an upper slot's span its timers move down a level (or
+// further); a tick that starts a span of several levels moves them all
+static void cascade(struct timer_wheel *w, uint64_t tick) {
+    for (unsigned level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        unsigned shift = TIMER_WHEEL_BITS * level;
+        if (tick & (((uint64_t)1 << shift) - 1)) break;
+        struct timer *list;
+        take_slot(w, level, (unsigned)(tick >> shift) & SLOT_MASK, &list);
+        while (list) {
+            struct timer *t = list;
+            unlink_timer(w, t);
+            place(w, t);
+        }
+    }
+}
+
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now, void (*expire)(struct timer *, void *), void *arg) {
+    for (;;) {
+        int64_t next = timer_wheel_next(w);
+        if (next < 0 || (uint64_t)next > now) break;
+        uint64_t tick = (uint64_t)next;
+        w->now = tick;
+        cascade(w, tick);
+        struct timer *list;
+        take_slot(w, 0, (unsigned)tick & SLOT_MASK, &list);
+        // Timers added from here on land after this tick
+        w->now = tick + 1;
+        while (list) {
+            struct timer *t = list;
+            unlink_timer(w, t);
+            expire(t, arg);
+        }
+    }
+    if (w->now <= now) w->now = now + 1;
+}
+
+int64_t timer_wheel_next(const struct timer_wheel *w) {
+    int64_t best = -1;
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        uint64_t occ = w->occupied[level];
+        if (!occ) continue;
+        unsigned shift = TIMER_WHEEL_BITS * level;
+        // An upper slot is due at the start of its span. Past that start,
+        // the slot at the current position was filled a whole turn ahead.
+        uint64_t from = (w->now + ((uint64_t)1 << shift) - 1) >> shift;
+        unsigned r = (unsigned)from & SLOT_MASK;
+        uint64_t rot = r ? occ >> r | occ << (TIMER_WHEEL_SLOTS - r) : occ;
+        int64_t tick = (int64_t)((from + (uint64_t)__builtin_ctzll(rot)) << shift);
+        if (best < 0 || tick < best) best = tick;
+    }
+    return best;
+}
+
+struct timer *timer_wheel_any(const struct timer_wheel *w) {
+    for (unsigned level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        if (w->occupied[level]) return w->slots[level][__builtin_ctzll(w->occupied[level])];
+    }
+    return NULL;
+}
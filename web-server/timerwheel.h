@@ -0,0 +1,58 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel: four levels of 64 slots. Level 0 holds timers
+// due within 64 ticks, one slot per tick; each level above covers 64 times
+// the span of the one below, up to 2^24 ticks (later timers wait at the top
+// and are placed again as time goes by). Adding and removing a timer are
+// O(1); when a slot of an upper level comes due its timers move down.
+// Occupancy bitmaps let the wheel skip straight to the next tick with
+// work, so advancing over an idle stretch costs nothing per tick.
+//
+// Timers are embedded in their owner. Not thread-safe; each worker has its
+// own wheel.
+
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+struct timer {
+    struct timer *next;
+    struct timer **pprev;       // NULL while not pending
+    uint64_t expires;           // tick it fires on
+    unsigned slot;              // level * TIMER_WHEEL_SLOTS + index
+};
+
+struct timer_wheel {
+    uint64_t now;               // next tick to process
+    uint64_t occupied[TIMER_WHEEL_LEVELS];
+    struct timer *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+};
+
+void timer_wheel_init(struct timer_wheel *w, uint64_t now);
+
+// Schedules t for tick expires, moving it if already pending. A tick that
+// has passed fires on the next advance.
+void timer_add(struct timer_wheel *w, struct timer *t, uint64_t expires);
+
+void timer_del(struct timer_wheel *w, struct timer *t);
+
+static inline int timer_pending(const struct timer *t) {
+    return t->pprev != 0;
+}
+
+// Fires, in tick order, every timer due up to and including tick now. A
+// fired timer is no longer pending when expire runs, so it may be added
+// again or its owner freed.
+void timer_wheel_advance(struct timer_wheel *w, uint64_t now, void (*expire)(struct timer *, void *), void *arg);
+
+// The next tick that has work: a timer to fire or an upper slot to move
+// down. -1 if the wheel is empty.
+int64_t timer_wheel_next(const struct timer_wheel *w);
+
+// Some pending timer, NULL if none; for tearing everything down
+struct timer *timer_wheel_any(const struct timer_wheel *w);
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,342 @@
+// Asset bundler: compiles a directory of static files into C source for
+// assets.h. Every file becomes a string literal, along with its brotli and
+// gzip encodings when those come out smaller, and the serialized 200 and
+// 304 heads of each coding. A hash table maps paths to assets.
+//
+// Usage: bundle DIR OUT.c
+//
+// Text files (HTML, CSS, JavaScript, JSON, SVG, XML) lose leading and
+// trailing whitespace on every line and their blank lines. That is skipped
+// for any file with a <pre>, a <textarea> or a template literal, where
+// whitespace may matter. .gz and .br siblings left by 'make precompress'
+// and dot files are not bundled.
+#define _GNU_SOURCE
+#include <brotli/encode.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "mime.h"
+
+// The coding names, in the order of enum asset_coding
+static const char *const coding_names[] = {"identity", "br", "gzip"};
+
+struct file {
+    char *path;                 // relative to the bundled directory
+    time_t mtime;
+    int compressible;
+    int kept[3];                // codings emitted
+};
+
+static struct file *files;
+static size_t nfiles, files_cap;
+static size_t root_len;
+
+static void die(const char *msg, const char *arg) {
+    fprintf(stderr, "bundle: %s%s%s\n", msg, arg ? ": " : "", arg ? arg : "");
+    exit(1);
+}
+
+static int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+static int collect(const char *fpath, const struct stat *st, int type, struct FTW *ftw) {
+    const char *name = fpath + ftw->base;
+    if (ftw->level > 0 && name[0] == '.') return type == FTW_D ? FTW_SKIP_SUBTREE : FTW_CONTINUE;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) return FTW_CONTINUE;
+    if (has_suffix(name, ".gz") || has_suffix(name, ".br")) {
+        // A precompressed sibling, if its original is there
+        char orig[4096];
+        snprintf(orig, sizeof(orig), "%.*s", (int)(strlen(fpath) - 3), fpath);
+        struct stat ost;
+        if (stat(orig, &ost) == 0 && S_ISREG(ost.st_mode)) return FTW_CONTINUE;
+    }
+    // Paths also go into comments of the generated file
+    for (const char *p = fpath; *p; p++) {
+        if ((unsigned char)*p < 0x20) die("control character in file name", fpath);
+    }
+    if (nfiles == files_cap) {
+        files_cap = files_cap ? files_cap * 2 : 16;
+        files = realloc(files, files_cap * sizeof(*files));
+        if (!files) die("out of memory", NULL);
+    }
+    files[nfiles].path = strdup(fpath + root_len + 1);
+    if (!files[nfiles].path) die("out of memory", NULL);
+    files[nfiles].mtime = st->st_mtime;
+    nfiles++;
+    return FTW_CONTINUE;
+}
+
+static int file_cmp(const void *a, const void *b) {
+    return strcmp(((const struct file *)a)->path, ((const struct file *)b)->path);
+}
+
+static char *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) die("cannot open", path);
+    size_t cap = 4096, n = 0;
+    char *buf = malloc(cap);
+    for (size_t r; buf && (r = fread(buf + n, 1, cap - n, f)) > 0;) {
+        n += r;
+        if (n == cap) buf = realloc(buf, cap *= 2);
+    }
+    if (!buf) die("out of memory", NULL);
+    if (ferror(f)) die("cannot read", path);
+    fclose(f);
+    *len = n;
+    return buf;
+}
+
+static int minifiable(const char *path) {
+    static const char *const exts[] = {".html", ".htm", ".css", ".js", ".mjs", ".json", ".svg", ".xml"};
+    for (size_t i = 0; i < sizeof(exts) / sizeof(exts[0]); i++) {
+        if (strlen(path) >= strlen(exts[i]) && strcasecmp(path + strlen(path) - strlen(exts[i]), exts[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Drops indentation, trailing blanks and empty lines in place
+static size_t minify(char *buf, size_t len) {
+    if (memmem(buf, len, "<pre", 4) || memmem(buf, len, "<textarea", 9) || memchr(buf, '`', len)) return len;
+    size_t w = 0;
+    for (size_t i = 0; i < len;) {
+        size_t end = i;
+        while (end < len && buf[end] != '\n') end++;
+        size_t a = i, b = end;
+        while (a < b && (buf[a] == ' ' || buf[a] == '\t')) a++;
+        while (b > a && (buf[b - 1] == ' ' || buf[b - 1] == '\t' || buf[b - 1] == '\r')) b--;
+        if (b > a) {
+            memmove(buf + w, buf + a, b - a);
+            w += b - a;
+            if (end < len) buf[w++] = '\n';
+        }
+        i = end + 1;
+    }
+    return w;
+}
+
+// gzip (RFC 1952) at the highest level; NULL if it fails
+static char *compress_gzip(const char *in, size_t len, size_t *out_len) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+    size_t cap = deflateBound(&zs, (uLong)len);
+    char *out = malloc(cap);
+    if (!out) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+    zs.next_in = (Bytef *)in;
+    zs.avail_in = (uInt)len;
+    zs.next_out = (Bytef *)out;
+    zs.avail_out = (uInt)cap;
+    int rc = deflate(&zs, Z_FINISH);
+    *out_len = zs.total_out;
+    deflateEnd(&zs);
+    if (rc != Z_STREAM_END) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static char *compress_brotli(const char *in, size_t len, size_t *out_len) {
+    size_t cap = BrotliEncoderMaxCompressedSize(len);
+    char *out = cap ? malloc(cap) : NULL;
+    if (!out) return NULL;
+    *out_len = cap;
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, len,
+                               (const uint8_t *)in, out_len, (uint8_t *)out)) {
+        free(out);
+        return NULL;
+    }
+    return out;
+}
+
+static uint64_t hash64(const char *p, size_t len) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// The hash asset_find() probes with; it must match the one emitted below
+static uint32_t hash_path(const char *p, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Writes data as a C string literal, split after newlines and long lines
+// if wrap is set. Octal escapes are always three digits, so a following
+// digit cannot extend them.
+static void emit_string(FILE *out, const char *data, size_t len, int wrap) {
+    fputs(wrap ? "\n    \"" : "\"", out);
+    int col = 5;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char ch = (unsigned char)data[i];
+        if (wrap && col >= 100) {
+            fputs("\"\n    \"", out);
+            col = 5;
+        }
+        if (ch == '"' || ch == '\\' || ch == '?') col += fprintf(out, "\\%c", ch);
+        else if (ch >= 0x20 && ch < 0x7f) col += fprintf(out, "%c", ch);
+        else if (ch == '\n') col += fprintf(out, "\\n");
+        else if (ch == '\r') col += fprintf(out, "\\r");
+        else col += fprintf(out, "\\%03o", ch);
+        if (ch == '\n' && i + 1 < len) col = 100;
+    }
+    fputc('"', out);
+}
+
+static void emit_bytes(FILE *out, const char *name, size_t i, int enc, const char *data, size_t len) {
+    fprintf(out, "static const char %s_%zu_%d[] =", name, i, enc);
+    emit_string(out, data, len, 1);
+    fputs(";\n\n", out);
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s DIR OUT.c\n", argv[0]);
+        return 1;
+    }
+    const char *root = argv[1];
+    root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') root_len--;
+    if (nftw(root, collect, 16, FTW_PHYS | FTW_ACTIONRETVAL) != 0) die("cannot walk", root);
+    if (nfiles) qsort(files, nfiles, sizeof(*files), file_cmp);
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", argv[2]);
+    FILE *out = fopen(tmp, "w");
+    if (!out) die("cannot create", tmp);
+    fprintf(out, "// Generated by tools/bundle from %s; do not edit\n#include \"assets.h\"\n\n#include <stdint.h>\n"
+                 "#include <string.h>\n\n", root);
+
+    for (size_t i = 0; i < nfiles; i++) {
+        struct file *f = &files[i];
+        char path[4096];
+        snprintf(path, sizeof(path), "%.*s/%s", (int)root_len, root, f->path);
+        size_t len;
+        char *body[3] = {read_file(path, &len), NULL, NULL};
+        size_t body_len[3] = {len, 0, 0};
+        const char *mime = mime_type_for(f->path);
+        int compressible = mime_compressible(mime);
+        f->compressible = compressible;
+        if (minifiable(f->path)) body_len[0] = minify(body[0], len);
+        uint64_t tag = hash64(body[0], body_len[0]);
+        for (int enc = 1; compressible && enc < 3; enc++) {
+            size_t zlen = 0;
+            char *z = enc == 1 ? compress_brotli(body[0], body_len[0], &zlen)
+                               : compress_gzip(body[0], body_len[0], &zlen);
+            if (!z || zlen >= body_len[0]) {
+                free(z);
+                continue;
+            }
+            body[enc] = z;
+            body_len[enc] = zlen;
+        }
+
+        // The same heads asset_build() in webserver.c serializes
+        char modified[32];
+        struct tm tm;
+        gmtime_r(&f->mtime, &tm);
+        strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        fprintf(out, "// %s: %zu bytes, %zu as served", f->path, len, body_len[0]);
+        for (int enc = 1; enc < 3; enc++) {
+            if (body[enc]) fprintf(out, ", %zu %s", body_len[enc], coding_names[enc]);
+        }
+        fputs("\n", out);
+        for (int enc = 0; enc < 3; enc++) {
+            if (!body[enc]) continue;
+            f->kept[enc] = 1;
+            char etag[32], validators[160], head[512], not_modified[256];
+            snprintf(etag, sizeof(etag), "\"%016llx%s%s\"", (unsigned long long)tag, enc ? "-" : "",
+                     enc ? coding_names[enc] : "");
+            snprintf(validators, sizeof(validators), "ETag: %s\r\nLast-Modified: %s\r\n%s", etag, modified,
+                     compressible ? "Vary: Accept-Encoding\r\n" : "");
+            snprintf(head, sizeof(head),
+                     "HTTP/1.1 200 OK\r\nServer: c-min-web/1.0\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+                     "%s%s%s%s",
+                     mime, body_len[enc], enc ? "Content-Encoding: " : "", enc ? coding_names[enc] : "",
+                     enc ? "\r\n" : "", validators);
+            snprintf(not_modified, sizeof(not_modified), "HTTP/1.1 304 Not Modified\r\nServer: c-min-web/1.0\r\n%s",
+                     validators);
+            emit_bytes(out, "asset_head", i, enc, head, strlen(head));
+            emit_bytes(out, "asset_not_modified", i, enc, not_modified, strlen(not_modified));
+            emit_bytes(out, "asset_etag", i, enc, etag, strlen(etag));
+            emit_bytes(out, "asset_body", i, enc, body[enc], body_len[enc]);
+        }
+        for (int enc = 0; enc < 3; enc++) free(body[enc]);
+    }
+
+    fputs("const struct asset assets[] = {\n", out);
+    for (size_t i = 0; i < nfiles; i++) {
+        fputs("    {", out);
+        emit_string(out, files[i].path, strlen(files[i].path), 0);
+        fprintf(out, ", %lld, %d, {\n", (long long)files[i].mtime, files[i].compressible);
+        for (int enc = 0; enc < 3; enc++) {
+            if (!files[i].kept[enc]) {
+                fputs("        {NULL, 0, NULL, 0, NULL, NULL, 0},\n", out);
+                continue;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "%zu_%d", i, enc);
+            fprintf(out,
+                    "        {asset_head_%s, sizeof(asset_head_%s) - 1, asset_not_modified_%s,\n"
+                    "         sizeof(asset_not_modified_%s) - 1, asset_etag_%s, asset_body_%s,\n"
+                    "         sizeof(asset_body_%s) - 1},\n",
+                    name, name, name, name, name, name, name);
+        }
+        fputs("    }},\n", out);
+    }
+    fputs("};\n\n", out);
+    fprintf(out, "const size_t assets_count = %zu;\n\n", nfiles);
+
+    // Open addressing, at most half full, so a miss ends within a probe or two
+    size_t nslots = 2;
+    while (nslots < nfiles * 2) nslots *= 2;
+    unsigned *slots = calloc(nslots, sizeof(*slots));
+    if (!slots) die("out of memory", NULL);
+    for (size_t i = 0; i < nfiles; i++) {
+        size_t s = hash_path(files[i].path, strlen(files[i].path)) & (nslots - 1);
+        while (slots[s]) s = (s + 1) & (nslots - 1);
+        slots[s] = (unsigned)i + 1;
+    }
+    fprintf(out, "// Asset index + 1 by path hash, 0 for none\nstatic const unsigned asset_slots[%zu] = {", nslots);
+    for (size_t s = 0; s < nslots; s++) fprintf(out, "%s%u", s % 16 ? ", " : "\n    ", slots[s]);
+    fputs("\n};\n\n", out);
+    fprintf(out,
+            "const struct asset *asset_find(const char *path, size_t len) {\n"
+            "    uint32_t h = 2166136261u;\n"
+            "    for (size_t i = 0; i < len; i++) {\n"
+            "        h ^= (unsigned char)path[i];\n"
+            "        h *= 16777619u;\n"
+            "    }\n"
+            "    for (size_t s = h & %zuu; asset_slots[s]; s = (s + 1) & %zuu) {\n"
+            "        const struct asset *a = &assets[asset_slots[s] - 1];\n"
+            "        if (strncmp(a->path, path, len) == 0 && a->path[len] == '\\0') return a;\n"
+            "    }\n"
+            "    return NULL;\n"
+            "}\n",
+            nslots - 1, nslots - 1);
+    free(slots);
+
+    if (fclose(out) != 0 || rename(tmp, argv[2]) != 0) die("cannot write", argv[2]);
+    return 0;
+}
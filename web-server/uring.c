@@ -0,0 +1,408 @@
+#include "uring.h"
+
+#include <errno.h>
+
+#ifdef NO_URING
+
+struct uring *uring_new(unsigned sq_entries, unsigned nbufs, unsigned buf_size) {
+    (void)sq_entries;
+    (void)nbufs;
+    (void)buf_size;
+    errno = ENOSYS;
+    return NULL;
+}
+
+void uring_free(struct uring *u) {
+    (void)u;
+}
+
+int uring_wait(struct uring *u, int timeout_ms) {
+    (void)u;
+    (void)timeout_ms;
+    return -1;
+}
+
+int uring_next(struct uring *u, struct uring_event *ev) {
+    (void)u;
+    (void)ev;
+    return 0;
+}
+
+char *uring_buf(struct uring *u, unsigned buf) {
+    (void)u;
+    (void)buf;
+    return NULL;
+}
+
+void uring_buf_put(struct uring *u, unsigned buf) {
+    (void)u;
+    (void)buf;
+}
+
+int uring_accept(struct uring *u, int fd, uint64_t tag) {
+    (void)u;
+    (void)fd;
+    (void)tag;
+    return -1;
+}
+
+int uring_recv(struct uring *u, int fd, uint64_t tag) {
+    (void)u;
+    (void)fd;
+    (void)tag;
+    return -1;
+}
+
+int uring_sendmsg(struct uring *u, int fd, const struct msghdr *msg, int flags, uint64_t tag, uint64_t shutdown_tag) {
+    (void)u;
+    (void)fd;
+    (void)msg;
+    (void)flags;
+    (void)tag;
+    (void)shutdown_tag;
+    return -1;
+}
+
+int uring_poll(struct uring *u, int fd, unsigned events, int multishot, uint64_t tag) {
+    (void)u;
+    (void)fd;
+    (void)events;
+    (void)multishot;
+    (void)tag;
+    return -1;
+}
+
+int uring_shutdown(struct uring *u, int fd, uint64_t tag) {
+    (void)u;
+    (void)fd;
+    (void)tag;
+    return -1;
+}
+
+int uring_cancel(struct uring *u, uint64_t tag) {
+    (void)u;
+    (void)tag;
+    return -1;
+}
+
+int uring_cancel_fd(struct uring *u, int fd) {
+    (void)u;
+    (void)fd;
+    return -1;
+}
+
+int uring_close(struct uring *u, int fd) {
+    (void)u;
+    (void)fd;
+    return -1;
+}
+
+#else
+
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUF_GROUP 0
+
+struct uring {
+    int fd;
+    unsigned sq_entries;
+    unsigned sq_mask;
+    unsigned sq_tail;               // next free slot, published on submit
+    _Atomic unsigned *ksq_head;
+    _Atomic unsigned *ksq_tail;
+    struct io_uring_sqe *sqes;
+    unsigned cq_mask;
+    _Atomic unsigned *kcq_head;
+    _Atomic unsigned *kcq_tail;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;                  // == sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    size_t sqes_size;
+    struct io_uring_buf_ring *br;   // provided buffers
+    size_t br_size;
+    unsigned nbufs;
+    unsigned buf_size;
+    unsigned short br_tail;
+    char *bufs;
+};
+
+static int sys_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nargs) {
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nargs);
+}
+
+void uring_free(struct uring *u) {
+    if (!u) return;
+    if (u->fd >= 0) close(u->fd);
+    if (u->sqes && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring && u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_size);
+    if (u->br && u->br != MAP_FAILED) munmap(u->br, u->br_size);
+    free(u->bufs);
+    free(u);
+}
+
+static void buf_add(struct uring *u, unsigned buf) {
+    struct io_uring_buf *b = &u->br->bufs[u->br_tail & (u->nbufs - 1)];
+    b->addr = (uint64_t)(uintptr_t)(u->bufs + (size_t)buf * u->buf_size);
+    b->len = u->buf_size;
+    b->bid = (unsigned short)buf;
+    u->br_tail++;
+}
+
+static void buf_publish(struct uring *u) {
+    __atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+}
+
+struct uring *uring_new(unsigned sq_entries, unsigned nbufs, unsigned buf_size) {
+    if (nbufs == 0 || nbufs > 32768 || (nbufs & (nbufs - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    struct uring *u = calloc(1, sizeof(*u));
+    if (!u) return NULL;
+    u->fd = -1;
+
+    // SINGLE_ISSUER arrived in 6.0 with multishot receive, so a kernel that
+    // takes it has everything used here. DEFER_TASKRUN (6.1) runs
+    // completions only when this thread asks for them.
+    struct io_uring_params p;
+    unsigned base = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER;
+    unsigned tries[2] = {base | IORING_SETUP_DEFER_TASKRUN, base | IORING_SETUP_COOP_TASKRUN};
+    for (int i = 0; i < 2 && u->fd < 0; i++) {
+        memset(&p, 0, sizeof(p));
+        p.flags = tries[i];
+        p.cq_entries = sq_entries * 8;
+        u->fd = sys_setup(sq_entries, &p);
+    }
+    if (u->fd < 0) goto fail;
+    int err;
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_EXT_ARG)) {
+        errno = ENOSYS;
+        goto fail;
+    }
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_size > u->sq_ring_size) u->sq_ring_size = u->cq_ring_size;
+        u->cq_ring_size = u->sq_ring_size;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                      IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                          IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) goto fail;
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) goto fail;
+
+    char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_entries = p.sq_entries;
+    u->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    u->ksq_head = (_Atomic unsigned *)(sq + p.sq_off.head);
+    u->ksq_tail = (_Atomic unsigned *)(sq + p.sq_off.tail);
+    u->sq_tail = atomic_load_explicit(u->ksq_tail, memory_order_relaxed);
+    // Slot i of the submission array always names SQE i
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) array[i] = i;
+    u->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    u->kcq_head = (_Atomic unsigned *)(cq + p.cq_off.head);
+    u->kcq_tail = (_Atomic unsigned *)(cq + p.cq_off.tail);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    u->nbufs = nbufs;
+    u->buf_size = buf_size;
+    u->br_size = nbufs * sizeof(struct io_uring_buf);
+    u->br = mmap(NULL, u->br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = malloc((size_t)nbufs * buf_size);
+    if (u->br == MAP_FAILED || !u->bufs) goto fail;
+    struct io_uring_buf_reg reg = {.ring_addr = (uint64_t)(uintptr_t)u->br, .ring_entries = nbufs, .bgid = BUF_GROUP};
+    if (sys_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) goto fail;
+    for (unsigned i = 0; i < nbufs; i++) buf_add(u, i);
+    buf_publish(u);
+    return u;
+
+fail:
+    err = errno;
+    uring_free(u);
+    errno = err;
+    return NULL;
+}
+
+static int submit(struct uring *u, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    atomic_store_explicit(u->ksq_tail, u->sq_tail, memory_order_release);
+    unsigned pending = u->sq_tail - atomic_load_explicit(u->ksq_head, memory_order_acquire);
+    for (;;) {
+        int rc = sys_enter(u->fd, pending, min_complete, flags, arg, argsz);
+        if (rc >= 0) return 0;
+        if (errno == EINTR) continue;
+        return errno == ETIME ? 0 : -1;
+    }
+}
+
+// The next free SQE, zeroed; flushes the queue to the kernel when full
+static struct io_uring_sqe *get_sqe(struct uring *u) {
+    if (u->sq_tail - atomic_load_explicit(u->ksq_head, memory_order_acquire) == u->sq_entries) {
+        if (submit(u, 0, 0, NULL, 0) < 0) return NULL;
+        if (u->sq_tail - atomic_load_explicit(u->ksq_head, memory_order_acquire) == u->sq_entries) return NULL;
+    }
+    struct io_uring_sqe *sqe = &u->sqes[u->sq_tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_tail++;
+    return sqe;
+}
+
+int uring_wait(struct uring *u, int timeout_ms) {
+    unsigned ready = atomic_load_explicit(u->kcq_tail, memory_order_acquire) !=
+                     atomic_load_explicit(u->kcq_head, memory_order_relaxed);
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg = {0};
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+    return submit(u, ready ? 0 : 1, flags, timeout_ms >= 0 ? &arg : NULL, timeout_ms >= 0 ? sizeof(arg) : 0);
+}
+
+int uring_next(struct uring *u, struct uring_event *ev) {
+    unsigned head = atomic_load_explicit(u->kcq_head, memory_order_relaxed);
+    for (;;) {
+        if (head == atomic_load_explicit(u->kcq_tail, memory_order_acquire)) return 0;
+        const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        ev->tag = cqe->user_data;
+        ev->res = cqe->res;
+        ev->flags = (cqe->flags & IORING_CQE_F_MORE ? URING_F_MORE : 0) |
+                    (cqe->flags & IORING_CQE_F_BUFFER ? URING_F_BUFFER : 0);
+        ev->buf = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        atomic_store_explicit(u->kcq_head, ++head, memory_order_release);
+        if (ev->tag) return 1;
+    }
+}
+
+char *uring_buf(struct uring *u, unsigned buf) {
+    return u->bufs + (size_t)buf * u->buf_size;
+}
+
+void uring_buf_put(struct uring *u, unsigned buf) {
+    buf_add(u, buf);
+    buf_publish(u);
+}
+
+int uring_accept(struct uring *u, int fd, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int uring_recv(struct uring *u, int fd, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUF_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int uring_sendmsg(struct uring *u, int fd, const struct msghdr *msg, int flags, uint64_t tag, uint64_t shutdown_tag) {
+    // Both SQEs or neither: a lone linked SQE would chain to whatever
+    // comes next
+    if (shutdown_tag && u->sq_tail + 1 - atomic_load_explicit(u->ksq_head, memory_order_acquire) >= u->sq_entries &&
+        submit(u, 0, 0, NULL, 0) < 0) {
+        return -1;
+    }
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)msg;
+    sqe->len = 1;
+    sqe->msg_flags = (unsigned)flags | MSG_WAITALL;
+    sqe->user_data = tag;
+    if (shutdown_tag) {
+        sqe->flags = IOSQE_IO_LINK;
+        if (uring_shutdown(u, fd, shutdown_tag) < 0) return -1;
+    }
+    return 0;
+}
+
+int uring_poll(struct uring *u, int fd, unsigned events, int multishot, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->len = multishot ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int uring_shutdown(struct uring *u, int fd, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_SHUTDOWN;
+    sqe->fd = fd;
+    sqe->len = SHUT_WR;
+    sqe->user_data = tag;
+    return 0;
+}
+
+int uring_cancel(struct uring *u, uint64_t tag) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = tag;
+    return 0;
+}
+
+int uring_cancel_fd(struct uring *u, int fd) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = fd;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    return 0;
+}
+
+int uring_close(struct uring *u, int fd) {
+    struct io_uring_sqe *sqe = get_sqe(u);
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = fd;
+    return 0;
+}
+
+#endif
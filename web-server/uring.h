@@ -0,0 +1,80 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+// Just enough io_uring for the server loop, on the raw system calls (no
+// liburing). One ring per worker, used only by the thread that created it.
+// Received data lands in a ring of provided buffers, so idle connections
+// pin no memory; a buffer is handed back with uring_buf_put() once copied.
+//
+// Every request carries a 64-bit tag that comes back in its completions.
+// Requests submitted with tag 0 complete silently. Built with NO_URING,
+// uring_new() always fails with ENOSYS.
+
+#define URING_F_MORE 1              // the request stays armed: more completions follow
+#define URING_F_BUFFER 2            // buf is a provided buffer holding res bytes
+
+struct uring_event {
+    uint64_t tag;
+    int res;                        // result, or -errno
+    unsigned flags;
+    unsigned buf;
+};
+
+struct uring;
+
+// A ring with room for sq_entries pending requests and nbufs receive
+// buffers of buf_size bytes. Needs Linux 6.0 (multishot receive); returns
+// NULL with errno set otherwise.
+struct uring *uring_new(unsigned sq_entries, unsigned nbufs, unsigned buf_size);
+
+void uring_free(struct uring *u);
+
+// Submits everything queued and waits up to timeout_ms (-1: no limit) for
+// a completion, unless one is already waiting. Returns -1 on error.
+int uring_wait(struct uring *u, int timeout_ms);
+
+// Takes the next completion into ev. Returns 0 when there is none.
+int uring_next(struct uring *u, struct uring_event *ev);
+
+char *uring_buf(struct uring *u, unsigned buf);
+
+void uring_buf_put(struct uring *u, unsigned buf);
+
+// The request builders return -1 only if the submission queue is full and
+// cannot be flushed.
+
+// Multishot accept; sockets come back non-blocking and close-on-exec
+int uring_accept(struct uring *u, int fd, uint64_t tag);
+
+// Multishot receive into provided buffers. Ends (no URING_F_MORE) on EOF,
+// errors, cancellation or -ENOBUFS when every buffer is in use.
+int uring_recv(struct uring *u, int fd, uint64_t tag);
+
+// sendmsg() that completes only when all of msg is sent or on error. msg
+// and what it points to must stay put until then. With a nonzero
+// shutdown_tag the write side is shut down right after, in the same
+// submission, and that completes with shutdown_tag.
+int uring_sendmsg(struct uring *u, int fd, const struct msghdr *msg, int flags, uint64_t tag, uint64_t shutdown_tag);
+
+// Poll for events (POLLIN, POLLOUT); multishot keeps reporting them
+int uring_poll(struct uring *u, int fd, unsigned events, int multishot, uint64_t tag);
+
+// Shuts down the write side
+int uring_shutdown(struct uring *u, int fd, uint64_t tag);
+
+// Cancels the request with this tag; it completes with -ECANCELED
+int uring_cancel(struct uring *u, uint64_t tag);
+
+// Cancels every request on fd that has started. A request linked behind
+// another starts, and only then looks up its fd, once that one completes:
+// fd must stay open until all of them are in, or a socket that reuses the
+// number takes their effect.
+int uring_cancel_fd(struct uring *u, int fd);
+
+int uring_close(struct uring *u, int fd);
+
+#endif // URING_H
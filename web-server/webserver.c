@@ -1,199 +1,3060 @@
-// Minimal single-file C web server with embedded UI
+// Minimal C web server with an embedded UI
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/openat2.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "accesslog.h"
+#include "admission.h"
+#include "arena.h"
+#include "assets.h"
+#include "handoff.h"
+#include "http_parser.h"
+#include "metrics.h"
+#include "mime.h"
+#include "router.h"
+#include "scan.h"
+#include "sse.h"
+#include "timerwheel.h"
+#include "uring.h"
+#include "websocket.h"
+
 #define SERVER_PORT 8080
-#define BACKLOG 16
-#define RECV_BUF 8192
+#define BACKLOG SOMAXCONN
+#define RECV_BUF HTTP_MAX_HEAD
+#define MAX_EVENTS 256
+#define ACCEPT_BATCH 64             // accepts per listener wakeup; the rest wait for the next pass
+#define KEEPALIVE_TIMEOUT_MS 5000   // idle between requests
+#define HEADER_TIMEOUT_MS 10000     // from a request's first byte (or the accept) to its blank line
+#define BODY_TIMEOUT_MS 10000       // between reads of input after the head
+#define WRITE_TIMEOUT_MS 10000      // between sends while output is queued
+#define SHED_TARGET_MS 5            // queueing delay tolerated under standing overload
+#define SHED_INTERVAL_MS 100        // window over which overload must persist
+#define WAIT_BLOCKED_NS 20000       // a poll that took longer had nothing ready when called
+#define MAX_KEEPALIVE_REQUESTS 100
+#define OUT_HIGH_WATER (64 * 1024)
+#define STATIC_ROUTE "/static/*"
+#define ASSET_ROUTE "/assets/*"
+#define OUT_SEGS 32
+#define STATIC_CACHE_FILE_MAX (64 * 1024)
+#define FILE_CACHE_BYTES (64 * 1024 * 1024)     // default for -C
+#define FILE_CACHE_BUCKETS 1024
+#define FILE_CACHE_WATCHES 4096     // directories watched for changes; entries below others use stat()
+#define ARENA_CHUNK 4096            // request arena chunk size
+#define ARENA_POOL_CHUNKS 256       // idle chunks each worker keeps for reuse
+#define SSE_QUEUE_MAX (16 * 1024)   // unsent event bytes before a subscriber is dropped
+#define SSE_SNDBUF (32 * 1024)      // socket send buffer of a subscriber
+#define SSE_RETRY_MS 2000           // reconnect delay suggested to EventSource clients
+#define WS_MAX_MESSAGE (64 * 1024)  // longest WebSocket message, fragments joined
+#define WS_BURST_MAX (SSE_HISTORY / 2)  // chat events published ahead of the worker's delivery
+#define WS_PING_MS (KEEPALIVE_TIMEOUT_MS / 2)   // quiet time before a WebSocket is pinged
+#define URING_ENTRIES 256           // io_uring submission queue per worker
+#define URING_BUFS 512              // provided receive buffers per worker
+#define URING_BUF_SIZE 4096
+#define RECV_SPILL_MAX (64 * 1024)  // io_uring: bytes held past a full rbuf before receiving pauses
+#define RANGES_MAX 16               // ranges honoured in one request; more get the whole file
+#define DRAIN_TIMEOUT_MS 30000      // default for -g
+#define HANDOFF_READY_MS 10000      // how long a successor may take to start
+
+static volatile sig_atomic_t keep_running = 1;
+// Set once a successor has taken over the listeners: responses close their
+// connections, and the workers exit as soon as they have none left
+static volatile sig_atomic_t draining;
+
+// A response serialized once: the status line and every header except
+// Connection, then the body. The Connection line is picked per request from
+// the two constants below, so one copy serves keep-alive and close alike and
+// the whole response goes out in a single sendmsg().
+struct response {
+    int status;
+    const char *head;
+    size_t head_len;
+    const char *body;
+    size_t body_len;
+    // Assets also carry validators and the 304 that answers a request
+    // still holding this body, serialized the same way
+    char etag[32];              // quoted; empty for responses without validators
+    time_t mtime;               // Last-Modified
+    const char *not_modified;
+    size_t not_modified_len;
+};
+
+static const char conn_keep_alive_line[] = "Connection: keep-alive\r\n\r\n";
+static const char conn_close_line[] = "Connection: close\r\n\r\n";
+
+// Content codings kept for compressible assets, in server preference order
+// for equal client q-values. Bundled assets are indexed the same way.
+enum { ENC_IDENTITY = ASSET_IDENTITY, ENC_BR = ASSET_BR, ENC_GZIP = ASSET_GZIP, ENC_COUNT = ASSET_CODINGS };
+
+static const char *const enc_names[ENC_COUNT] = {"identity", "br", "gzip"};
+
+static struct response (*resp_assets)[ENC_COUNT];     // by index into assets[]
+static struct response resp_bad_request;
+static struct response resp_forbidden;
+static struct response resp_not_found;
+static struct response resp_uri_too_long;
+static struct response resp_header_too_large;
+static struct response resp_not_implemented;
+static struct response resp_version_not_supported;
+static struct response resp_internal_error;
+static struct response resp_unavailable;
+
+// extra holds additional header lines (each ending in CRLF), or NULL
+static int response_build(struct response *r, const char *status, const char *content_type,
+                          const char *extra, const char *body, size_t body_len) {
+    char head[512];
+    int n = snprintf(head, sizeof(head),
+                     "HTTP/1.1 %s\r\n"
+                     "Server: c-min-web/1.0\r\n"
+                     "Content-Type: %s\r\n"
+                     "Content-Length: %zu\r\n"
+                     "%s",
+                     status, content_type, body_len, extra ? extra : "");
+    if (n < 0 || (size_t)n >= sizeof(head)) return -1;
+    r->head = strdup(head);
+    if (!r->head) return -1;
+    r->status = atoi(status);
+    r->head_len = (size_t)n;
+    r->body = body;
+    r->body_len = body_len;
+    return 0;
+}
+
+static uint64_t hash64(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+#define HASH64_INIT 14695981039346656037ull
+
+// A strong entity tag: tag names the content, and each coding of it gets
+// its own, since their bytes differ (RFC 9110 8.8.3.3)
+static void etag_format(char dst[32], uint64_t tag, int enc) {
+    snprintf(dst, 32, "\"%016llx%s%s\"", (unsigned long long)tag, enc != ENC_IDENTITY ? "-" : "",
+             enc != ENC_IDENTITY ? enc_names[enc] : "");
+}
+
+// Formats t as an IMF-fixdate, the preferred HTTP-date (RFC 9110 5.6.7)
+static void http_date(char dst[32], time_t t) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(dst, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// The header lines every answer about an asset repeats, 304s included:
+// its validators, Cache-Control when given, and Vary for assets kept in
+// more than one coding
+static void validators_format(char *dst, size_t cap, const char *etag, time_t mtime, const char *cache_control,
+                              int vary) {
+    char modified[32];
+    http_date(modified, mtime);
+    snprintf(dst, cap, "ETag: %s\r\nLast-Modified: %s\r\n%s%s%s%s", etag, modified,
+             cache_control ? "Cache-Control: " : "", cache_control ? cache_control : "", cache_control ? "\r\n" : "",
+             vary ? "Vary: Accept-Encoding\r\n" : "");
+}
+
+static void coding_format(char dst[48], int enc) {
+    dst[0] = '\0';
+    if (enc != ENC_IDENTITY) snprintf(dst, 48, "Content-Encoding: %s\r\n", enc_names[enc]);
+}
+
+// Builds the 200 of a cacheable asset in content coding enc, and the 304
+// for a client that already has it. Both carry the validators, and vary
+// adds Vary: Accept-Encoding for assets kept in more than one coding.
+// ranges advertises byte-range support.
+static int asset_build(struct response *r, const char *content_type, int enc, int vary, int ranges,
+                       const char *body, size_t body_len, uint64_t tag, time_t mtime) {
+    etag_format(r->etag, tag, enc);
+    r->mtime = mtime;
+    char validators[128];
+    validators_format(validators, sizeof(validators), r->etag, mtime, NULL, vary);
+    char extra[224];
+    coding_format(extra, enc);
+    if (ranges) strcat(extra, "Accept-Ranges: bytes\r\n");
+    strcat(extra, validators);
+    if (response_build(r, "200 OK", content_type, extra, body, body_len) < 0) return -1;
+    // A 304 repeats the validators and Vary but no other metadata of the
+    // body (RFC 9110 15.4.5)
+    char head[256];
+    int n = snprintf(head, sizeof(head), "HTTP/1.1 304 Not Modified\r\nServer: c-min-web/1.0\r\n%s", validators);
+    r->not_modified = strdup(head);
+    if (!r->not_modified) return -1;
+    r->not_modified_len = (size_t)n;
+    return 0;
+}
+
+// Builds the fixed error responses and wraps the bundled assets at startup
+static int build_responses(void) {
+    struct {
+        struct response *r;
+        const char *status;
+        const char *type;
+        const char *body;
+    } table[] = {
+        {&resp_bad_request, "400 Bad Request", "text/plain; charset=utf-8", "Bad Request\n"},
+        {&resp_forbidden, "403 Forbidden", "text/plain; charset=utf-8", "Forbidden\n"},
+        {&resp_not_found, "404 Not Found", "text/plain; charset=utf-8", "Not Found\n"},
+        {&resp_uri_too_long, "414 URI Too Long", "text/plain; charset=utf-8", "URI Too Long\n"},
+        {&resp_header_too_large, "431 Request Header Fields Too Large", "text/plain; charset=utf-8",
+         "Request Header Fields Too Large\n"},
+        {&resp_not_implemented, "501 Not Implemented", "text/plain; charset=utf-8", "Not Implemented\n"},
+        {&resp_version_not_supported, "505 HTTP Version Not Supported", "text/plain; charset=utf-8",
+         "HTTP Version Not Supported\n"},
+        {&resp_internal_error, "500 Internal Server Error", "text/plain; charset=utf-8", "Internal Server Error\n"},
+    };
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+        if (response_build(table[i].r, table[i].status, table[i].type, NULL, table[i].body, strlen(table[i].body)) < 0) {
+            return -1;
+        }
+    }
+    static const char unavailable[] = "Service Unavailable\n";
+    if (response_build(&resp_unavailable, "503 Service Unavailable", "text/plain; charset=utf-8",
+                       "Retry-After: 1\r\n", unavailable, strlen(unavailable)) < 0) {
+        return -1;
+    }
+    // Everything was serialized by tools/bundle; only pointers are copied
+    resp_assets = calloc(assets_count ? assets_count : 1, sizeof(*resp_assets));
+    if (!resp_assets) return -1;
+    for (size_t i = 0; i < assets_count; i++) {
+        for (int enc = 0; enc < ENC_COUNT; enc++) {
+            const struct asset_variant *v = &assets[i].v[enc];
+            struct response *r = &resp_assets[i][enc];
+            if (!v->head) continue;
+            r->status = 200;
+            r->head = v->head;
+            r->head_len = v->head_len;
+            r->body = v->body;
+            r->body_len = v->body_len;
+            snprintf(r->etag, sizeof(r->etag), "%s", v->etag);
+            r->mtime = (time_t)assets[i].mtime;
+            r->not_modified = v->not_modified;
+            r->not_modified_len = v->not_modified_len;
+        }
+    }
+    return 0;
+}
+
+// Small static files are kept as serialized responses, built on first use
+// and shared by all workers, up to a total size (-C). When that is reached
+// the least recently used entries make room. Entries are invalidated by
+// inotify as soon as their file changes, so a hit costs no system call;
+// where inotify cannot follow the file (a symlink on the way, or no
+// inotify) a hit is revalidated with one stat() instead. A connection still
+// sending an entry pins it with a reference count.
+struct file_entry {
+    atomic_int refs;
+    struct file_entry *next;    // hash chain
+    struct file_entry *lru_prev;
+    struct file_entry *lru_next;
+    char *key;                  // normalized request path
+    char *file;                 // path that was opened, with index.html resolved
+    int watched;                // inotify reports changes; otherwise stat() each hit
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    size_t bytes;               // memory held by all variants
+    struct response resp[ENC_COUNT];
+    char *body[ENC_COUNT];
+};
+
+// A directory with an inotify watch, relative to the document root
+struct cache_watch {
+    int wd;
+    char *dir;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    size_t capacity;            // bytes; 0 keeps nothing
+    size_t bytes;
+    size_t entries;
+    struct file_entry *lru;     // most recently used first
+    struct file_entry *lru_tail;
+    uint64_t gen;               // bumped by every change inotify reports
+    int inotify_fd;             // -1 without inotify
+    struct cache_watch watches[FILE_CACHE_WATCHES];
+    int nwatches;
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+    uint64_t evictions;
+    uint64_t invalidations;
+    struct file_entry *buckets[FILE_CACHE_BUCKETS];
+} file_cache = {.lock = PTHREAD_MUTEX_INITIALIZER};    // capacity and inotify_fd are set in main()
+
+static uint32_t hash_str(const char *s) {
+    uint32_t h = 2166136261u;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void file_entry_get(struct file_entry *e) {
+    atomic_fetch_add_explicit(&e->refs, 1, memory_order_relaxed);
+}
+
+static void file_entry_put(struct file_entry *e) {
+    if (atomic_fetch_sub_explicit(&e->refs, 1, memory_order_acq_rel) != 1) return;
+    free(e->key);
+    free(e->file);
+    for (int enc = 0; enc < ENC_COUNT; enc++) {
+        free((char *)e->resp[enc].head);
+        free((char *)e->resp[enc].not_modified);
+        free(e->body[enc]);
+    }
+    free(e);
+}
+
+static void lru_unlink_locked(struct file_entry *e) {
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else file_cache.lru = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else file_cache.lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_locked(struct file_entry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = file_cache.lru;
+    if (file_cache.lru) file_cache.lru->lru_prev = e;
+    else file_cache.lru_tail = e;
+    file_cache.lru = e;
+}
+
+// Returns a referenced entry for key, or NULL
+static struct file_entry *file_cache_lookup(const char *key) {
+    struct file_entry **bucket = &file_cache.buckets[hash_str(key) % FILE_CACHE_BUCKETS];
+    pthread_mutex_lock(&file_cache.lock);
+    struct file_entry *e = *bucket;
+    while (e && strcmp(e->key, key) != 0) e = e->next;
+    if (e) {
+        if (e != file_cache.lru) {
+            lru_unlink_locked(e);
+            lru_push_locked(e);
+        }
+        file_entry_get(e);
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+    return e;
+}
+
+// Returns 0 if e was no longer in the cache
+static int file_cache_unlink_locked(struct file_entry *e) {
+    struct file_entry **pp = &file_cache.buckets[hash_str(e->key) % FILE_CACHE_BUCKETS];
+    while (*pp && *pp != e) pp = &(*pp)->next;
+    if (!*pp) return 0;
+    *pp = e->next;
+    lru_unlink_locked(e);
+    file_cache.bytes -= e->bytes;
+    file_cache.entries--;
+    file_entry_put(e);
+    return 1;
+}
+
+// Drops an entry found stale on a hit
+static void file_cache_remove(struct file_entry *e) {
+    pthread_mutex_lock(&file_cache.lock);
+    if (file_cache_unlink_locked(e)) file_cache.invalidations++;
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+static uint64_t file_cache_gen(void) {
+    pthread_mutex_lock(&file_cache.lock);
+    uint64_t gen = file_cache.gen;
+    pthread_mutex_unlock(&file_cache.lock);
+    return gen;
+}
+
+// Publishes e, replacing any entry under the same key and evicting the
+// least recently used ones until it fits. gen is file_cache_gen() from
+// before e's file was opened: if inotify reported a change since, e may
+// already be stale and is served this once but not kept.
+static void file_cache_insert(struct file_entry *e, uint64_t gen) {
+    struct file_entry **bucket = &file_cache.buckets[hash_str(e->key) % FILE_CACHE_BUCKETS];
+    pthread_mutex_lock(&file_cache.lock);
+    for (struct file_entry *old = *bucket; old; old = old->next) {
+        if (strcmp(old->key, e->key) == 0) {
+            file_cache_unlink_locked(old);
+            break;
+        }
+    }
+    if (e->bytes <= file_cache.capacity && !(e->watched && gen != file_cache.gen)) {
+        while (file_cache.bytes + e->bytes > file_cache.capacity) {
+            file_cache_unlink_locked(file_cache.lru_tail);
+            file_cache.evictions++;
+        }
+        file_entry_get(e);
+        e->next = *bucket;
+        *bucket = e;
+        lru_push_locked(e);
+        file_cache.bytes += e->bytes;
+        file_cache.entries++;
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+// Drops the entries whose file is path or lies below it; "" drops them all
+static void file_cache_invalidate_locked(const char *path, size_t len) {
+    file_cache.gen++;
+    struct file_entry *next;
+    for (struct file_entry *e = file_cache.lru; e; e = next) {
+        next = e->lru_next;
+        if (len && (strncmp(e->file, path, len) != 0 || (e->file[len] && e->file[len] != '/'))) continue;
+        file_cache_unlink_locked(e);
+        file_cache.invalidations++;
+    }
+}
+
+static void file_cache_stats(struct metrics_file_cache *fc) {
+    pthread_mutex_lock(&file_cache.lock);
+    fc->hits = atomic_load_explicit(&file_cache.hits, memory_order_relaxed);
+    fc->misses = atomic_load_explicit(&file_cache.misses, memory_order_relaxed);
+    fc->evictions = file_cache.evictions;
+    fc->invalidations = file_cache.invalidations;
+    fc->entries = file_cache.entries;
+    fc->bytes = file_cache.bytes;
+    fc->capacity = file_cache.capacity;
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+struct byte_range {
+    off_t first;
+    off_t last;             // inclusive, as in Content-Range
+};
+
+// A multipart/byteranges body sent from a file: between its ranges, the
+// head of each part is queued when the range before it is done
+struct file_parts {
+    const char *mime;
+    off_t size;             // of the whole representation
+    char boundary[20];
+    int n;
+    int next;               // the part to queue next
+    uint64_t pending;       // bytes not queued yet: part heads, ranges, closing delimiter
+    struct byte_range r[RANGES_MAX];
+};
+
+// A piece of queued output. Bytes the connection produced itself are copied
+// into its out buffer (data == NULL, off is the position there); prebuilt
+// and cached responses are referenced in place, with ref pinning a cache
+// entry, or msg an event, until its bytes have been sent.
+struct out_seg {
+    const char *data;
+    size_t off;
+    size_t len;
+    struct file_entry *ref;
+    struct sse_msg *msg;
+};
+
+// A connection upgraded to WebSocket. Frames arrive in the connection's
+// rbuf; a message split over several frames is joined in msg.
+struct ws_conn {
+    unsigned id;                    // shown to the other chat clients
+    struct ws_frame_head frame;     // frame being received
+    int in_frame;                   // frame's header consumed, payload pending
+    uint64_t frame_pos;             // payload bytes of it consumed so far
+    enum ws_opcode msg_op;          // WS_TEXT or WS_BINARY, WS_CONTINUATION if none open
+    char *msg;
+    size_t msg_len;
+    size_t msg_cap;
+    int held;                       // frames left unread until the worker delivers
+};
+
+// What a connection needs under the io_uring loop, where reads and sends
+// complete later instead of being retried on readiness
+struct conn_uring {
+    int ops;                // requests in flight that name the connection
+    int recv;               // multishot receive: 0 off, 1 armed, 2 being cancelled
+    int eof;                // the peer closed; nothing more will arrive
+    int send_busy;
+    int poll_busy;          // waiting for room to sendfile()
+    int shut;               // write side shut down behind the last send
+    char *send_out;         // c->out as the send in flight saw it
+    struct msghdr msg;      // the send in flight
+    struct iovec iov[OUT_SEGS];
+    char *spill;            // received bytes that did not fit rbuf
+    size_t spill_len;
+    size_t spill_cap;
+};
+
+// What a connection is waiting on, each with its own timeout
+enum conn_wait {
+    WAIT_NONE = -1,
+    WAIT_HEADER = METRICS_TIMEOUT_HEADER,   // the rest of a request head
+    WAIT_BODY = METRICS_TIMEOUT_BODY,       // input after the head; so far only what lingering discards
+    WAIT_IDLE = METRICS_TIMEOUT_IDLE,       // the next request, or on a stream the next message
+    WAIT_WRITE = METRICS_TIMEOUT_WRITE,     // the peer to take queued output
+};
+
+// Per-connection state for the event loop. Requests are accumulated in rbuf
+// and handled in arrival order; their responses are queued as out_segs and
+// drained with sendmsg() as the socket becomes writable.
+struct conn {
+    _Alignas(16) int fd;    // aligned for UTAG()
+    int events;             // epoll interest currently registered
+    int close_after;        // close once the queued output is sent
+    int lingering;          // write side shut, discarding input until EOF
+    int status;             // status code of the response last queued, for the log
+    int route;              // index in routes[] of the last request, ROUTE_UNMATCHED if none
+    int head_only;          // the request is HEAD: its response is queued without a body
+    uint32_t peer_addr;     // client IPv4 address, network order
+    unsigned requests;      // requests handled on this connection
+    long long last_active;  // monotonic ms of the last read or write progress
+    long long arrived;      // monotonic ns the last input arrived, for admission control
+    long long unblocked;    // ns: when its own output last stopped holding it up
+    struct timer timer;     // fires when what it waits on (wait) takes too long
+    int wait;               // enum conn_wait the timer was set for
+    struct conn *closing_prev;
+    struct conn *closing_next;
+    size_t rlen;
+    char *out;              // bytes owned by this connection
+    size_t out_len;
+    size_t out_cap;
+    struct out_seg segs[OUT_SEGS];
+    int nsegs;
+    int seg_head;           // first segment not fully sent
+    size_t seg_sent;        // bytes of segs[seg_head] already sent
+    size_t out_queued;      // bytes queued and not yet sent
+    uint64_t out_total;     // bytes ever queued, for accounting
+    struct http_request req;    // parse state of the request at the start of rbuf
+    struct arena arena;         // request-scoped allocations, reset per request
+    const struct route *body_route; // route reading the request's body, NULL if none
+    struct http_body body;      // framing of that body; rbuf holds what follows the head
+    char *head;             // copy of the request's head meanwhile, in the arena
+    long long req_start;    // ns: when that request started
+    uint64_t req_mark;      // out_total then
+    int file_fd;            // file body sent after out, -1 if none
+    off_t file_off;
+    off_t file_end;
+    struct file_parts *parts;   // multipart ranges of file_fd still to come, NULL if none
+    int sse;                // GET /events: the rest of the connection is a stream
+    struct ws_conn *ws;     // set once upgraded by GET /ws
+    uint64_t sse_last;      // id of the last event queued
+    struct conn *sub_prev;  // the loop's subscribers
+    struct conn *sub_next;
+    int closing;            // io_uring: closed, freed once u.ops drops to 0
+    struct conn_uring u;
+    char rbuf[RECV_BUF];
+};
+
+// A listening socket. A worker has its own; one started with fewer workers
+// than the server it took over from also accepts from the listeners left
+// over, as closing them would reset the connections queued on them.
+struct listener {
+    _Alignas(16) int fd;    // aligned for UTAG(); -1 once closed
+};
+
+// Every connection has one timer on the loop's wheel, set for whatever it
+// is waiting on; expiry closes it without looking at the others.
+struct loop {
+    _Alignas(16) int ep;        // aligned for UTAG()
+    struct listener *listeners;
+    int nlisteners;
+    int listening;              // listeners not closed yet
+    int sse_fd;                 // eventfd signalled when an event is published
+    struct timer_wheel timers;  // one per connection, in ms
+    struct arena_pool pool;     // chunks for the connections' arenas
+    uint64_t sse_seen;          // newest event handed to the subscribers
+    struct conn *subs;          // event streams and WebSockets
+    unsigned nsubs;
+    unsigned long long sse_dropped;     // subscribers closed for falling behind
+    struct access_ring *log;    // NULL when access logging is off
+    struct metrics_shard *metrics;
+    struct uring *uring;        // NULL: the epoll loop
+    struct conn *closing;       // io_uring: closed connections with requests in flight
+    unsigned nconns;
+    unsigned writing;           // connections with a response being sent (WAIT_WRITE)
+    unsigned max_conns;         // this worker's share of the limits, 0 for none
+    unsigned max_writing;
+    struct admission adm;
+    long long pass_start;       // ns: when the loop last woke up
+    long long ready_since;      // ns: how far back the work of this pass may have been waiting
+    int stamped;                // epoll: the kernel timestamps what arrives
+    long long realtime_offset;  // ns: CLOCK_REALTIME minus CLOCK_MONOTONIC, for the timestamps
+    int draining;               // 1 once told to drain, 2 once its last connection closed
+};
+
+// io_uring request tags: the connection, listener or loop pointer with the
+// kind of request in the low bits
+enum uring_op {
+    UOP_ACCEPT = 1,
+    UOP_STOP,
+    UOP_BUS,
+    UOP_DRAIN,
+    UOP_RECV,               // the rest are a connection's
+    UOP_SEND,
+    UOP_POLL,
+    UOP_SHUT,
+};
+
+#define UOP_MASK 15
+#define UTAG(p, op) ((uint64_t)(uintptr_t)(p) | (op))
+
+static long long now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static const int wait_timeout_ms[] = {
+    [WAIT_HEADER] = HEADER_TIMEOUT_MS,
+    [WAIT_BODY] = BODY_TIMEOUT_MS,
+    [WAIT_IDLE] = KEEPALIVE_TIMEOUT_MS,
+    [WAIT_WRITE] = WRITE_TIMEOUT_MS,
+};
+
+static enum conn_wait conn_waiting_on(const struct conn *c) {
+    if (c->out_queued > 0 || c->file_fd >= 0) return WAIT_WRITE;
+    if (c->lingering || c->body_route) return WAIT_BODY;
+    if (c->sse || c->ws) return WAIT_IDLE;
+    if (c->rlen > 0 || c->requests == 0) return WAIT_HEADER;
+    return WAIT_IDLE;
+}
+
+// Sets c's timer for what it now waits on. The header deadline is fixed
+// when the head starts, so trickling bytes cannot extend it; the others
+// run from the last progress.
+static void conn_timer(struct loop *lp, struct conn *c) {
+    enum conn_wait w = conn_waiting_on(c);
+    if (w == WAIT_HEADER && c->wait == WAIT_HEADER) return;
+    uint64_t deadline = (uint64_t)(c->last_active + wait_timeout_ms[w]);
+    if (w == c->wait && c->timer.expires == deadline) return;
+    if ((w == WAIT_WRITE) != (c->wait == WAIT_WRITE)) lp->writing += w == WAIT_WRITE ? 1 : -1;
+    c->wait = (int)w;
+    timer_add(&lp->timers, &c->timer, deadline);
+}
+
+// Once everything queued has been sent, the segment table and the buffer
+// start over. Under io_uring they are otherwise only reset by the next
+// flush, and output queued in between must not join a segment already sent.
+static void out_reclaim(struct conn *c) {
+    if (c->seg_head < c->nsegs) return;
+    c->nsegs = c->seg_head = 0;
+    c->seg_sent = 0;
+    c->out_len = 0;
+}
+
+static int out_append(struct conn *c, const char *data, size_t len) {
+    if (len == 0) return 0;
+    out_reclaim(c);
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 1024;
+        while (cap < c->out_len + len) cap *= 2;
+        char *p;
+        if (c->out && c->out == c->u.send_out) {
+            // An io_uring send still reads the old buffer; it is freed
+            // when that send completes
+            p = malloc(cap);
+            if (p) memcpy(p, c->out, c->out_len);
+        } else {
+            p = realloc(c->out, cap);
+        }
+        if (!p) return -1;
+        c->out = p;
+        c->out_cap = cap;
+    }
+    struct out_seg *last = c->nsegs ? &c->segs[c->nsegs - 1] : NULL;
+    if (last && !last->data && last->off + last->len == c->out_len) {
+        last->len += len;
+    } else if (c->nsegs < OUT_SEGS) {
+        c->segs[c->nsegs++] = (struct out_seg){.off = c->out_len, .len = len};
+    } else {
+        return -1;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+    c->out_queued += len;
+    c->out_total += len;
+    return 0;
+}
+
+// Queues len bytes at data without copying. The last slot is kept for
+// owned bytes, so once the segment table is nearly full the data is copied.
+static int out_ref(struct conn *c, const char *data, size_t len, struct file_entry *ref) {
+    if (len == 0) return 0;
+    out_reclaim(c);
+    if (c->nsegs >= OUT_SEGS - 1) return out_append(c, data, len);
+    if (ref) file_entry_get(ref);
+    c->segs[c->nsegs++] = (struct out_seg){.data = data, .len = len, .ref = ref};
+    c->out_queued += len;
+    c->out_total += len;
+    return 0;
+}
+
+static void seg_release(struct out_seg *s) {
+    if (s->ref) file_entry_put(s->ref);
+    if (s->msg) sse_msg_put(s->msg);
+}
+
+// Wall clock, formatted once per second by the clock thread (clock_main).
+// It fills the slot readers are not using, then publishes it by index.
+// Readers copy what they need and retry if the slot's sequence number was
+// odd (being written) or changed meanwhile, so they never block.
+#define CLOCK_DATE_MAX 48
+#define CLOCK_HEAD_MAX 256
+
+struct clock_slot {
+    atomic_uint seq;
+    size_t date_len;
+    char date[CLOCK_DATE_MAX];          // "Date: ...\r\n"
+    size_t iso_len;
+    char iso[32];                       // body of GET /time
+    size_t time_head_len;
+    char time_head[CLOCK_HEAD_MAX];     // GET /time up to the Connection line
+};
+
+static struct clock_slot clock_slots[2];
+static atomic_int clock_cur;
+
+static void clock_tick(void) {
+    int next = 1 - atomic_load_explicit(&clock_cur, memory_order_relaxed);
+    struct clock_slot *s = &clock_slots[next];
+    unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+    atomic_store_explicit(&s->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    // Not time(): it reads the coarse clock, which can still show the
+    // previous second just after the boundary the thread woke up for
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    struct tm t;
+    gmtime_r(&now.tv_sec, &t);
+    char date[CLOCK_DATE_MAX];
+    s->date_len = strftime(date, sizeof(date), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &t);
+    memcpy(s->date, date, sizeof(date));
+    s->iso_len = strftime(s->iso, sizeof(s->iso), "%Y-%m-%dT%H:%M:%SZ", &t);
+    int n = snprintf(s->time_head, sizeof(s->time_head),
+                     "HTTP/1.1 200 OK\r\n"
+                     "Server: c-min-web/1.0\r\n"
+                     "%s"
+                     "Content-Type: text/plain; charset=utf-8\r\n"
+                     "Content-Length: %zu\r\n",
+                     date, s->iso_len);
+    s->time_head_len = n > 0 && (size_t)n < sizeof(s->time_head) ? (size_t)n : 0;
+
+    atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+    atomic_store_explicit(&clock_cur, next, memory_order_release);
+    sse_publish("time", s->iso, s->iso_len, 0);
+}
+
+static const struct clock_slot *clock_read_begin(unsigned *seq) {
+    for (;;) {
+        const struct clock_slot *s = &clock_slots[atomic_load_explicit(&clock_cur, memory_order_acquire)];
+        *seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        if (!(*seq & 1)) return s;
+    }
+}
+
+static int clock_read_retry(const struct clock_slot *s, unsigned seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) != seq;
+}
+
+// Copies the current "Date: ...\r\n" line into dst, which must hold
+// CLOCK_DATE_MAX bytes, and returns its length
+static size_t clock_date(char *dst) {
+    const struct clock_slot *s;
+    unsigned seq;
+    size_t n;
+    do {
+        s = clock_read_begin(&seq);
+        n = s->date_len < CLOCK_DATE_MAX ? s->date_len : 0;
+        memcpy(dst, s->date, n);
+    } while (clock_read_retry(s, seq));
+    return n;
+}
+
+// Queues a serialized head and body. Date and Connection, and for assets
+// the route's Cache-Control, are the only per-request header lines; they
+// are copied together between the shared head and body.
+static void send_serialized(struct conn *c, int status, const char *head, size_t head_len, const char *body,
+                            size_t body_len, struct file_entry *ref, const char *cache_control) {
+    const char *line = c->close_after ? conn_close_line : conn_keep_alive_line;
+    size_t line_len = c->close_after ? sizeof(conn_close_line) - 1 : sizeof(conn_keep_alive_line) - 1;
+    char lines[CLOCK_DATE_MAX + 128];
+    size_t n = clock_date(lines);
+    if (cache_control) {
+        int m = snprintf(lines + n, sizeof(lines) - n, "Cache-Control: %s\r\n", cache_control);
+        if (m > 0 && (size_t)m < sizeof(lines) - n) n += (size_t)m;
+    }
+    c->status = status;
+    if (out_ref(c, head, head_len, ref) < 0) return;
+    if (out_append(c, lines, n) < 0) return;
+    if (out_append(c, line, line_len) < 0) return;
+    if (!c->head_only) out_ref(c, body, body_len, ref);
+}
+
+static void send_prebuilt(struct conn *c, const struct response *r, struct file_entry *ref) {
+    send_serialized(c, r->status, r->head, r->head_len, r->body, r->body_len, ref, NULL);
+}
+
+// Whether the list in an If-None-Match value holds etag, or is "*". The
+// comparison is weak (RFC 9110 8.8.3.2): a W/ prefix does not matter.
+static int etag_listed(const char *v, size_t len, const char *etag) {
+    size_t etag_len = strlen(etag);
+    size_t i = 0;
+    for (;;) {
+        while (i < len && (v[i] == ' ' || v[i] == '\t' || v[i] == ',')) i++;
+        if (i == len) return 0;
+        if (v[i] == '*') return 1;
+        if (len - i >= 2 && v[i] == 'W' && v[i + 1] == '/') i += 2;
+        if (i == len || v[i] != '"') return 0;
+        const char *end = memchr(v + i + 1, '"', len - i - 1);
+        if (!end) return 0;
+        size_t n = (size_t)(end - (v + i)) + 1;
+        if (n == etag_len && memcmp(v + i, etag, n) == 0) return 1;
+        i += n;
+    }
+}
+
+// Parses an HTTP-date in any of its three forms (RFC 9110 5.6.7)
+static int parse_http_date(const char *v, size_t len, time_t *t) {
+    static const char *const formats[] = {
+        "%a, %d %b %Y %H:%M:%S GMT",    // IMF-fixdate
+        "%A, %d-%b-%y %H:%M:%S GMT",    // obsolete RFC 850
+        "%a %b %e %H:%M:%S %Y",         // asctime()
+    };
+    char buf[64];
+    if (len >= sizeof(buf)) return -1;
+    memcpy(buf, v, len);
+    buf[len] = '\0';
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *end = strptime(buf, formats[i], &tm);
+        if (end && !*end) {
+            *t = timegm(&tm);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Whether the client already holds the representation with these
+// validators (RFC 9110 13.2.2): If-None-Match decides when present,
+// otherwise If-Modified-Since
+static int client_has(const char *buf, const struct http_request *req, const char *etag, time_t mtime) {
+    const struct http_header *h = http_find_header(req, buf, "If-None-Match");
+    if (h) return etag_listed(buf + h->value.off, h->value.len, etag);
+    h = http_find_header(req, buf, "If-Modified-Since");
+    time_t since;
+    return h && parse_http_date(buf + h->value.off, h->value.len, &since) == 0 && mtime <= since;
+}
+
+// Answers a request for a cacheable asset with r, or with its 304 when the
+// client's copy is current; either way under the route's Cache-Control
+static void send_asset(struct conn *c, const struct http_request *req, const struct response *r,
+                       struct file_entry *ref, const char *cache_control) {
+    if (client_has(c->rbuf, req, r->etag, r->mtime)) {
+        send_serialized(c, 304, r->not_modified, r->not_modified_len, NULL, 0, ref, cache_control);
+    } else {
+        send_serialized(c, r->status, r->head, r->head_len, r->body, r->body_len, ref, cache_control);
+    }
+}
+
+// Formats a response into the output buffer; extra holds additional
+// header lines, each ending in CRLF, or is NULL
+static void send_response(struct conn *c, const char *status, const char *content_type, const char *extra,
+                          const char *body) {
+    size_t body_len = body ? strlen(body) : 0;
+    char date[CLOCK_DATE_MAX];
+    date[clock_date(date)] = '\0';
+    c->status = atoi(status);
+    size_t n;
+    char *header = arena_printf(&c->arena, &n,
+                                "HTTP/1.1 %s\r\n"
+                                "Server: c-min-web/1.0\r\n"
+                                "%s"
+                                "Content-Type: %s; charset=utf-8\r\n"
+                                "Content-Length: %zu\r\n"
+                                "%s"
+                                "Connection: %s\r\n\r\n",
+                                status, date, content_type, body_len, extra ? extra : "",
+                                c->close_after ? "close" : "keep-alive");
+    if (!header) return;
+    if (out_append(c, header, n) < 0) return;
+    if (body_len && !c->head_only) {
+        out_append(c, body, body_len);
+    }
+}
+
+// Decides whether the connection stays open after this request, following
+// the HTTP/1.1 defaults: 1.1 persists unless "Connection: close", 1.0 only
+// with "Connection: keep-alive".
+static int wants_close(struct conn *c, const struct http_request *req, int reads_body) {
+    if (draining || c->requests >= MAX_KEEPALIVE_REQUESTS) return 1;
+    // A body left unread ends the stream, as the next request would be in it
+    if (!reads_body && http_has_body(req)) return 1;
+    if (req->version_minor >= 1) return req->conn_close;
+    return !req->conn_keep_alive;
+}
+
+// Static assets under /static/ are served from the directory given with
+// -d, opened once at startup. Bodies go out with sendfile() so file data never
+// passes through user space.
+static int docroot_fd = -1;
+
+// Turns a request path such as "/css/../img/%61.png" into a path relative
+// to the document root ("img/a.png"). Percent-escapes are decoded first, then
+// empty and "." segments dropped and ".." resolved. Returns -1 for malformed
+// escapes, NUL bytes, or a path that climbs above the root, 1 for a path
+// that can only name a directory ("img/", "img/."), and 0 otherwise.
+static int normalize_path(const char *in, size_t in_len, char *out, size_t out_size) {
+    if (in_len >= out_size) return -1;
+    long decoded = scan.pct_decode(out, in, in_len, SCAN_STRICT);
+    if (decoded < 0) return -1;
+    size_t len = (size_t)decoded;
+    if (memchr(out, '\0', len)) return -1;
+    out[len] = '\0';
+
+    // Resolve segments in place; out only ever shrinks
+    size_t w = 0;
+    size_t r = 0;
+    int dir = 0;
+    while (r < len) {
+        while (r < len && out[r] == '/') r++;
+        size_t start = r;
+        while (r < len && out[r] != '/') r++;
+        size_t seg = r - start;
+        // Anything but a name last leaves a directory
+        dir = 1;
+        if (seg == 0 || (seg == 1 && out[start] == '.')) continue;
+        if (seg == 2 && out[start] == '.' && out[start + 1] == '.') {
+            if (w == 0) return -1;
+            while (w > 0 && out[w - 1] != '/') w--;
+            if (w > 0) w--;
+            continue;
+        }
+        dir = 0;
+        if (w > 0) out[w++] = '/';
+        memmove(out + w, out + start, seg);
+        w += seg;
+    }
+    out[w] = '\0';
+    return dir;
+}
+
+// Opens rel beneath the document root. openat2(RESOLVE_BENEATH) also stops
+// symlinks from leading outside it; older kernels fall back to openat().
+static int open_beneath(const char *rel) {
+    struct open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+    };
+    const char *p = rel[0] ? rel : ".";
+    int fd = (int)syscall(SYS_openat2, docroot_fd, p, &how, sizeof(how));
+    if (fd < 0 && errno == ENOSYS) {
+        fd = openat(docroot_fd, p, O_RDONLY | O_CLOEXEC);
+    }
+    return fd;
+}
+
+// Like open_beneath(), but sets *linked if a symlink may lie on the way:
+// inotify watches the directories named in rel, not those a link leads to
+static int open_beneath_linked(const char *rel, int *linked) {
+    struct open_how how = {
+        .flags = O_RDONLY | O_CLOEXEC,
+        .resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS,
+    };
+    int fd = (int)syscall(SYS_openat2, docroot_fd, rel[0] ? rel : ".", &how, sizeof(how));
+    if (fd < 0 && (errno == ELOOP || errno == ENOSYS)) {
+        *linked = 1;
+        fd = open_beneath(rel);
+    }
+    return fd;
+}
+
+// Watches every directory on the way to rel (the document root, "a",
+// "a/b" for "a/b/c.html") for changes to what they contain. Returns 1 if
+// all of them are watched, so that a cache entry for rel needs no stat()
+// on its hits.
+static int file_cache_watch_dirs(const char *rel) {
+    if (file_cache.inotify_fd < 0) return 0;
+    int all = 1;
+    pthread_mutex_lock(&file_cache.lock);
+    for (size_t len = 0;;) {
+        int known = 0;
+        for (int i = 0; i < file_cache.nwatches && !known; i++) {
+            const char *dir = file_cache.watches[i].dir;
+            known = strncmp(dir, rel, len) == 0 && dir[len] == '\0';
+        }
+        if (!known) {
+            char path[1100];
+            int n = snprintf(path, sizeof(path), "/proc/self/fd/%d/%.*s", docroot_fd, (int)len, rel);
+            int wd = file_cache.nwatches < FILE_CACHE_WATCHES && n > 0 && (size_t)n < sizeof(path)
+                         ? inotify_add_watch(file_cache.inotify_fd, path,
+                                             IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                                 IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+                         : -1;
+            char *dir = wd >= 0 ? strndup(rel, len) : NULL;
+            if (!dir) {
+                all = 0;
+                break;
+            }
+            // A directory reached under a second name keeps one watch; the
+            // newer name is the one that led here
+            int i = 0;
+            while (i < file_cache.nwatches && file_cache.watches[i].wd != wd) i++;
+            if (i == file_cache.nwatches) file_cache.nwatches++;
+            else free(file_cache.watches[i].dir);
+            file_cache.watches[i].wd = wd;
+            file_cache.watches[i].dir = dir;
+        }
+        const char *slash = strchr(rel + len + (len > 0), '/');
+        if (!slash) break;
+        len = (size_t)(slash - rel);
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+    return all;
+}
+
+// Forgets the watches on dir and the directories below it, whose names no
+// longer lead to them
+static void file_cache_unwatch_locked(const char *dir, size_t len) {
+    for (int i = 0; i < file_cache.nwatches;) {
+        const char *d = file_cache.watches[i].dir;
+        if (len && (strncmp(d, dir, len) != 0 || (d[len] && d[len] != '/'))) {
+            i++;
+            continue;
+        }
+        inotify_rm_watch(file_cache.inotify_fd, file_cache.watches[i].wd);
+        free(file_cache.watches[i].dir);
+        file_cache.watches[i] = file_cache.watches[--file_cache.nwatches];
+    }
+}
+
+// Applies a batch of inotify events: each drops the entries for the name
+// it reports, including everything below it when that is a directory, and
+// the original of a changed .gz or .br sibling
+static void file_cache_apply_events(const char *buf, size_t len) {
+    pthread_mutex_lock(&file_cache.lock);
+    for (size_t off = 0; off + sizeof(struct inotify_event) <= len;) {
+        const struct inotify_event *ev = (const struct inotify_event *)(buf + off);
+        off += sizeof(*ev) + ev->len;
+        if (ev->mask & IN_Q_OVERFLOW) {
+            // Events were lost; anything may have changed
+            file_cache_invalidate_locked("", 0);
+            continue;
+        }
+        int i = 0;
+        while (i < file_cache.nwatches && file_cache.watches[i].wd != ev->wd) i++;
+        if (i == file_cache.nwatches) continue;
+        const char *dir = file_cache.watches[i].dir;
+        // Files are opened relative to the document root's descriptor, so
+        // moving the root itself changes nothing that is served
+        if ((ev->mask & IN_MOVE_SELF) && !dir[0]) continue;
+        if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+            char gone[1100];
+            size_t n = strlen(dir);
+            memcpy(gone, dir, n + 1);
+            file_cache_invalidate_locked(gone, n);
+            file_cache_unwatch_locked(gone, n);
+            continue;
+        }
+        if (ev->len == 0) continue;
+        char path[1100];
+        int n = snprintf(path, sizeof(path), "%s%s%s", dir, dir[0] ? "/" : "", ev->name);
+        if (n < 0 || (size_t)n >= sizeof(path)) {
+            file_cache_invalidate_locked("", 0);
+            continue;
+        }
+        file_cache_invalidate_locked(path, (size_t)n);
+        if (n > 3 && (strcmp(path + n - 3, ".gz") == 0 || strcmp(path + n - 3, ".br") == 0)) {
+            file_cache_invalidate_locked(path, (size_t)n - 3);
+        }
+    }
+    pthread_mutex_unlock(&file_cache.lock);
+}
+
+// Fills q[] with the client's weight (0-1000) for each content coding.
+// Without an Accept-Encoding header only identity is acceptable.
+static void parse_accept_encoding(const char *buf, const struct http_request *req, int q[ENC_COUNT]) {
+    char value[256];
+    for (int enc = 0; enc < ENC_COUNT; enc++) q[enc] = 0;
+    q[ENC_IDENTITY] = 1000;
+    const struct http_header *h = http_find_header(req, buf, "Accept-Encoding");
+    if (!h) return;
+    size_t n = h->value.len < sizeof(value) - 1 ? h->value.len : sizeof(value) - 1;
+    memcpy(value, buf + h->value.off, n);
+    value[n] = '\0';
+
+    int seen[ENC_COUNT] = {0};
+    int star = -1;
+    char *save = NULL;
+    for (char *tok = strtok_r(value, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        while (*tok == ' ' || *tok == '\t') tok++;
+        size_t name_len = strcspn(tok, " \t;");
+        int weight = 1000;
+        const char *qp = strstr(tok + name_len, "q=");
+        if (qp) weight = (int)(strtod(qp + 2, NULL) * 1000 + 0.5);
+        if (weight < 0) weight = 0;
+        if (weight > 1000) weight = 1000;
+        if (name_len == 1 && tok[0] == '*') {
+            star = weight;
+            continue;
+        }
+        for (int enc = 0; enc < ENC_COUNT; enc++) {
+            if (strlen(enc_names[enc]) == name_len && strncasecmp(tok, enc_names[enc], name_len) == 0) {
+                q[enc] = weight;
+                seen[enc] = 1;
+            }
+        }
+    }
+    if (star >= 0) {
+        for (int enc = 0; enc < ENC_COUNT; enc++) {
+            if (!seen[enc]) q[enc] = star;
+        }
+    }
+}
+
+// Picks the available variant with the highest q, preferring the smaller
+// coding on ties. Identity is the fallback even if the client refused it.
+static const struct response *pick_variant(const struct response v[ENC_COUNT], const int q[ENC_COUNT]) {
+    int best = ENC_IDENTITY;
+    for (int enc = ENC_IDENTITY + 1; enc < ENC_COUNT; enc++) {
+        if (v[enc].head && q[enc] > 0 && q[enc] >= q[best]) {
+            if (q[enc] > q[best] || best == ENC_IDENTITY) best = enc;
+        }
+    }
+    return &v[best];
+}
+
+static void send_error_for_errno(struct conn *c, int err) {
+    if (err == EACCES || err == EPERM) {
+        send_prebuilt(c, &resp_forbidden, NULL);
+    } else if (err == ENOENT || err == ENOTDIR || err == EXDEV || err == ELOOP || err == ENAMETOOLONG) {
+        send_prebuilt(c, &resp_not_found, NULL);
+    } else {
+        send_prebuilt(c, &resp_internal_error, NULL);
+    }
+}
+
+static char *read_whole(int fd, size_t size) {
+    char *buf = malloc(size ? size : 1);
+    if (!buf) return NULL;
+    size_t got = 0;
+    while (got < size) {
+        ssize_t r = pread(fd, buf + got, size - got, (off_t)got);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            free(buf);
+            return NULL;
+        }
+        got += (size_t)r;
+    }
+    return buf;
+}
+
+// Opens the precompressed sibling of file ("file.br", "file.gz") if it is a
+// regular file at least as new as the original. Returns -1 otherwise. Sets
+// *linked as open_beneath_linked() does.
+static int open_sidecar(const char *file, int enc, const struct stat *orig, struct stat *st, int *linked) {
+    char path[1100];
+    snprintf(path, sizeof(path), "%s.%s", file, enc == ENC_BR ? "br" : "gz");
+    int fd = open_beneath_linked(path, linked);
+    if (fd < 0) return -1;
+    if (fstat(fd, st) < 0 || !S_ISREG(st->st_mode) || st->st_mtim.tv_sec < orig->st_mtim.tv_sec ||
+        (st->st_mtim.tv_sec == orig->st_mtim.tv_sec && st->st_mtim.tv_nsec < orig->st_mtim.tv_nsec)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Names a file's content by where it lives and when it last changed, which
+// is what the cache checks on every hit as well
+static uint64_t file_tag(const struct stat *st) {
+    uint64_t h = hash64(HASH64_INIT, &st->st_dev, sizeof(st->st_dev));
+    h = hash64(h, &st->st_ino, sizeof(st->st_ino));
+    h = hash64(h, &st->st_size, sizeof(st->st_size));
+    h = hash64(h, &st->st_mtim.tv_sec, sizeof(st->st_mtim.tv_sec));
+    return hash64(h, &st->st_mtim.tv_nsec, sizeof(st->st_mtim.tv_nsec));
+}
+
+// Reads a small file, and for compressible types its .br/.gz siblings, into
+// a new, unpublished cache entry holding one reference. watched says whether
+// inotify reports changes to file; the siblings must be watched as well.
+static struct file_entry *file_entry_load(const char *key, const char *file, int fd, const struct stat *st,
+                                          int watched) {
+    struct file_entry *e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    atomic_init(&e->refs, 1);
+    e->key = strdup(key);
+    e->file = strdup(file);
+    e->body[ENC_IDENTITY] = read_whole(fd, (size_t)st->st_size);
+    if (!e->key || !e->file || !e->body[ENC_IDENTITY]) goto fail;
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime = st->st_mtim;
+    e->bytes = (size_t)st->st_size;
+
+    const char *mime = mime_type_for(file);
+    int compressible = mime_compressible(mime);
+    uint64_t tag = file_tag(st);
+    if (asset_build(&e->resp[ENC_IDENTITY], mime, ENC_IDENTITY, compressible, 1, e->body[ENC_IDENTITY],
+                    (size_t)st->st_size, tag, st->st_mtim.tv_sec) < 0) {
+        goto fail;
+    }
+    int linked = 0;
+    for (int enc = ENC_IDENTITY + 1; compressible && enc < ENC_COUNT; enc++) {
+        struct stat zst;
+        int zfd = open_sidecar(file, enc, st, &zst, &linked);
+        if (zfd < 0) continue;
+        if (zst.st_size <= STATIC_CACHE_FILE_MAX) e->body[enc] = read_whole(zfd, (size_t)zst.st_size);
+        close(zfd);
+        if (!e->body[enc]) continue;
+        if (asset_build(&e->resp[enc], mime, enc, 1, 1, e->body[enc], (size_t)zst.st_size, tag,
+                        st->st_mtim.tv_sec) < 0) {
+            goto fail;
+        }
+        e->bytes += (size_t)zst.st_size;
+    }
+    e->watched = watched && !linked;
+    return e;
+fail:
+    file_entry_put(e);
+    return NULL;
+}
+
+// For entries inotify cannot vouch for, one stat() instead of
+// open/fstat/read: the entry is still good if the path leads to the same,
+// unmodified file
+static int file_entry_fresh(const struct file_entry *e) {
+    struct stat st;
+    if (fstatat(docroot_fd, e->file[0] ? e->file : ".", &st, 0) < 0) return 0;
+    return st.st_dev == e->dev && st.st_ino == e->ino && st.st_size == e->size &&
+           st.st_mtim.tv_sec == e->mtime.tv_sec && st.st_mtim.tv_nsec == e->mtime.tv_nsec;
+}
+
+// Reads a decimal position, saturating rather than overflowing. Returns -1
+// if there are no digits.
+static off_t parse_pos(const char *v, size_t len, size_t *i) {
+    if (*i == len || v[*i] < '0' || v[*i] > '9') return -1;
+    off_t n = 0;
+    for (; *i < len && v[*i] >= '0' && v[*i] <= '9'; (*i)++) {
+        n = n > (INT64_MAX - 9) / 10 ? INT64_MAX : n * 10 + (v[*i] - '0');
+    }
+    return n;
+}
+
+// Parses a Range value (RFC 9110 14.1.2) against a representation of size
+// bytes into at most max ranges. Returns how many can be satisfied, -1 if
+// none can, or 0 if the header is to be ignored: not in bytes, malformed,
+// or asking for more than max ranges.
+static int parse_range(const char *v, size_t len, off_t size, struct byte_range *r, int max) {
+    if (len < 6 || strncasecmp(v, "bytes=", 6) != 0) return 0;
+    size_t i = 6;
+    int n = 0, specs = 0;
+    for (;;) {
+        while (i < len && (v[i] == ' ' || v[i] == '\t' || v[i] == ',')) i++;
+        if (i == len) break;
+        off_t first = parse_pos(v, len, &i);
+        if (i == len || v[i] != '-') return 0;
+        i++;
+        off_t last = parse_pos(v, len, &i);
+        while (i < len && (v[i] == ' ' || v[i] == '\t')) i++;
+        if ((i < len && v[i] != ',') || (first < 0 && last < 0) || (first >= 0 && last >= 0 && last < first)) {
+            return 0;
+        }
+        specs++;
+        if (first < 0) {
+            // A suffix: the last so many bytes
+            if (last == 0 || size == 0) continue;
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        } else {
+            if (first >= size) continue;
+            if (last < 0 || last >= size) last = size - 1;
+        }
+        if (n == max) return 0;
+        r[n].first = first;
+        r[n].last = last;
+        n++;
+    }
+    if (!specs) return 0;
+    return n ? n : -1;
+}
+
+// If-Range (RFC 9110 13.1.5): ranges only apply to the copy the client
+// has, named by a strong entity tag or its exact Last-Modified date
+static int if_range_holds(const char *buf, const struct http_request *req, const char *etag, time_t mtime) {
+    const struct http_header *h = http_find_header(req, buf, "If-Range");
+    if (!h) return 1;
+    const char *v = buf + h->value.off;
+    size_t len = h->value.len;
+    if (len && v[0] == '"') return len == strlen(etag) && memcmp(v, etag, len) == 0;
+    time_t t;
+    return parse_http_date(v, len, &t) == 0 && t == mtime;
+}
+
+// The ranges a request asks for out of size bytes, in ranges[RANGES_MAX]:
+// as for parse_range(), 0 means the whole representation is sent. So is it
+// when the ranges add up to more than the whole, as overlapping ones would
+// only multiply what is sent. Ranges are only defined for GET (RFC 9110
+// 14.2); a HEAD gets the head of the whole.
+static int request_ranges(const char *buf, const struct http_request *req, const char *etag, time_t mtime,
+                          off_t size, struct byte_range *ranges) {
+    if (http_method_parse(buf + req->method.off, req->method.len) != HTTP_GET) return 0;
+    const struct http_header *h = http_find_header(req, buf, "Range");
+    if (!h) return 0;
+    int n = parse_range(buf + h->value.off, h->value.len, size, ranges, RANGES_MAX);
+    if (n == 0 || !if_range_holds(buf, req, etag, mtime)) return 0;
+    off_t total = 0;
+    for (int i = 0; i < n; i++) total += ranges[i].last - ranges[i].first + 1;
+    return total > size ? 0 : n;
+}
+
+// Formats the head of one part of a multipart/byteranges body into
+// dst[128]; the delimiter's leading CRLF ends the part before
+static size_t part_head_format(char *dst, const struct file_parts *p, int i) {
+    int n = snprintf(dst, 128, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                     p->boundary, p->mime, (long long)p->r[i].first, (long long)p->r[i].last, (long long)p->size);
+    return n > 0 && n < 128 ? (size_t)n : 0;
+}
+
+static size_t parts_end_format(char *dst, const struct file_parts *p) {
+    return (size_t)snprintf(dst, 32, "\r\n--%s--\r\n", p->boundary);
+}
+
+// Queues the head of a file response: the status line, Date, fields (each
+// line ending in CRLF), validators and Connection
+static int send_file_head(struct conn *c, int status, const char *fields, const char *validators) {
+    const char *line = status == 206 ? "206 Partial Content" : status == 304 ? "304 Not Modified" : "200 OK";
+    char date[CLOCK_DATE_MAX];
+    date[clock_date(date)] = '\0';
+    char header[1024];
+    int n = snprintf(header, sizeof(header),
+                     "HTTP/1.1 %s\r\n"
+                     "Server: c-min-web/1.0\r\n"
+                     "%s%s%s"
+                     "Connection: %s\r\n\r\n",
+                     line, date, fields, validators, c->close_after ? "close" : "keep-alive");
+    c->status = status;
+    if (n < 0 || (size_t)n >= sizeof(header)) return -1;
+    return out_append(c, header, (size_t)n);
+}
+
+static void send_unsatisfiable(struct conn *c, off_t size) {
+    char extra[64];
+    snprintf(extra, sizeof(extra), "Content-Range: bytes */%lld\r\n", (long long)size);
+    send_response(c, "416 Range Not Satisfiable", "text/plain", extra, "Range Not Satisfiable\n");
+}
+
+// Sends ranges of a representation of size bytes with a 206: a single
+// range as it is, several as multipart/byteranges. The bytes come from
+// body, pinned by ref, or if body is NULL from fd, which is taken over and
+// sent from with sendfile() at each range's offset.
+static void send_ranges(struct conn *c, const char *coding, const char *validators, const char *mime,
+                        const struct byte_range *r, int n, off_t size, const char *body, struct file_entry *ref,
+                        int fd) {
+    char fields[320];
+    if (n == 1) {
+        snprintf(fields, sizeof(fields), "Content-Type: %s\r\nContent-Length: %lld\r\nContent-Range: bytes %lld-%lld/%lld\r\n%s",
+                 mime, (long long)(r[0].last - r[0].first + 1), (long long)r[0].first, (long long)r[0].last,
+                 (long long)size, coding);
+        if (send_file_head(c, 206, fields, validators) < 0) {
+            if (fd >= 0) close(fd);
+            return;
+        }
+        if (body) {
+            out_ref(c, body + r[0].first, (size_t)(r[0].last - r[0].first + 1), ref);
+        } else {
+            c->file_fd = fd;
+            c->file_off = r[0].first;
+            c->file_end = r[0].last + 1;
+        }
+        return;
+    }
+
+    struct file_parts *p = calloc(1, sizeof(*p));
+    if (!p) {
+        if (fd >= 0) close(fd);
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+    p->mime = mime;
+    p->size = size;
+    snprintf(p->boundary, sizeof(p->boundary), "%016llx",
+             (unsigned long long)hash64(HASH64_INIT ^ (uint64_t)now_ms(), &c, sizeof(c)));
+    p->n = n;
+    memcpy(p->r, r, (size_t)n * sizeof(*r));
+    char part[128];
+    uint64_t total = parts_end_format(part, p);
+    for (int i = 0; i < n; i++) total += part_head_format(part, p, i) + (uint64_t)(r[i].last - r[i].first + 1);
+    snprintf(fields, sizeof(fields), "Content-Type: multipart/byteranges; boundary=%s\r\nContent-Length: %llu\r\n%s",
+             p->boundary, (unsigned long long)total, coding);
+    if (send_file_head(c, 206, fields, validators) < 0) goto done;
+    if (body) {
+        for (int i = 0; i < n; i++) {
+            if (out_append(c, part, part_head_format(part, p, i)) < 0) goto done;
+            if (out_ref(c, body + r[i].first, (size_t)(r[i].last - r[i].first + 1), ref) < 0) goto done;
+        }
+        out_append(c, part, parts_end_format(part, p));
+        goto done;
+    }
+    // From a file, the first part goes out now and conn_send_file() queues
+    // the rest as it gets to them
+    size_t head = part_head_format(part, p, 0);
+    if (out_append(c, part, head) < 0) goto done;
+    p->next = 1;
+    p->pending = total - head - (uint64_t)(r[0].last - r[0].first + 1);
+    c->file_fd = fd;
+    c->file_off = r[0].first;
+    c->file_end = r[0].last + 1;
+    c->parts = p;
+    return;
+done:
+    if (fd >= 0) close(fd);
+    free(p);
+}
+
+// Answers from a cached file: the prebuilt 200 or 304, or a 206 of it
+static void serve_entry(struct conn *c, const struct http_request *req, struct file_entry *e, const int q[ENC_COUNT],
+                        const char *cache_control) {
+    const struct response *r = pick_variant(e->resp, q);
+    struct byte_range ranges[RANGES_MAX];
+    int n = request_ranges(c->rbuf, req, r->etag, r->mtime, (off_t)r->body_len, ranges);
+    if (n == 0 || client_has(c->rbuf, req, r->etag, r->mtime)) {
+        send_asset(c, req, r, e, cache_control);
+        return;
+    }
+    if (n < 0) {
+        send_unsatisfiable(c, (off_t)r->body_len);
+        return;
+    }
+    const char *mime = mime_type_for(e->file);
+    char validators[192], coding[48];
+    validators_format(validators, sizeof(validators), r->etag, r->mtime, cache_control, mime_compressible(mime));
+    coding_format(coding, (int)(r - e->resp));
+    send_ranges(c, coding, validators, mime, ranges, n, (off_t)r->body_len, r->body, e, -1);
+}
+
+static void serve_static(struct conn *c, const struct http_request *req, const char *req_path, size_t req_path_len,
+                         const int q[ENC_COUNT], const char *cache_control) {
+    if (docroot_fd < 0) {
+        send_prebuilt(c, &resp_not_found, NULL);
+        return;
+    }
+    // Room for the decoded path plus a possible "/index.html"
+    char *rel = arena_alloc(&c->arena, req_path_len + sizeof("/index.html"));
+    if (!rel) {
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+    int dir = normalize_path(req_path, req_path_len, rel, req_path_len + 1);
+    if (dir < 0) {
+        send_prebuilt(c, &resp_bad_request, NULL);
+        return;
+    }
+
+    struct file_entry *e = file_cache_lookup(rel);
+    if (e) {
+        if (e->watched || file_entry_fresh(e)) {
+            atomic_fetch_add_explicit(&file_cache.hits, 1, memory_order_relaxed);
+            // An entry opened under its own key is a file, not a directory
+            if (dir && strcmp(e->file, e->key) == 0) send_prebuilt(c, &resp_not_found, NULL);
+            else serve_entry(c, req, e, q, cache_control);
+            file_entry_put(e);
+            return;
+        }
+        file_cache_remove(e);
+        file_entry_put(e);
+    }
+
+    char *key = arena_strndup(&c->arena, rel, strlen(rel));
+    if (!key) {
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+    // Watched before opening, so that no change after the open goes unseen
+    uint64_t gen = file_cache_gen();
+    int watched = file_cache_watch_dirs(rel);
+    int linked = 0;
+    int fd = open_beneath_linked(rel, &linked);
+    if (fd < 0) {
+        send_error_for_errno(c, errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        send_error_for_errno(c, errno);
+        close(fd);
+        return;
+    }
+    if (dir && !S_ISDIR(st.st_mode)) {
+        close(fd);
+        send_prebuilt(c, &resp_not_found, NULL);
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        // A directory is served through its index.html
+        close(fd);
+        strcat(rel, rel[0] ? "/index.html" : "index.html");
+        watched = watched && file_cache_watch_dirs(rel);
+        fd = open_beneath_linked(rel, &linked);
+        if (fd < 0) {
+            send_error_for_errno(c, errno);
+            return;
+        }
+        if (fstat(fd, &st) < 0) {
+            send_error_for_errno(c, errno);
+            close(fd);
+            return;
+        }
+    }
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+        send_prebuilt(c, &resp_not_found, NULL);
+        return;
+    }
+
+    if (st.st_size <= STATIC_CACHE_FILE_MAX) {
+        atomic_fetch_add_explicit(&file_cache.misses, 1, memory_order_relaxed);
+        e = file_entry_load(key, rel, fd, &st, watched && !linked);
+        if (e) {
+            close(fd);
+            file_cache_insert(e, gen);
+            serve_entry(c, req, e, q, cache_control);
+            file_entry_put(e);
+            return;
+        }
+    }
+
+    // Large files: send a fresh precompressed sibling instead if the client takes it
+    const char *mime = mime_type_for(rel);
+    int compressible = mime_compressible(mime);
+    uint64_t tag = file_tag(&st);
+    time_t mtime = st.st_mtim.tv_sec;
+    int enc = ENC_IDENTITY;
+    int order[2] = {ENC_BR, ENC_GZIP};
+    if (q[ENC_GZIP] > q[ENC_BR]) {
+        order[0] = ENC_GZIP;
+        order[1] = ENC_BR;
+    }
+    for (int i = 0; compressible && i < 2; i++) {
+        int want = order[i];
+        if (q[want] == 0 || q[want] < q[ENC_IDENTITY]) continue;
+        struct stat zst;
+        int zfd = open_sidecar(rel, want, &st, &zst, &linked);
+        if (zfd < 0) continue;
+        close(fd);
+        fd = zfd;
+        st = zst;
+        enc = want;
+        break;
+    }
+
+    char etag[32], validators[192], coding[48];
+    etag_format(etag, tag, enc);
+    validators_format(validators, sizeof(validators), etag, mtime, cache_control, compressible);
+    coding_format(coding, enc);
+    if (client_has(c->rbuf, req, etag, mtime)) {
+        send_file_head(c, 304, "", validators);
+        close(fd);
+        return;
+    }
+    struct byte_range ranges[RANGES_MAX];
+    int nranges = request_ranges(c->rbuf, req, etag, mtime, st.st_size, ranges);
+    if (nranges < 0) {
+        close(fd);
+        send_unsatisfiable(c, st.st_size);
+        return;
+    }
+    if (nranges > 0) {
+        send_ranges(c, coding, validators, mime, ranges, nranges, st.st_size, NULL, NULL, fd);
+        return;
+    }
+    char fields[256];
+    snprintf(fields, sizeof(fields), "Content-Type: %s\r\nContent-Length: %lld\r\n%sAccept-Ranges: bytes\r\n", mime,
+             (long long)st.st_size, coding);
+    if (send_file_head(c, 200, fields, validators) < 0 || st.st_size == 0 || c->head_only) {
+        close(fd);
+        return;
+    }
+    c->file_fd = fd;
+    c->file_off = 0;
+    c->file_end = st.st_size;
+}
+
+static void send_parse_error(struct conn *c, int status) {
+    switch (status) {
+    case 414:
+        send_prebuilt(c, &resp_uri_too_long, NULL);
+        break;
+    case 431:
+        send_prebuilt(c, &resp_header_too_large, NULL);
+        break;
+    case 501:
+        send_prebuilt(c, &resp_not_implemented, NULL);
+        break;
+    case 505:
+        send_prebuilt(c, &resp_version_not_supported, NULL);
+        break;
+    default:
+        send_prebuilt(c, &resp_bad_request, NULL);
+        break;
+    }
+}
+
+// Routes. Each handler gets the parsed request, whose bytes sit at the
+// start of c->rbuf, and the router's match with captures and query pairs.
+typedef void (*route_fn)(struct conn *c, const struct http_request *req, const struct route_match *m);
+
+// A route with a body function takes request bodies. The body arrives
+// through body as it is received, a span at a time, and a call with data
+// NULL ends it. Only the current span is in memory, so an upload of any
+// size costs the same. handle may queue the response head, or leave
+// c->status 0 for body to queue it with the first span; until then, bad
+// framing is still answered with a 400. A handler that turns the body
+// down clears c->body_route and sets close_after.
+typedef void (*route_body_fn)(struct conn *c, const char *data, size_t len);
+
+struct route {
+    unsigned methods;
+    const char *pattern;
+    route_fn handle;
+    route_body_fn body;     // NULL: a request with a body closes the connection
+    const char *cache_control;  // sent with the assets it serves, NULL for none
+};
+
+static struct router *router;
+
+// Serves the bundled asset at path, relative to static/
+static void serve_asset(struct conn *c, const struct http_request *req, const char *path, size_t len,
+                        const char *cache_control) {
+    const struct asset *a = asset_find(path, len);
+    if (!a) {
+        send_prebuilt(c, &resp_not_found, NULL);
+        return;
+    }
+    int q[ENC_COUNT];
+    parse_accept_encoding(c->rbuf, req, q);
+    send_asset(c, req, pick_variant(resp_assets[a - assets], q), NULL, cache_control);
+}
+
+static void route_index(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    serve_asset(c, req, "index.html", 10, ((const struct route *)m->target)->cache_control);
+}
+
+// m->rest starts with the '/' after "/assets"
+static void route_asset(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    serve_asset(c, req, c->rbuf + m->rest.off + 1, m->rest.len - 1, ((const struct route *)m->target)->cache_control);
+}
+
+static void route_echo(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)req;
+    const char *msg = "(empty)";
+    struct http_slice value;
+    if (route_query(m, c->rbuf, "msg", &value) == 0 && value.len) {
+        char *decoded = arena_alloc(&c->arena, value.len + 1);
+        if (!decoded) {
+            send_prebuilt(c, &resp_internal_error, NULL);
+            return;
+        }
+        decoded[scan.pct_decode(decoded, c->rbuf + value.off, value.len, SCAN_FORM)] = '\0';
+        if (decoded[0]) msg = decoded;
+    }
+    send_response(c, "200 OK", "text/plain", NULL, msg);
+}
+
+// Queues the head of the echo of c->req. Once the body is being read, the
+// request's head is in c->head.
+static void echo_head(struct conn *c) {
+    const struct http_request *req = &c->req;
+    const char *buf = c->head ? c->head : c->rbuf;
+    const struct http_header *ct = http_find_header(req, buf, "Content-Type");
+    char framing[48];
+    if (req->chunked) snprintf(framing, sizeof(framing), "Transfer-Encoding: chunked\r\n");
+    else snprintf(framing, sizeof(framing), "Content-Length: %lld\r\n", req->content_length > 0 ? req->content_length : 0);
+    char date[CLOCK_DATE_MAX];
+    date[clock_date(date)] = '\0';
+    c->status = 200;
+    size_t n;
+    char *header = arena_printf(&c->arena, &n,
+                                "HTTP/1.1 200 OK\r\n"
+                                "Server: c-min-web/1.0\r\n"
+                                "%s"
+                                "Content-Type: %.*s\r\n"
+                                "%s"
+                                "Connection: %s\r\n\r\n",
+                                date, ct ? (int)ct->value.len : 24,
+                                ct ? buf + ct->value.off : "application/octet-stream", framing,
+                                c->close_after ? "close" : "keep-alive");
+    if (!header || out_append(c, header, n) < 0) {
+        c->body_route = NULL;
+        c->close_after = 1;
+    }
+}
+
+// POST or PUT /echo: the body goes back as it arrives, with the request's
+// Content-Type. A body of known length keeps it; a chunked one is sent
+// back chunked. The 200 waits for the first of the body (echo_head), so
+// that framing found bad before then gets a 400 instead.
+static void route_echo_upload(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)req;
+    (void)m;
+    c->status = 0;
+    if (!c->body_route) echo_head(c);
+}
+
+static void echo_body(struct conn *c, const char *data, size_t len) {
+    if (!c->status) {
+        echo_head(c);
+        if (!c->body_route) return;
+    }
+    if (!c->req.chunked) {
+        if (data) out_append(c, data, len);
+        return;
+    }
+    if (!data) {
+        out_append(c, "0\r\n\r\n", 5);
+        return;
+    }
+    char size[24];
+    int n = snprintf(size, sizeof(size), "%zx\r\n", len);
+    out_append(c, size, (size_t)n);
+    out_append(c, data, len);
+    out_append(c, "\r\n", 2);
+}
+
+// Copies the response serialized by the clock thread; nothing is formatted
+static void route_time(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)req;
+    (void)m;
+    char head[CLOCK_HEAD_MAX];
+    char iso[32];
+    size_t head_len, iso_len;
+    const struct clock_slot *s;
+    unsigned seq;
+    do {
+        s = clock_read_begin(&seq);
+        head_len = s->time_head_len < sizeof(head) ? s->time_head_len : 0;
+        iso_len = s->iso_len < sizeof(iso) ? s->iso_len : 0;
+        memcpy(head, s->time_head, head_len);
+        memcpy(iso, s->iso, iso_len);
+    } while (clock_read_retry(s, seq));
+
+    const char *line = c->close_after ? conn_close_line : conn_keep_alive_line;
+    size_t line_len = c->close_after ? sizeof(conn_close_line) - 1 : sizeof(conn_keep_alive_line) - 1;
+    c->status = 200;
+    if (out_append(c, head, head_len) < 0) return;
+    if (out_append(c, line, line_len) < 0) return;
+    if (!c->head_only) out_append(c, iso, iso_len);
+}
+
+// Turns the connection into an event stream; the worker subscribes it once
+// the handler returns (sse_subscribe). A reconnecting EventSource sends
+// Last-Event-ID and gets what it missed from the bus history first.
+static void route_events(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)m;
+    uint64_t last = sse_last_id();
+    const struct http_header *h = http_find_header(req, c->rbuf, "Last-Event-ID");
+    if (h && h->value.len && h->value.len < 21) {
+        char id[21];
+        memcpy(id, c->rbuf + h->value.off, h->value.len);
+        id[h->value.len] = '\0';
+        char *end;
+        unsigned long long v = strtoull(id, &end, 10);
+        if (*end == '\0' && v < last) last = v;
+    }
+
+    char date[CLOCK_DATE_MAX];
+    date[clock_date(date)] = '\0';
+    // A HEAD gets the head and no stream
+    char retry[32] = "";
+    if (!c->head_only) snprintf(retry, sizeof(retry), "retry: %d\n\n", SSE_RETRY_MS);
+    size_t n;
+    char *head = arena_printf(&c->arena, &n,
+                              "HTTP/1.1 200 OK\r\n"
+                              "Server: c-min-web/1.0\r\n"
+                              "%s"
+                              "Content-Type: text/event-stream\r\n"
+                              "Cache-Control: no-cache\r\n"
+                              "Connection: %s\r\n\r\n"
+                              "%s",
+                              date, c->close_after ? "close" : "keep-alive", retry);
+    if (!head || out_append(c, head, n) < 0) {
+        c->close_after = 1;
+        return;
+    }
+    c->status = 200;
+    if (c->head_only) return;
+    // The stream has no length and ends when either side closes
+    c->close_after = 0;
+    c->sse = 1;
+    c->sse_last = last;
+}
+
+static atomic_uint ws_next_id;
+
+static int header_has_token(const struct conn *c, const struct http_request *req, const char *name,
+                            const char *token) {
+    const struct http_header *h = http_find_header(req, c->rbuf, name);
+    return h && http_value_has_token(c->rbuf + h->value.off, h->value.len, token);
+}
+
+// Opening handshake (RFC 6455 4.2). The upgraded connection joins the
+// subscribers once the handler returns, like an event stream, and its
+// frames are handled by ws_process().
+static void route_ws(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)m;
+    // Only a GET upgrades (RFC 6455 4.1); a HEAD gets the head of a GET
+    // that did not ask to
+    if (c->head_only || !header_has_token(c, req, "Upgrade", "websocket")) {
+        c->close_after = 1;
+        send_response(c, "426 Upgrade Required", "text/plain", "Upgrade: websocket\r\n",
+                      "Upgrade Required\n");
+        return;
+    }
+    const struct http_header *key = http_find_header(req, c->rbuf, "Sec-WebSocket-Key");
+    const struct http_header *version = http_find_header(req, c->rbuf, "Sec-WebSocket-Version");
+    if (!version || !http_slice_eq(c->rbuf, version->value, "13")) {
+        c->close_after = 1;
+        send_response(c, "426 Upgrade Required", "text/plain", "Sec-WebSocket-Version: 13\r\n",
+                      "Upgrade Required\n");
+        return;
+    }
+    // The key is 16 random bytes in base64
+    if (req->version_minor < 1 || !header_has_token(c, req, "Connection", "upgrade") || !key ||
+        key->value.len != 24) {
+        c->close_after = 1;
+        send_prebuilt(c, &resp_bad_request, NULL);
+        return;
+    }
+    struct ws_conn *w = calloc(1, sizeof(*w));
+    if (!w) {
+        c->close_after = 1;
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+
+    char accept[WS_ACCEPT_LEN + 1];
+    ws_accept_key(c->rbuf + key->value.off, key->value.len, accept);
+    char date[CLOCK_DATE_MAX];
+    date[clock_date(date)] = '\0';
+    size_t n;
+    char *head = arena_printf(&c->arena, &n,
+                              "HTTP/1.1 101 Switching Protocols\r\n"
+                              "Server: c-min-web/1.0\r\n"
+                              "%s"
+                              "Upgrade: websocket\r\n"
+                              "Connection: Upgrade\r\n"
+                              "Sec-WebSocket-Accept: %s\r\n\r\n",
+                              date, accept);
+    if (!head || out_append(c, head, n) < 0) {
+        free(w);
+        c->close_after = 1;
+        return;
+    }
+    w->id = atomic_fetch_add_explicit(&ws_next_id, 1, memory_order_relaxed) + 1;
+    w->msg_op = WS_CONTINUATION;
+    c->ws = w;
+    c->status = 101;
+    c->close_after = 0;
+    c->sse_last = sse_last_id();
+}
+
+static void route_static(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    int q[ENC_COUNT];
+    parse_accept_encoding(c->rbuf, req, q);
+    serve_static(c, req, c->rbuf + m->rest.off, m->rest.len, q, ((const struct route *)m->target)->cache_control);
+}
+
+// Allocator counters of the worker that takes the request, for tuning
+// ARENA_CHUNK and ARENA_POOL_CHUNKS
+static void route_arena_stats(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)req;
+    (void)m;
+    const struct arena_pool *p = c->arena.pool;
+    const struct arena_stats *st = &p->stats;
+    char *body = arena_printf(&c->arena, NULL,
+                              "chunk_size %zu\n"
+                              "chunks_pooled %zu\n"
+                              "chunk_mallocs %llu\n"
+                              "chunk_reuses %llu\n"
+                              "chunk_frees %llu\n"
+                              "large_allocs %llu\n"
+                              "resets %llu\n"
+                              "bytes %llu\n"
+                              "peak_request_bytes %llu\n"
+                              "multi_chunk_requests %llu\n",
+                              p->chunk_size, p->nfree, (unsigned long long)st->chunk_mallocs,
+                              (unsigned long long)st->chunk_reuses, (unsigned long long)st->chunk_frees,
+                              (unsigned long long)st->large_allocs, (unsigned long long)st->resets,
+                              (unsigned long long)st->bytes, (unsigned long long)st->peak_bytes,
+                              (unsigned long long)st->multi_chunk);
+    if (!body) {
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+    send_response(c, "200 OK", "text/plain", NULL, body);
+}
+
+// Merged request metrics of all workers, in Prometheus text format
+static void route_metrics(struct conn *c, const struct http_request *req, const struct route_match *m) {
+    (void)req;
+    (void)m;
+    struct metrics_file_cache fc;
+    file_cache_stats(&fc);
+    char *body = metrics_render(NULL, &fc);
+    if (!body) {
+        send_prebuilt(c, &resp_internal_error, NULL);
+        return;
+    }
+    send_response(c, "200 OK", "text/plain; version=0.0.4", NULL, body);
+    free(body);
+}
+
+// Bundled assets change with every build and are revalidated on every
+// load, which a 304 makes cheap; files may be edited in place, so caches
+// keep them for a minute at most
+static const struct route routes[] = {
+    {ROUTE_METHOD(HTTP_GET), "/", route_index, NULL, "no-cache"},
+    {ROUTE_METHOD(HTTP_GET), ASSET_ROUTE, route_asset, NULL, "no-cache"},
+    {ROUTE_METHOD(HTTP_GET), "/echo", route_echo, NULL, NULL},
+    {ROUTE_METHOD(HTTP_POST) | ROUTE_METHOD(HTTP_PUT), "/echo", route_echo_upload, echo_body, NULL},
+    {ROUTE_METHOD(HTTP_GET), "/time", route_time, NULL, NULL},
+    {ROUTE_METHOD(HTTP_GET), "/events", route_events, NULL, NULL},
+    {ROUTE_METHOD(HTTP_GET), "/ws", route_ws, NULL, NULL},
+    {ROUTE_METHOD(HTTP_GET), STATIC_ROUTE, route_static, NULL, "max-age=60"},
+    {ROUTE_METHOD(HTTP_GET), "/debug/arena", route_arena_stats, NULL, NULL},
+    {ROUTE_METHOD(HTTP_GET), "/metrics", route_metrics, NULL, NULL},
+};
+
+#define ROUTE_COUNT ((int)(sizeof(routes) / sizeof(routes[0])))
+#define ROUTE_UNMATCHED ROUTE_COUNT     // metrics label for 404s, 405s and bad requests
+
+// Metrics labels: the pattern, with the methods in front unless it is
+// GET only, so routes on one path for different methods stay apart
+static const char *route_names[ROUTE_COUNT + 1];
+static char route_labels[ROUTE_COUNT][64];
+
+static const char *route_label(int i) {
+    if (routes[i].methods == ROUTE_METHOD(HTTP_GET)) return routes[i].pattern;
+    char *label = route_labels[i];
+    size_t n = 0;
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+        if (!(routes[i].methods & ROUTE_METHOD(m))) continue;
+        n += (size_t)snprintf(label + n, sizeof(route_labels[i]) - n, "%s%s", n ? "|" : "", http_method_name(m));
+    }
+    snprintf(label + n, sizeof(route_labels[i]) - n, " %s", routes[i].pattern);
+    return label;
+}
+
+static int build_router(void) {
+    router = router_new();
+    if (!router) return -1;
+    for (int i = 0; i < ROUTE_COUNT; i++) {
+        if (router_add(router, routes[i].methods, routes[i].pattern, &routes[i]) < 0) {
+            fprintf(stderr, "Bad route: %s\n", routes[i].pattern);
+            return -1;
+        }
+        route_names[i] = route_label(i);
+    }
+    route_names[ROUTE_UNMATCHED] = "unmatched";
+    return router_compile(router);
+}
+
+// 405 with the Allow header listing the path's methods (RFC 9110 15.5.6)
+static void send_method_not_allowed(struct conn *c, unsigned allowed) {
+    char allow[128] = "Allow: ";
+    size_t n = strlen(allow);
+    for (int m = 0; m < HTTP_METHOD_COUNT; m++) {
+        if (!(allowed & ROUTE_METHOD(m))) continue;
+        n += (size_t)snprintf(allow + n, sizeof(allow) - n, "%s%s", n > 7 ? ", " : "", http_method_name(m));
+    }
+    snprintf(allow + n, sizeof(allow) - n, "\r\n");
+    send_response(c, "405 Method Not Allowed", "text/plain", allow, "Method Not Allowed\n");
+}
+
+// A client that sent "Expect: 100-continue" holds the body back until told
+// to go ahead (RFC 9110 10.1.1); one already sending it needs no answer
+static void send_continue(struct conn *c, const struct http_request *req) {
+    static const char line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if (req->version_minor < 1 || c->rlen > req->head_len) return;
+    const struct http_header *h = http_find_header(req, c->rbuf, "Expect");
+    if (h && h->value.len == 12 && strncasecmp(c->rbuf + h->value.off, "100-continue", 12) == 0) {
+        out_append(c, line, sizeof(line) - 1);
+    }
+}
+
+// Handles one parsed request whose head sits at the start of c->rbuf
+static void handle_client(struct conn *c, const struct http_request *req) {
+    c->requests++;
+
+    struct route_match m;
+    c->route = ROUTE_UNMATCHED;
+    enum route_status st = router_match(router, c->rbuf, req, &m);
+    const struct route *r = st == ROUTE_FOUND ? m.target : NULL;
+    int reads_body = r && r->body && http_has_body(req);
+    c->close_after = wants_close(c, req, reads_body);
+    switch (st) {
+    case ROUTE_FOUND:
+        c->route = (int)(r - routes);
+        if (reads_body) {
+            c->body_route = r;
+            http_body_init(&c->body, req);
+            send_continue(c, req);
+        }
+        r->handle(c, req, &m);
+        break;
+    case ROUTE_METHOD_NOT_ALLOWED:
+        c->close_after = 1;
+        send_method_not_allowed(c, m.allowed);
+        break;
+    case ROUTE_NOT_FOUND:
+        send_prebuilt(c, &resp_not_found, NULL);
+        break;
+    }
+}
+
+static void sse_unsubscribe(struct loop *lp, struct conn *c) {
+    if (c->sub_prev) c->sub_prev->sub_next = c->sub_next;
+    else if (lp->subs == c) lp->subs = c->sub_next;
+    else return;
+    if (c->sub_next) c->sub_next->sub_prev = c->sub_prev;
+    c->sub_prev = c->sub_next = NULL;
+    lp->nsubs--;
+}
+
+static void conn_free(struct conn *c) {
+    if (c->file_fd >= 0) close(c->file_fd);
+    free(c->parts);
+    for (int i = c->seg_head; i < c->nsegs; i++) seg_release(&c->segs[i]);
+    if (c->u.send_out != c->out) free(c->u.send_out);
+    free(c->out);
+    free(c->u.spill);
+    free(c);
+}
+
+// Closes the socket of a connection nothing is pending on any more and
+// frees it
+static void conn_reap(struct loop *lp, struct conn *c) {
+    if (!lp->uring || uring_close(lp->uring, c->fd) < 0) close(c->fd);
+    conn_free(c);
+}
+
+static void conn_close(struct loop *lp, struct conn *c) {
+    if (!lp->uring) epoll_ctl(lp->ep, EPOLL_CTL_DEL, c->fd, NULL);
+    if (c->sse || c->ws) sse_unsubscribe(lp, c);
+    if (c->ws) {
+        free(c->ws->msg);
+        free(c->ws);
+        c->ws = NULL;
+    }
+    arena_reset(&c->arena);
+    timer_del(&lp->timers, &c->timer);
+    if (c->wait == WAIT_WRITE) lp->writing--;
+    lp->nconns--;
+    metrics_connections(lp->metrics, -1);
+    if (!lp->uring || c->u.ops == 0) {
+        conn_reap(lp, c);
+        return;
+    }
+    // The ring cancels what is pending on the socket; the socket is closed
+    // and c freed once their completions are in. Until then the number is
+    // not reused, so a shutdown linked behind a send cannot land on the
+    // next connection.
+    if (uring_cancel_fd(lp->uring, c->fd) < 0) shutdown(c->fd, SHUT_RDWR);
+    c->closing = 1;
+    c->closing_prev = NULL;
+    c->closing_next = lp->closing;
+    if (lp->closing) lp->closing->closing_prev = c;
+    lp->closing = c;
+}
+
+// Accounts for a completed io_uring request on c. Returns 1 if that was
+// the last one of a closed connection, which is now freed.
+static int conn_op_done(struct loop *lp, struct conn *c) {
+    c->u.ops--;
+    if (!c->closing || c->u.ops > 0) return 0;
+    if (c->closing_prev) c->closing_prev->closing_next = c->closing_next;
+    else lp->closing = c->closing_next;
+    if (c->closing_next) c->closing_next->closing_prev = c->closing_prev;
+    conn_reap(lp, c);
+    return 1;
+}
+
+static int uring_arm_recv(struct loop *lp, struct conn *c) {
+    if (uring_recv(lp->uring, c->fd, UTAG(c, UOP_RECV)) < 0) return -1;
+    c->u.recv = 1;
+    c->u.ops++;
+    return 0;
+}
+
+// Under io_uring the receive is always armed and sends report back, so
+// there is no interest to change
+static int conn_want(struct loop *lp, struct conn *c, int events) {
+    if (lp->uring || c->events == events) return 0;
+    struct epoll_event ev = {.events = (uint32_t)events, .data.ptr = c};
+    if (epoll_ctl(lp->ep, EPOLL_CTL_MOD, c->fd, &ev) < 0) return -1;
+    c->events = events;
+    return 0;
+}
+
+// Drops the first n queued bytes, which have been sent
+static void out_sent(struct conn *c, size_t n) {
+    c->last_active = now_ms();
+    c->out_queued -= n;
+    while (n > 0) {
+        struct out_seg *s = &c->segs[c->seg_head];
+        size_t left = s->len - c->seg_sent;
+        if (n < left) {
+            c->seg_sent += n;
+            break;
+        }
+        n -= left;
+        seg_release(s);
+        c->seg_head++;
+        c->seg_sent = 0;
+    }
+}
+
+// The queued segments as an iovec array; returns its length
+static int out_iov(struct conn *c, struct iovec *iov) {
+    int n = 0;
+    for (int i = c->seg_head; i < c->nsegs; i++, n++) {
+        const struct out_seg *s = &c->segs[i];
+        size_t skip = i == c->seg_head ? c->seg_sent : 0;
+        iov[n].iov_base = (char *)(s->data ? s->data : c->out + s->off) + skip;
+        iov[n].iov_len = s->len - skip;
+    }
+    return n;
+}
+
+// sendfile() of the file body. Returns 1 when done, 0 if the socket would
+// block, -1 on error.
+static int conn_send_file(struct conn *c) {
+    while (c->file_fd >= 0) {
+        ssize_t w = sendfile(c->fd, c->file_fd, &c->file_off, (size_t)(c->file_end - c->file_off));
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        if (w == 0) return -1;  // file shrank underneath us
+        c->last_active = now_ms();
+        if (c->file_off < c->file_end) continue;
+        struct file_parts *p = c->parts;
+        char part[128];
+        if (p && p->next < p->n) {
+            // The next part's head goes out before its range
+            const struct byte_range *r = &p->r[p->next++];
+            size_t n = part_head_format(part, p, p->next - 1);
+            if (out_append(c, part, n) < 0) return -1;
+            p->pending -= n + (uint64_t)(r->last - r->first + 1);
+            c->file_off = r->first;
+            c->file_end = r->last + 1;
+            return 1;
+        }
+        if (p) {
+            if (out_append(c, part, parts_end_format(part, p)) < 0) return -1;
+            free(p);
+            c->parts = NULL;
+        }
+        close(c->file_fd);
+        c->file_fd = -1;
+    }
+    return 1;
+}
+
+// conn_flush() for the io_uring loop: queues one send of everything
+// pending, which reports back through uring_on_send(). A final response is
+// followed by the write-side shutdown in the same submission. Files still
+// go out with sendfile(), waiting on a poll when the socket is full.
+static int conn_flush_uring(struct loop *lp, struct conn *c) {
+    if (c->u.send_busy || c->u.poll_busy) return 0;
+    if (c->seg_head < c->nsegs) {
+        c->u.msg = (struct msghdr){.msg_iov = c->u.iov, .msg_iovlen = (size_t)out_iov(c, c->u.iov)};
+        int last = c->close_after && !c->body_route && c->file_fd < 0 && !c->sse && !c->u.shut;
+        int flags = MSG_NOSIGNAL | (c->file_fd >= 0 ? MSG_MORE : 0);
+        if (uring_sendmsg(lp->uring, c->fd, &c->u.msg, flags, UTAG(c, UOP_SEND), last ? UTAG(c, UOP_SHUT) : 0) < 0)
+            return -1;
+        c->u.send_busy = 1;
+        c->u.send_out = c->out;
+        c->u.shut |= last;
+        c->u.ops += 1 + last;
+        return 0;
+    }
+    c->nsegs = c->seg_head = 0;
+    c->out_len = 0;
+    int rc = conn_send_file(c);
+    // A multipart body queued the head of its next part
+    if (rc == 1 && c->seg_head < c->nsegs) return conn_flush_uring(lp, c);
+    if (rc == 0) {
+        if (uring_poll(lp->uring, c->fd, POLLOUT, 0, UTAG(c, UOP_POLL)) < 0) return -1;
+        c->u.poll_busy = 1;
+        c->u.ops++;
+    }
+    return rc;
+}
+
+// Write as much queued output as the socket takes. Returns 1 when the
+// queue is empty, 0 if the socket would block, -1 on error.
+static int conn_flush(struct loop *lp, struct conn *c) {
+    if (lp->uring) return conn_flush_uring(lp, c);
+    for (;;) {
+        while (c->seg_head < c->nsegs) {
+            struct iovec iov[OUT_SEGS];
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = (size_t)out_iov(c, iov)};
+            // MSG_MORE lets the header share a segment with the file that follows
+            int flags = MSG_NOSIGNAL | (c->file_fd >= 0 ? MSG_MORE : 0);
+            ssize_t w = sendmsg(c->fd, &msg, flags);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+                return -1;
+            }
+            out_sent(c, (size_t)w);
+        }
+        c->nsegs = c->seg_head = 0;
+        c->out_len = 0;
+        int rc = conn_send_file(c);
+        // A multipart body queued the head of its next part
+        if (rc != 1 || c->seg_head == c->nsegs) return rc;
+    }
+}
+
+// Queues the events in msgs that c has not had yet, referencing the shared
+// bytes. Returns -1 if that would leave more than SSE_QUEUE_MAX unsent even
+// after writing what the socket takes, or if the next event c needs has
+// already left the history: the subscriber is not keeping up and gets
+// dropped rather than buffered or handed a stream with a hole.
+static int sse_queue(struct loop *lp, struct conn *c, struct sse_msg **msgs, int n) {
+    for (int i = 0; i < n; i++) {
+        struct sse_msg *m = msgs[i];
+        if (m->id <= c->sse_last) continue;
+        if (m->id > c->sse_last + 1) return -1;
+        // WebSockets only get the events published with a frame
+        const char *data = c->ws ? m->data + m->ws_off : m->data;
+        size_t len = c->ws ? m->ws_len : m->len;
+        c->sse_last = m->id;
+        if (len == 0) continue;
+        if (c->out_queued + len > SSE_QUEUE_MAX && conn_flush(lp, c) < 0) return -1;
+        if (c->out_queued + len > SSE_QUEUE_MAX) return -1;
+        if (c->nsegs >= OUT_SEGS - 1 && c->seg_head > 0) {
+            // Reclaim the slots of segments already sent
+            memmove(c->segs, c->segs + c->seg_head, (size_t)(c->nsegs - c->seg_head) * sizeof(c->segs[0]));
+            c->nsegs -= c->seg_head;
+            c->seg_head = 0;
+        }
+        if (c->nsegs >= OUT_SEGS - 1) {
+            if (out_append(c, data, len) < 0) return -1;
+        } else {
+            sse_msg_get(m);
+            c->segs[c->nsegs++] = (struct out_seg){.data = data, .len = len, .msg = m};
+            c->out_queued += len;
+            c->out_total += len;
+        }
+    }
+    return 0;
+}
+
+static void sse_send(struct loop *lp, struct conn *c) {
+    int rc = conn_flush(lp, c);
+    if (rc < 0 || conn_want(lp, c, rc ? EPOLLIN | EPOLLRDHUP : EPOLLOUT) < 0) conn_close(lp, c);
+    else conn_timer(lp, c);
+}
+
+// Adds a connection that route_events() turned into a stream, with any
+// events it asked to have replayed. conn_process() sends what is queued.
+static void sse_subscribe(struct loop *lp, struct conn *c) {
+    // Otherwise the kernel would buffer megabytes for a stalled reader
+    // before the queue limit is ever reached
+    int sndbuf = SSE_SNDBUF;
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+    c->sub_prev = NULL;
+    c->sub_next = lp->subs;
+    if (lp->subs) lp->subs->sub_prev = c;
+    lp->subs = c;
+    lp->nsubs++;
+
+    struct sse_msg *msgs[SSE_HISTORY];
+    int n = sse_fetch(c->sse_last, msgs, SSE_HISTORY);
+    if (n > 0 && msgs[0]->id > c->sse_last + 1) {
+        // Part of what it asked to have replayed is gone. The stream ends
+        // instead; the id: line has the reconnect resume from the oldest
+        // event still kept.
+        char line[32];
+        out_append(c, line, (size_t)snprintf(line, sizeof(line), "id: %llu\n\n",
+                                             (unsigned long long)msgs[0]->id - 1));
+        c->close_after = 1;
+    } else if (sse_queue(lp, c, msgs, n) < 0) {
+        c->close_after = 1;
+    }
+    for (int i = 0; i < n; i++) sse_msg_put(msgs[i]);
+}
+
+// Runs when the bus signals sse_fd: fetches the new events once and queues
+// them on every subscriber of this worker, then tries to send right away.
+// If more were published since the last run than the history keeps, those
+// that left it are lost, and so are the subscribers that needed them.
+static void sse_deliver(struct loop *lp) {
+    uint64_t count;
+    if (read(lp->sse_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) return;
+    struct sse_msg *msgs[SSE_HISTORY];
+    int n = sse_fetch(lp->sse_seen, msgs, SSE_HISTORY);
+    if (n > 0) lp->sse_seen = msgs[n - 1]->id;
+    long long now = now_ms();
+    struct conn *next;
+    for (struct conn *c = n > 0 ? lp->subs : NULL; c; c = next) {
+        next = c->sub_next;
+        // Pings a WebSocket that has been quiet for a while, as a keep-alive
+        static const char ping[2] = {(char)(0x80 | WS_PING), 0};
+        if (c->ws && now - c->last_active >= WS_PING_MS) out_append(c, ping, sizeof(ping));
+        if (sse_queue(lp, c, msgs, n) < 0) {
+            lp->sse_dropped++;
+            conn_close(lp, c);
+        } else {
+            sse_send(lp, c);
+        }
+    }
+    for (int i = 0; i < n; i++) sse_msg_put(msgs[i]);
+}
+
+static int ws_send(struct conn *c, enum ws_opcode op, const char *payload, size_t len) {
+    char head[WS_FRAME_HEAD_MAX];
+    if (out_append(c, head, ws_frame_head_build(head, op, len)) < 0) return -1;
+    return out_append(c, payload, len);
+}
+
+// Starts the closing handshake with code; the connection closes once the
+// frame is sent
+static void ws_fail(struct conn *c, unsigned code) {
+    char payload[2] = {(char)(code >> 8), (char)code};
+    ws_send(c, WS_CLOSE, payload, sizeof(payload));
+    c->close_after = 1;
+}
+
+// A complete message: text goes to every chat client through the event bus
+// (and to /events as a "chat" event), binary is echoed to the sender. A
+// burst of chat would run the bus history past what this worker has
+// delivered, so the sender is held once it is WS_BURST_MAX ahead.
+static void ws_message(struct loop *lp, struct conn *c) {
+    struct ws_conn *w = c->ws;
+    if (w->msg_op == WS_BINARY) {
+        if (ws_send(c, WS_BINARY, w->msg ? w->msg : "", w->msg_len) < 0) c->close_after = 1;
+        return;
+    }
+    if (!ws_utf8_valid(w->msg, w->msg_len)) {
+        ws_fail(c, WS_CLOSE_INVALID_DATA);
+        return;
+    }
+    size_t n;
+    char *prefix = arena_printf(&c->arena, &n, "[Client %u]: ", w->id);
+    char *line = prefix ? arena_alloc(&c->arena, n + w->msg_len) : NULL;
+    if (!line) {
+        ws_fail(c, WS_CLOSE_GOING_AWAY);
+        return;
+    }
+    memcpy(line, prefix, n);
+    if (w->msg_len) memcpy(line + n, w->msg, w->msg_len);
+    // Every subscriber drops an event it cannot queue whole, so one too big
+    // for SSE_QUEUE_MAX fails its sender instead of reaching no one
+    if (sse_event_size("chat", line, n + w->msg_len, SSE_WS) > SSE_QUEUE_MAX) {
+        ws_fail(c, WS_CLOSE_TOO_BIG);
+        arena_reset(&c->arena);
+        return;
+    }
+    uint64_t id = sse_publish("chat", line, n + w->msg_len, SSE_WS);
+    if (id >= lp->sse_seen + WS_BURST_MAX) w->held = 1;
+    arena_reset(&c->arena);
+}
+
+static int ws_close_code_valid(unsigned code) {
+    return (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) || (code >= 3000 && code <= 4999);
+}
+
+// Control frames arrive whole and may come between the fragments of a message
+static void ws_control(struct conn *c, enum ws_opcode op, const char *payload, size_t len) {
+    switch (op) {
+    case WS_PING:
+        if (ws_send(c, WS_PONG, payload, len) < 0) c->close_after = 1;
+        break;
+    case WS_CLOSE:
+        if (len == 0) {
+            ws_send(c, WS_CLOSE, "", 0);
+            c->close_after = 1;
+        } else if (len == 1 || !ws_close_code_valid((unsigned char)payload[0] << 8 | (unsigned char)payload[1])) {
+            ws_fail(c, WS_CLOSE_PROTOCOL_ERROR);
+        } else if (!ws_utf8_valid(payload + 2, len - 2)) {
+            ws_fail(c, WS_CLOSE_INVALID_DATA);
+        } else {
+            // Echo the status code back, as RFC 6455 5.5.1 suggests
+            ws_send(c, WS_CLOSE, payload, 2);
+            c->close_after = 1;
+        }
+        break;
+    default:
+        break;  // unsolicited pongs are allowed and ignored
+    }
+}
 
-static volatile sig_atomic_t keep_running = 1;
+// Consumes the frames in rbuf. Data payloads are copied into the message as
+// they arrive and unmasked there, so a frame can be larger than rbuf.
+// Returns how many frames were completed.
+static int ws_process(struct loop *lp, struct conn *c) {
+    struct ws_conn *w = c->ws;
+    size_t pos = 0;
+    int frames = 0;
+    while (!c->close_after && !w->held && c->out_queued < OUT_HIGH_WATER) {
+        struct ws_frame_head *f = &w->frame;
+        if (!w->in_frame) {
+            int rc = ws_frame_head_parse(c->rbuf + pos, c->rlen - pos, f);
+            if (rc == 0) break;
+            // Clients must mask every frame (RFC 6455 5.1)
+            if (rc < 0 || !f->masked) {
+                ws_fail(c, WS_CLOSE_PROTOCOL_ERROR);
+                break;
+            }
+            if (f->opcode >= WS_CLOSE) {
+                if (c->rlen - pos < f->head_len + f->len) break;
+                char *payload = c->rbuf + pos + f->head_len;
+                scan.unmask(payload, (size_t)f->len, f->mask, 0);
+                ws_control(c, f->opcode, payload, (size_t)f->len);
+                pos += f->head_len + (size_t)f->len;
+                frames++;
+                continue;
+            }
+            // A continuation needs an open message, a new message none
+            if ((f->opcode == WS_CONTINUATION) != (w->msg_op != WS_CONTINUATION)) {
+                ws_fail(c, WS_CLOSE_PROTOCOL_ERROR);
+                break;
+            }
+            if (f->len > WS_MAX_MESSAGE - w->msg_len) {
+                ws_fail(c, WS_CLOSE_TOO_BIG);
+                break;
+            }
+            if (w->msg_len + f->len > w->msg_cap) {
+                size_t cap = w->msg_cap ? w->msg_cap : 256;
+                while (cap < w->msg_len + f->len) cap *= 2;
+                char *msg = realloc(w->msg, cap);
+                if (!msg) {
+                    ws_fail(c, WS_CLOSE_GOING_AWAY);
+                    break;
+                }
+                w->msg = msg;
+                w->msg_cap = cap;
+            }
+            if (f->opcode != WS_CONTINUATION) w->msg_op = f->opcode;
+            pos += f->head_len;
+            w->in_frame = 1;
+            w->frame_pos = 0;
+        }
 
-static void handle_sigint(int sig) {
-    (void)sig;
-    keep_running = 0;
+        size_t n = c->rlen - pos;
+        if (n > f->len - w->frame_pos) n = (size_t)(f->len - w->frame_pos);
+        if (n) {
+            char *dst = w->msg + w->msg_len;
+            memcpy(dst, c->rbuf + pos, n);
+            scan.unmask(dst, n, f->mask, (size_t)w->frame_pos);
+            w->msg_len += n;
+            w->frame_pos += n;
+            pos += n;
+        }
+        if (w->frame_pos < f->len) break;
+
+        w->in_frame = 0;
+        frames++;
+        if (f->fin) {
+            ws_message(lp, c);
+            w->msg_op = WS_CONTINUATION;
+            w->msg_len = 0;
+        }
+    }
+    memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+    c->rlen -= pos;
+    return frames;
 }
 
-static void url_decode(char *str) {
-    char *src = str, *dst = str;
-    while (*src) {
-        if (*src == '+') {
-            *dst++ = ' ';
-            src++;
-        } else if ((src[0] == '%') && src[1] && src[2]) {
-            char hex[3] = {src[1], src[2], '\0'};
-            *dst++ = (char)strtol(hex, NULL, 16);
-            src += 3;
-        } else {
-            *dst++ = *src++;
-        }
-    }
-    *dst = '\0';
-}
-
-static const char *html_page =
-    "<!doctype html>\n"
-    "<html lang=\"en\">\n"
-    "<head>\n"
-    "  <meta charset=\"utf-8\">\n"
-    "  <meta name=\"viewport\" content=\"width=device-width, initial-scale=1\">\n"
-    "  <title>C Web Server</title>\n"
-    "  <style>\n"
-    "    :root{--bg:#0f172a;--fg:#e2e8f0;--muted:#94a3b8;--accent:#22d3ee;--card:#111827;--ok:#10b981;}\n"
-    "    *{box-sizing:border-box}body{margin:0;background:var(--bg);color:var(--fg);font:16px/1.5 system-ui,Segoe UI,Roboto,Helvetica,Arial,sans-serif}\n"
-    "    .wrap{max-width:900px;margin:0 auto;padding:32px}\n"
-    "    header{display:flex;align-items:center;gap:12px;margin-bottom:20px}\n"
-    "    header h1{margin:0;font-size:22px}\n"
-    "    header .pill{padding:4px 8px;border-radius:999px;background:#0b1324;color:var(--muted);font-size:12px}\n"
-    "    .card{background:var(--card);border:1px solid #1f2937;border-radius:12px;padding:20px;margin:16px 0}\n"
-    "    .row{display:flex;gap:12px;flex-wrap:wrap}\n"
-    "    input[type=text]{flex:1;min-width:200px;background:#0b1324;border:1px solid #1f2937;border-radius:8px;color:var(--fg);padding:10px}\n"
-    "    button{background:var(--accent);color:#001018;border:0;border-radius:8px;padding:10px 14px;font-weight:600;cursor:pointer}\n"
-    "    button:hover{filter:brightness(1.05)}\n"
-    "    code{background:#0b1324;border:1px solid #1f2937;border-radius:6px;padding:2px 6px}\n"
-    "    .muted{color:var(--muted)}\n"
-    "    .ok{color:var(--ok)}\n"
-    "  </style>\n"
-    "</head>\n"
-    "<body>\n"
-    "  <div class=\"wrap\">\n"
-    "    <header>\n"
-    "      <h1>Minimal C Web Server</h1>\n"
-    "      <span class=\"pill\">single-file</span>\n"
-    "      <span class=\"pill\">port 8080</span>\n"
-    "    </header>\n"
-    "    <div class=\"card\">\n"
-    "      <p class=\"muted\">This server is a tiny C program with an embedded UI. Try actions below.</p>\n"
-    "      <div class=\"row\">\n"
-    "        <input id=\"msg\" type=\"text\" placeholder=\"Type a message...\">\n"
-    "        <button onclick=\"echoMsg()\">Echo</button>\n"
-    "        <button onclick=\"getTime()\">Get Server Time</button>\n"
-    "      </div>\n"
-    "      <p id=\"out\" class=\"muted\" style=\"margin-top:12px\">Ready.</p>\n"
-    "    </div>\n"
-    "    <div class=\"card\">\n"
-    "      <b>Endpoints</b>\n"
-    "      <ul>\n"
-    "        <li><code>GET /</code>: UI</li>\n"
-    "        <li><code>GET /echo?msg=...</code>: returns your message</li>\n"
-    "        <li><code>GET /time</code>: returns ISO time</li>\n"
-    "      </ul>\n"
-    "    </div>\n"
-    "  </div>\n"
-    "  <script>\n"
-    "  async function echoMsg(){\n"
-    "    const v=document.getElementById('msg').value;\n"
-    "    const r=await fetch('/echo?msg='+encodeURIComponent(v));\n"
-    "    const t=await r.text();\n"
-    "    document.getElementById('out').textContent=t;\n"
-    "  }\n"
-    "  async function getTime(){\n"
-    "    const r=await fetch('/time');\n"
-    "    const t=await r.text();\n"
-    "    document.getElementById('out').textContent='Server time: '+t;\n"
-    "  }\n"
-    "  </script>\n"
-    "</body>\n"
-    "</html>\n";
-
-static void send_response(int client_fd, const char *status, const char *content_type, const char *body) {
-    char header[512];
-    size_t body_len = body ? strlen(body) : 0;
-    int n = snprintf(header, sizeof(header),
-                     "HTTP/1.1 %s\r\n"
-                     "Server: c-min-web/1.0\r\n"
-                     "Connection: close\r\n"
-                     "Content-Type: %s; charset=utf-8\r\n"
-                     "Content-Length: %zu\r\n\r\n",
-                     status, content_type, body_len);
-    if (n < 0) return;
-    send(client_fd, header, (size_t)n, 0);
-    if (body_len) {
-        send(client_fd, body, body_len, 0);
+// Shut down the write side and discard input until the peer closes, so
+// unread pipelined requests do not turn into a reset that destroys the
+// final response in flight.
+static void conn_linger(struct loop *lp, struct conn *c) {
+    c->lingering = 1;
+    if (!lp->uring) {
+        shutdown(c->fd, SHUT_WR);
+        if (conn_want(lp, c, EPOLLIN | EPOLLRDHUP) < 0) {
+            conn_close(lp, c);
+            return;
+        }
+    } else {
+        if (c->u.eof || (!c->u.shut && uring_shutdown(lp->uring, c->fd, UTAG(c, UOP_SHUT)) < 0)) {
+            conn_close(lp, c);
+            return;
+        }
+        if (!c->u.shut) c->u.ops++;
+        c->u.shut = 1;
+        if (c->u.recv == 0 && uring_arm_recv(lp, c) < 0) {
+            conn_close(lp, c);
+            return;
+        }
     }
+    conn_timer(lp, c);
 }
 
-static void handle_client(int client_fd) {
-    char buf[RECV_BUF];
-    ssize_t r = recv(client_fd, buf, sizeof(buf) - 1, 0);
-    if (r <= 0) {
-        return;
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Fills an access log record for the request just handled; req is NULL
+// when it could not be parsed
+static void log_request(struct loop *lp, const struct conn *c, const struct http_request *req, uint64_t bytes,
+                        uint64_t duration_ns) {
+    struct access_record *r = access_ring_reserve(lp->log);
+    if (!r) return;
+    r->time = time(NULL);
+    r->addr = c->peer_addr;
+    r->status = (uint16_t)c->status;
+    r->bytes = bytes;
+    r->duration_us = (uint32_t)(duration_ns / 1000);
+    if (req) {
+        // Once its body has been read the request's head is in a copy
+        const char *buf = c->head ? c->head : c->rbuf;
+        size_t mlen = req->method.len < sizeof(r->method) - 1 ? req->method.len : sizeof(r->method) - 1;
+        size_t tlen = req->target.len < ACCESS_TARGET_MAX - 1 ? req->target.len : ACCESS_TARGET_MAX - 1;
+        memcpy(r->method, buf + req->method.off, mlen);
+        r->method[mlen] = '\0';
+        memcpy(r->target, buf + req->target.off, tlen);
+        r->target_len = (uint8_t)tlen;
+        r->version_minor = (uint8_t)req->version_minor;
+    } else {
+        strcpy(r->method, "-");
+        r->target[0] = '-';
+        r->target_len = 1;
+        r->version_minor = 1;
     }
-    buf[r] = '\0';
+    access_ring_commit(lp->log);
+}
 
-    // Parse request line
-    char method[8] = {0};
-    char path[1024] = {0};
-    if (sscanf(buf, "%7s %1023s", method, path) != 2) {
-        send_response(client_fd, "400 Bad Request", "text/plain", "Bad Request\n");
-        return;
+// Accounts for the request just handled. bytes counts what the response
+// queued since mark (c->out_total), including a file still to be sent.
+static void request_done(struct loop *lp, struct conn *c, const struct http_request *req, uint64_t mark,
+                         long long start_ns) {
+    uint64_t bytes = c->out_total - mark;
+    if (c->file_fd >= 0) bytes += (uint64_t)(c->file_end - c->file_off);
+    if (c->parts) bytes += c->parts->pending;
+    uint64_t duration = (uint64_t)(now_ns() - start_ns);
+    metrics_record(lp->metrics, req ? c->route : ROUTE_UNMATCHED, c->status, bytes, duration);
+    if (lp->log) log_request(lp, c, req, bytes, duration);
+}
+
+// Whether a request about to be handled at now (ns) should get a 503
+// instead: too many responses are already being sent, or it has waited
+// longer than the admission control allows
+static int shed_request(struct loop *lp, long long now, long long arrived) {
+    long long delay = now > arrived ? now - arrived : 0;
+    int late = lp->adm.target_ns && admission_check(&lp->adm, (uint64_t)now, (uint64_t)delay);
+    if (lp->max_writing && lp->writing >= lp->max_writing) {
+        metrics_shed(lp->metrics, METRICS_SHED_INFLIGHT);
+        return 1;
+    }
+    if (late) metrics_shed(lp->metrics, METRICS_SHED_DELAY);
+    return late;
+}
+
+// A shed request leaves the connection open as the request would have;
+// with req NULL the connection itself is turned away
+static void send_unavailable(struct conn *c, const struct http_request *req) {
+    if (req) c->requests++;
+    c->close_after = req ? wants_close(c, req, 0) : 1;
+    c->route = ROUTE_UNMATCHED;
+    send_prebuilt(c, &resp_unavailable, NULL);
+}
+
+// Moves bytes that arrived while rbuf was full into the room now free, and
+// resumes receiving once they all fit (io_uring)
+static void conn_refill(struct loop *lp, struct conn *c) {
+    size_t n = sizeof(c->rbuf) - c->rlen;
+    if (n > c->u.spill_len) n = c->u.spill_len;
+    memcpy(c->rbuf + c->rlen, c->u.spill, n);
+    c->rlen += n;
+    c->u.spill_len -= n;
+    memmove(c->u.spill, c->u.spill + n, c->u.spill_len);
+    if (c->u.spill_len == 0 && c->u.recv == 0 && !c->u.eof && uring_arm_recv(lp, c) < 0) c->close_after = 1;
+}
+
+// Hands the body bytes in rbuf to the route reading them, while what it
+// writes back fits under OUT_HIGH_WATER; the output buffer is emptied
+// before more is taken, which bounds it. Returns 1 once the body is
+// complete, 0 when more input or room is needed, -1 on bad framing.
+static int conn_body(struct loop *lp, struct conn *c) {
+    enum http_body_status st = HTTP_BODY_PARTIAL;
+    size_t pos = 0;
+    while (c->out_len < OUT_HIGH_WATER) {
+        const char *data;
+        size_t len, used;
+        st = http_body_decode(&c->body, c->rbuf + pos, c->rlen - pos, &used, &data, &len);
+        pos += used;
+        if (st != HTTP_BODY_DATA) break;
+        c->body_route->body(c, data, len);
+        if (!c->body_route) return -1;  // turned down
+        st = HTTP_BODY_PARTIAL;
+    }
+    memmove(c->rbuf, c->rbuf + pos, c->rlen - pos);
+    c->rlen -= pos;
+    if (pos) c->last_active = now_ms();
+    if (st == HTTP_BODY_ERROR) return -1;
+    if (st != HTTP_BODY_DONE) return 0;
+    c->body_route->body(c, NULL, 0);
+    request_done(lp, c, &c->req, c->req_mark, c->req_start);
+    c->body_route = NULL;
+    c->head = NULL;
+    arena_reset(&c->arena);
+    http_request_init(&c->req);
+    return 1;
+}
+
+// Parses and handles every complete request in rbuf in order, then sends
+// what was produced. The parser resumes where it stopped on the previous
+// read. Reading pauses while responses are backed up. A request body is
+// streamed to its route from rbuf before the next request is parsed.
+static void conn_process(struct loop *lp, struct conn *c, int peer_closed) {
+    int handled, blocked;
+again:
+    handled = 0;
+    // Output in the way of the next request; once it drains, that request
+    // is handled without waiting for more input
+    blocked = c->file_fd >= 0 || c->out_queued >= OUT_HIGH_WATER ||
+              (c->body_route && c->out_len >= OUT_HIGH_WATER);
+    // Input left waiting meanwhile, read or not, was not waiting on the
+    // worker; the admission control dates it from here
+    if (blocked) c->unblocked = lp->pass_start;
+    if (c->u.spill_len) conn_refill(lp, c);
+    while ((!c->close_after || c->body_route) && !c->sse && !c->ws && c->file_fd < 0 &&
+           c->out_queued < OUT_HIGH_WATER && (c->rlen > 0 || c->body_route)) {
+        if (c->body_route) {
+            size_t rlen = c->rlen;
+            int rc = conn_body(lp, c);
+            if (c->rlen != rlen || rc) handled++;
+            if (c->u.spill_len) conn_refill(lp, c);
+            if (rc < 0) {
+                // Unless the route still holds its head back, it is too
+                // late for a 400: the response is under way
+                c->body_route = NULL;
+                c->close_after = 1;
+                if (!c->status) {
+                    send_prebuilt(c, &resp_bad_request, NULL);
+                    request_done(lp, c, &c->req, c->req_mark, c->req_start);
+                }
+            }
+            if (rc <= 0) break;
+            continue;
+        }
+        long long start = now_ns();
+        uint64_t queued = c->out_total;
+        enum http_parse_status st = http_parse_request(&c->req, c->rbuf, c->rlen);
+        if (st == HTTP_PARSE_PARTIAL) {
+            if (c->rlen == sizeof(c->rbuf)) {
+                c->close_after = 1;
+                send_prebuilt(c, &resp_header_too_large, NULL);
+                request_done(lp, c, NULL, queued, start);
+            }
+            break;
+        }
+        if (st == HTTP_PARSE_ERROR) {
+            c->close_after = 1;
+            send_parse_error(c, c->req.error);
+            request_done(lp, c, NULL, queued, start);
+            break;
+        }
+        c->head_only = http_method_parse(c->rbuf + c->req.method.off, c->req.method.len) == HTTP_HEAD;
+        if (shed_request(lp, start, c->arrived > c->unblocked ? c->arrived : c->unblocked)) {
+            send_unavailable(c, &c->req);
+        } else {
+            handle_client(c, &c->req);
+        }
+        size_t head = c->req.head_len;
+        if (c->body_route) {
+            // The body takes the head's place in rbuf; the request is
+            // accounted for once it has been read
+            c->head = arena_alloc(&c->arena, head);
+            if (c->head) {
+                memcpy(c->head, c->rbuf, head);
+            } else {
+                c->body_route = NULL;
+                c->close_after = 1;
+            }
+            c->req_start = start;
+            c->req_mark = queued;
+        }
+        if (!c->body_route) {
+            request_done(lp, c, &c->req, queued, start);
+            arena_reset(&c->arena);
+        }
+        if (c->sse || c->ws) sse_subscribe(lp, c);
+        handled++;
+        memmove(c->rbuf, c->rbuf + head, c->rlen - head);
+        c->rlen -= head;
+        if (!c->body_route) {
+            http_request_init(&c->req);
+            c->head_only = 0;
+        }
+        if (c->wait == WAIT_HEADER) c->wait = WAIT_NONE;    // the next head gets a deadline of its own
+        if (c->u.spill_len) conn_refill(lp, c);
+    }
+    if (c->ws && c->rlen > 0) {
+        handled += ws_process(lp, c);
+        if (c->u.spill_len) conn_refill(lp, c);
+    }
+    // A request cut short by EOF is dropped
+    if (peer_closed) {
+        c->close_after = 1;
+        c->body_route = NULL;
     }
 
-    // Only handle GET
-    if (strcmp(method, "GET") != 0) {
-        send_response(client_fd, "405 Method Not Allowed", "text/plain", "Only GET supported\n");
+    int rc = conn_flush(lp, c);
+    if (rc > 0 && (handled || blocked) && (!c->close_after || c->body_route) && (c->rlen > 0 || c->body_route)) {
+        // Output drained at once; carry on with the next pipelined request
+        goto again;
+    }
+    if (rc > 0 && c->close_after && !c->body_route) {
+        conn_linger(lp, c);
+        return;
+    }
+    if (rc < 0 || conn_want(lp, c, rc ? EPOLLIN | EPOLLRDHUP : EPOLLOUT) < 0) {
+        conn_close(lp, c);
         return;
     }
+    conn_timer(lp, c);
+}
+
+// After sse_deliver(): the WebSockets held for it read on
+static void ws_release(struct loop *lp) {
+    struct conn *next;
+    for (struct conn *c = lp->subs; c; c = next) {
+        next = c->sub_next;
+        if (c->ws && c->ws->held) {
+            c->ws->held = 0;
+            conn_process(lp, c, 0);
+        }
+    }
+}
+
+static void on_writable(struct loop *lp, struct conn *c) {
+    // Once drained, carry on with any pipelined requests already buffered
+    conn_process(lp, c, 0);
+}
 
-    // Route handling
-    if (strcmp(path, "/") == 0) {
-        send_response(client_fd, "200 OK", "text/html", html_page);
+// Acts on what the reads just took in
+static void conn_input(struct loop *lp, struct conn *c, int peer_closed) {
+    // Subscribers have nothing more to say; only their EOF matters
+    if (c->lingering || c->sse) {
+        if (peer_closed) conn_close(lp, c);
+        else conn_timer(lp, c);
         return;
     }
+    if (peer_closed && c->rlen == 0) {
+        conn_close(lp, c);
+        return;
+    }
+    conn_process(lp, c, peer_closed);
+}
 
-    if (strncmp(path, "/echo", 5) == 0) {
-        // Find query param msg
-        const char *q = strchr(path, '?');
-        char msg[1024] = {0};
-        if (q) {
-            // naive parsing for msg=...
-            const char *p = strstr(q + 1, "msg=");
-            if (p) {
-                p += 4;
-                size_t i = 0;
-                while (*p && *p != '&' && i < sizeof(msg) - 1) {
-                    msg[i++] = *p++;
-                }
-                msg[i] = '\0';
-                url_decode(msg);
-            }
+static void on_readable(struct loop *lp, struct conn *c) {
+    char discard[4096];
+    int peer_closed = 0;
+    c->arrived = lp->ready_since;
+    for (;;) {
+        int discarding = c->lingering || c->sse;
+        char *dst = discarding ? discard : c->rbuf + c->rlen;
+        size_t room = discarding ? sizeof(discard) : sizeof(c->rbuf) - c->rlen;
+        if (room == 0) break;
+        struct iovec iov = {.iov_base = dst, .iov_len = room};
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+        } ctl;
+        struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1};
+        if (lp->stamped) {
+            msg.msg_control = &ctl;
+            msg.msg_controllen = sizeof(ctl);
+        }
+        ssize_t r = recvmsg(c->fd, &msg, 0);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            conn_close(lp, c);
+            return;
+        }
+        if (r == 0) {
+            peer_closed = 1;
+            break;
+        }
+        c->last_active = now_ms();
+        if (!discarding) c->rlen += (size_t)r;
+        struct cmsghdr *cm = lp->stamped ? CMSG_FIRSTHDR(&msg) : NULL;
+        if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            c->arrived = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec - lp->realtime_offset;
         }
-        if (msg[0] == '\0') {
-            strcpy(msg, "(empty)");
+    }
+    conn_input(lp, c, peer_closed);
+}
+
+// Sets up a connection for an accepted socket and starts watching it
+static void conn_new(struct loop *lp, int fd, uint32_t peer_addr) {
+    struct conn *c = calloc(1, sizeof(*c));
+    if (!c) {
+        close(fd);
+        return;
+    }
+    c->fd = fd;
+    c->peer_addr = peer_addr;
+    c->file_fd = -1;
+    c->wait = WAIT_NONE;
+    http_request_init(&c->req);
+    arena_init(&c->arena, &lp->pool);
+    if (lp->uring) {
+        if (uring_arm_recv(lp, c) < 0) {
+            close(fd);
+            free(c);
+            return;
+        }
+    } else {
+        c->events = EPOLLIN | EPOLLRDHUP;
+        struct epoll_event ev = {.events = (uint32_t)c->events, .data.ptr = c};
+        if (epoll_ctl(lp->ep, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("epoll_ctl");
+            close(fd);
+            free(c);
+            return;
+        }
+    }
+    c->last_active = now_ms();
+    c->arrived = lp->ready_since;
+    conn_timer(lp, c);
+    lp->nconns++;
+    metrics_connections(lp->metrics, 1);
+    if (lp->max_conns && lp->nconns > lp->max_conns) {
+        // Over the limit: answered at once and closed, before any request
+        metrics_shed(lp->metrics, METRICS_SHED_CONNECTIONS);
+        send_unavailable(c, NULL);
+        request_done(lp, c, NULL, c->out_total - c->out_queued, now_ns());
+        conn_process(lp, c, 0);
+    }
+}
+
+static void on_accept(struct loop *lp, struct listener *l) {
+    // Bounded so that new connections cannot crowd out the ready ones:
+    // those turned away at the limit need a pass to see their EOF
+    for (int i = 0; i < ACCEPT_BATCH; i++) {
+        struct sockaddr_in cli;
+        socklen_t clilen = sizeof(cli);
+        int client_fd = accept4(l->fd, (struct sockaddr*)&cli, &clilen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
         }
-        send_response(client_fd, "200 OK", "text/plain", msg);
+        conn_new(lp, client_fd, cli.sin_addr.s_addr);
+    }
+}
+
+// Takes n received bytes into rbuf; what does not fit waits in the spill
+// buffer until requests make room. Past RECV_SPILL_MAX the receive is
+// cancelled, which is the io_uring loop's way of no longer reading.
+static int conn_take(struct loop *lp, struct conn *c, const char *data, size_t n) {
+    c->last_active = now_ms();
+    c->arrived = lp->ready_since;
+    if (c->lingering || c->sse) return 0;
+    size_t room = sizeof(c->rbuf) - c->rlen;
+    if (c->u.spill_len == 0) {
+        size_t k = n < room ? n : room;
+        memcpy(c->rbuf + c->rlen, data, k);
+        c->rlen += k;
+        data += k;
+        n -= k;
+    }
+    if (n == 0) return 0;
+    if (c->u.spill_len + n > c->u.spill_cap) {
+        size_t cap = c->u.spill_cap ? c->u.spill_cap : URING_BUF_SIZE;
+        while (cap < c->u.spill_len + n) cap *= 2;
+        char *p = realloc(c->u.spill, cap);
+        if (!p) return -1;
+        c->u.spill = p;
+        c->u.spill_cap = cap;
+    }
+    memcpy(c->u.spill + c->u.spill_len, data, n);
+    c->u.spill_len += n;
+    if (c->u.spill_len > RECV_SPILL_MAX && c->u.recv == 1) {
+        if (uring_cancel(lp->uring, UTAG(c, UOP_RECV)) < 0) return -1;
+        c->u.recv = 2;
+    }
+    return 0;
+}
+
+static void uring_on_recv(struct loop *lp, struct conn *c, const struct uring_event *ev) {
+    int res = ev->res;
+    if (ev->flags & URING_F_BUFFER) {
+        if (!c->closing && conn_take(lp, c, uring_buf(lp->uring, ev->buf), (size_t)res) < 0) res = -ENOMEM;
+        uring_buf_put(lp->uring, ev->buf);
+    }
+    if (!(ev->flags & URING_F_MORE)) {
+        c->u.recv = 0;
+        if (conn_op_done(lp, c)) return;
+    }
+    if (c->closing) return;
+    if (res < 0 && res != -ENOBUFS && res != -ECANCELED) {
+        conn_close(lp, c);
         return;
     }
+    if (res == 0) c->u.eof = 1;
+    c->u.ops++;     // holds c while the requests are handled
+    if (res >= 0) conn_input(lp, c, res == 0);
+    // A receive stopped for want of buffers, or by a cancel that is no
+    // longer needed, starts over; one paused on a full spill waits for
+    // conn_refill()
+    if (!c->closing && c->u.recv == 0 && !c->u.eof && (c->lingering || c->sse || c->u.spill_len == 0) &&
+        uring_arm_recv(lp, c) < 0) {
+        conn_close(lp, c);
+    }
+    conn_op_done(lp, c);
+}
 
-    if (strcmp(path, "/time") == 0) {
-        char iso[64];
-        time_t now = time(NULL);
-        struct tm t;
-        gmtime_r(&now, &t);
-        strftime(iso, sizeof(iso), "%Y-%m-%dT%H:%M:%SZ", &t);
-        send_response(client_fd, "200 OK", "text/plain", iso);
+static void uring_on_send(struct loop *lp, struct conn *c, const struct uring_event *ev) {
+    c->u.send_busy = 0;
+    if (c->u.send_out != c->out) free(c->u.send_out);
+    c->u.send_out = NULL;
+    if (conn_op_done(lp, c) || c->closing) return;
+    if (ev->res < 0) {
+        conn_close(lp, c);
         return;
     }
+    out_sent(c, (size_t)ev->res);
+    on_writable(lp, c);
+}
+
+static void uring_on_poll(struct loop *lp, struct conn *c, const struct uring_event *ev) {
+    c->u.poll_busy = 0;
+    if (conn_op_done(lp, c) || c->closing) return;
+    if (ev->res < 0 || (ev->res & (POLLERR | POLLHUP))) conn_close(lp, c);
+    else on_writable(lp, c);
+}
+
+static struct conn *conn_of_timer(struct timer *t) {
+    return (struct conn *)((char *)t - offsetof(struct conn, timer));
+}
 
-    send_response(client_fd, "404 Not Found", "text/plain", "Not Found\n");
+static void on_timeout(struct timer *t, void *arg) {
+    struct conn *c = conn_of_timer(t);
+    struct loop *lp = arg;
+    metrics_timeout(lp->metrics, (enum metrics_timeout)c->wait);
+    conn_close(lp, c);
 }
 
-int main(void) {
-    signal(SIGINT, handle_sigint);
-    signal(SIGTERM, handle_sigint);
+// Closes the connections whose timeout has passed and returns how long the
+// loop may sleep before the next one is due
+static int run_timers(struct loop *lp) {
+    long long now = now_ms();
+    timer_wheel_advance(&lp->timers, (uint64_t)now, on_timeout, lp);
+    int64_t next = timer_wheel_next(&lp->timers);
+    if (next < 0) return -1;
+    return next > now ? (int)(next - now) : 0;
+}
+
+static void close_all(struct loop *lp) {
+    struct timer *t;
+    while ((t = timer_wheel_any(&lp->timers))) conn_close(lp, conn_of_timer(t));
+}
+
+// Server-wide settings, filled from the command line before workers start
+struct config {
+    const char *bind_ip;
+    const char *docroot;
+    int port;
+    int workers;
+    int backlog;
+    int pin;                // pin workers to CPUs
+    int ncpus;              // explicit CPU list length (0: worker i -> CPU i)
+    int cpus[CPU_SETSIZE];
+    const char *log_path;   // access log, NULL for none
+    enum access_format log_format;
+    int log_flush_ms;
+    uint64_t log_rotate_bytes;
+    int uring;              // run the workers on io_uring
+    unsigned max_conns;     // open connections, 0 for no limit
+    unsigned max_inflight;  // responses being sent, 0 for no limit
+    int shed_target_ms;     // admission control target, 0 to turn it off
+    size_t file_cache_bytes;
+    int drain_ms;           // how long a replaced server keeps its connections
+};
+
+static struct config cfg = {
+    .bind_ip = "192.168.1.20",
+    .port = SERVER_PORT,
+    .workers = 1,
+    .backlog = BACKLOG,
+    .log_flush_ms = 1000,
+    .shed_target_ms = SHED_TARGET_MS,
+    .file_cache_bytes = FILE_CACHE_BYTES,
+    .drain_ms = DRAIN_TIMEOUT_MS,
+};
+
+// Written once on shutdown; level-triggered, so every worker's epoll sees it
+static int stop_fd = -1;
+// Written once a successor is ready, the same way
+static int drain_fd = -1;
+// Workers still closing their connections
+static atomic_int drain_pending;
+// Listeners taken over from the previous server, by worker
+static int inherited_fds[HANDOFF_FDS_MAX];
+static int ninherited;
+
+struct worker {
+    pthread_t tid;
+    int id;
+    struct loop lp;
+};
+
+// The listeners passed to a successor on SIGUSR2, one per worker
+static struct worker *workers;
+static int started;
 
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
+// Each worker binds its own SO_REUSEPORT listener so the kernel spreads
+// incoming connections across them without a shared accept queue.
+static int open_listener(void) {
+    int server_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (server_fd < 0) {
         perror("socket");
-        return 1;
+        return -1;
     }
 
     int yes = 1;
@@ -201,48 +3062,735 @@ int main(void) {
         perror("setsockopt");
         // continue anyway
     }
+    if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+        perror("setsockopt SO_REUSEPORT");
+        close(server_fd);
+        return -1;
+    }
 
     struct sockaddr_in addr;
     memset(&addr, 0, sizeof(addr));
     addr.sin_family = AF_INET;
-    const char *bind_ip = "192.168.1.20";
-    if (inet_pton(AF_INET, bind_ip, &addr.sin_addr) != 1) {
-        fprintf(stderr, "Invalid bind IP: %s\n", bind_ip);
+    if (inet_pton(AF_INET, cfg.bind_ip, &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid bind IP: %s\n", cfg.bind_ip);
         close(server_fd);
-        return 1;
+        return -1;
     }
-    addr.sin_port = htons(SERVER_PORT);
+    addr.sin_port = htons(cfg.port);
 
     if (bind(server_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         perror("bind");
         close(server_fd);
-        return 1;
+        return -1;
     }
 
-    if (listen(server_fd, BACKLOG) < 0) {
+    if (listen(server_fd, cfg.backlog) < 0) {
         perror("listen");
         close(server_fd);
-        return 1;
+        return -1;
+    }
+    return server_fd;
+}
+
+// Takes worker id's listener, inherited or new, and every inherited one
+// past the last worker that falls to it round-robin
+static int listeners_open(struct loop *lp, int id) {
+    int n = 1;
+    for (int i = cfg.workers + id; i < ninherited; i += cfg.workers) n++;
+    lp->listeners = calloc((size_t)n, sizeof(*lp->listeners));
+    if (!lp->listeners) {
+        perror("calloc");
+        return -1;
+    }
+    lp->listeners[0].fd = id < ninherited ? inherited_fds[id] : open_listener();
+    if (lp->listeners[0].fd < 0) {
+        free(lp->listeners);
+        return -1;
+    }
+    lp->nlisteners = lp->listening = n;
+    for (int i = cfg.workers + id, k = 1; i < ninherited; i += cfg.workers) lp->listeners[k++].fd = inherited_fds[i];
+    return 0;
+}
+
+static void listeners_close(struct loop *lp) {
+    for (int i = 0; i < lp->nlisteners; i++) {
+        if (lp->listeners[i].fd >= 0) close(lp->listeners[i].fd);
+    }
+    free(lp->listeners);
+    lp->listeners = NULL;
+    lp->nlisteners = lp->listening = 0;
+}
+
+// The listener an epoll tag stands for, or NULL
+static struct listener *listener_of(struct loop *lp, void *tag) {
+    for (int i = 0; i < lp->nlisteners; i++) {
+        if (tag == &lp->listeners[i]) return &lp->listeners[i];
+    }
+    return NULL;
+}
+
+static int worker_init(struct worker *w) {
+    arena_pool_init(&w->lp.pool, ARENA_CHUNK, ARENA_POOL_CHUNKS);
+    if (listeners_open(&w->lp, w->id) < 0) return -1;
+    w->lp.ep = epoll_create1(EPOLL_CLOEXEC);
+    if (w->lp.ep < 0) {
+        perror("epoll_create1");
+        listeners_close(&w->lp);
+        return -1;
+    }
+    w->lp.sse_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (w->lp.sse_fd < 0) {
+        perror("eventfd");
+        close(w->lp.ep);
+        listeners_close(&w->lp);
+        return -1;
+    }
+    timer_wheel_init(&w->lp.timers, (uint64_t)now_ms());
+    // Limits are split evenly, each worker keeping at least one
+    unsigned n = (unsigned)cfg.workers;
+    if (cfg.max_conns) w->lp.max_conns = cfg.max_conns > n ? cfg.max_conns / n : 1;
+    if (cfg.max_inflight) w->lp.max_writing = cfg.max_inflight > n ? cfg.max_inflight / n : 1;
+    admission_init(&w->lp.adm, (uint64_t)cfg.shed_target_ms * 1000000, (uint64_t)SHED_INTERVAL_MS * 1000000);
+    w->lp.pass_start = w->lp.ready_since = now_ns();
+    w->lp.sse_seen = sse_last_id();
+    w->lp.log = access_log_ring(w->id);
+    w->lp.metrics = metrics_shard(w->id);
+    // Listeners are tagged with their struct listener, the stop eventfd
+    // with the loop itself, the drain eventfd with &draining and the event
+    // bus with &sse_fd; clients carry their struct conn
+    int added = 0;
+    for (; added < w->lp.nlisteners; added++) {
+        struct epoll_event lev = {.events = EPOLLIN, .data.ptr = &w->lp.listeners[added]};
+        if (epoll_ctl(w->lp.ep, EPOLL_CTL_ADD, w->lp.listeners[added].fd, &lev) < 0) break;
+    }
+    struct epoll_event sev = {.events = EPOLLIN, .data.ptr = &w->lp};
+    struct epoll_event dev = {.events = EPOLLIN, .data.ptr = &w->lp.draining};
+    struct epoll_event bev = {.events = EPOLLIN, .data.ptr = &w->lp.sse_fd};
+    if (added < w->lp.nlisteners || epoll_ctl(w->lp.ep, EPOLL_CTL_ADD, stop_fd, &sev) < 0 ||
+        epoll_ctl(w->lp.ep, EPOLL_CTL_ADD, drain_fd, &dev) < 0 ||
+        epoll_ctl(w->lp.ep, EPOLL_CTL_ADD, w->lp.sse_fd, &bev) < 0 || sse_watch(w->lp.sse_fd) < 0) {
+        perror("epoll_ctl");
+        close(w->lp.sse_fd);
+        close(w->lp.ep);
+        listeners_close(&w->lp);
+        return -1;
+    }
+    return 0;
+}
+
+static void pin_worker(struct worker *w) {
+    int cpu = cfg.ncpus ? cfg.cpus[w->id % cfg.ncpus] : w->id % (int)sysconf(_SC_NPROCESSORS_ONLN);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (err) fprintf(stderr, "worker %d: cannot pin to CPU %d: %s\n", w->id, cpu, strerror(err));
+}
+
+// Dates the work of a new pass for the admission control. A wait that
+// returned at once found it ready already, so it may have arrived as early
+// as the start of the previous pass; one that blocked saw it arrive. This
+// is all the io_uring loop goes by, as it takes every completion each
+// pass. The epoll loop takes at most MAX_EVENTS and the rest stay queued
+// in the kernel for passes to come, so it reads the kernel's timestamp of
+// each arrival instead, falling back to this.
+static void loop_woke(struct loop *lp, long long wait_start) {
+    long long now = now_ns();
+    lp->ready_since = now - wait_start < WAIT_BLOCKED_NS ? lp->pass_start : now;
+    lp->pass_start = now;
+    if (lp->stamped) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        lp->realtime_offset = (long long)ts.tv_sec * 1000000000 + ts.tv_nsec - now_ns();
+    }
+}
+
+// The successor accepts from the same sockets now. Stops accepting, has the
+// event streams and WebSockets reconnect, and lets the rest finish: a
+// request in progress gets its response with "Connection: close", an idle
+// keep-alive connection runs out its timer. On io_uring a listener is
+// closed once its accept reports the cancel, as the accept may still be
+// taking a connection until then.
+static void loop_drain(struct loop *lp) {
+    lp->draining = 1;
+    if (!lp->uring) epoll_ctl(lp->ep, EPOLL_CTL_DEL, drain_fd, NULL);
+    for (int i = 0; i < lp->nlisteners; i++) {
+        struct listener *l = &lp->listeners[i];
+        if (lp->uring && uring_cancel(lp->uring, UTAG(l, UOP_ACCEPT)) == 0) continue;
+        if (lp->uring) perror("io_uring cancel");
+        else epoll_ctl(lp->ep, EPOLL_CTL_DEL, l->fd, NULL);
+        close(l->fd);
+        l->fd = -1;
+        lp->listening--;
     }
+    struct conn *next;
+    for (struct conn *c = lp->subs; c; c = next) {
+        next = c->sub_next;
+        if (c->ws) {
+            ws_fail(c, WS_CLOSE_GOING_AWAY);
+            on_writable(lp, c);
+        } else {
+            // EventSource reconnects by itself
+            conn_close(lp, c);
+        }
+    }
+}
 
-    printf("Server listening on http://%s:%d\n", bind_ip, SERVER_PORT);
+// Reports the worker drained once its listeners are closed and its last
+// connection is gone
+static void loop_drained(struct loop *lp) {
+    if (lp->draining == 1 && lp->listening == 0 && lp->nconns == 0) {
+        lp->draining = 2;
+        atomic_fetch_sub(&drain_pending, 1);
+    }
+}
 
+static void epoll_loop(struct loop *lp) {
+    struct epoll_event events[MAX_EVENTS];
+    // Accepted sockets inherit this
+    int yes = 1;
+    lp->stamped = lp->adm.target_ns != 0;
+    for (int i = 0; i < lp->nlisteners && lp->stamped; i++) {
+        lp->stamped = setsockopt(lp->listeners[i].fd, SOL_SOCKET, SO_TIMESTAMPNS, &yes, sizeof(yes)) == 0;
+    }
     while (keep_running) {
-        struct sockaddr_in cli;
-        socklen_t clilen = sizeof(cli);
-        int client_fd = accept(server_fd, (struct sockaddr*)&cli, &clilen);
-        if (client_fd < 0) {
-            if (errno == EINTR && !keep_running) break;
-            perror("accept");
-            continue;
+        int timeout = run_timers(lp);
+        loop_drained(lp);
+        long long wait_start = now_ns();
+        int n = epoll_wait(lp->ep, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        loop_woke(lp, wait_start);
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            struct listener *l;
+            if (tag == lp) {
+                // stop_fd: keep_running is already cleared
+            } else if (tag == &lp->draining) {
+                loop_drain(lp);
+            } else if (tag == &lp->sse_fd) {
+                sse_deliver(lp);
+                ws_release(lp);
+            } else if ((l = listener_of(lp, tag))) {
+                // Gone if the drain came first in this batch
+                if (l->fd >= 0) on_accept(lp, l);
+            } else if (events[i].events & EPOLLERR) {
+                conn_close(lp, tag);
+            } else if (events[i].events & EPOLLOUT) {
+                on_writable(lp, tag);
+            } else {
+                on_readable(lp, tag);
+            }
         }
-        handle_client(client_fd);
-        close(client_fd);
     }
+    close_all(lp);
+}
 
-    close(server_fd);
-    printf("Shutting down.\n");
+// The same loop on io_uring: accepts, receives and sends are queued once
+// and complete into the ring, so a busy connection costs no readiness
+// round trips and a batch of them one system call
+static void uring_loop(struct loop *lp) {
+    struct uring *u = lp->uring;
+    for (int i = 0; i < lp->nlisteners; i++) {
+        if (uring_accept(u, lp->listeners[i].fd, UTAG(&lp->listeners[i], UOP_ACCEPT)) < 0) {
+            fprintf(stderr, "io_uring: cannot queue the listener\n");
+            return;
+        }
+    }
+    if (uring_poll(u, stop_fd, POLLIN, 0, UTAG(lp, UOP_STOP)) < 0 ||
+        uring_poll(u, drain_fd, POLLIN, 0, UTAG(lp, UOP_DRAIN)) < 0 ||
+        uring_poll(u, lp->sse_fd, POLLIN, 1, UTAG(lp, UOP_BUS)) < 0) {
+        fprintf(stderr, "io_uring: cannot queue the event polls\n");
+        return;
+    }
+    while (keep_running) {
+        int timeout = run_timers(lp);
+        loop_drained(lp);
+        long long wait_start = now_ns();
+        if (uring_wait(u, timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("io_uring_enter");
+            break;
+        }
+        loop_woke(lp, wait_start);
+        struct uring_event ev;
+        while (uring_next(u, &ev)) {
+            void *p = (void *)(uintptr_t)(ev.tag & ~(uint64_t)UOP_MASK);
+            switch (ev.tag & UOP_MASK) {
+            case UOP_ACCEPT: {
+                struct listener *l = p;
+                if (ev.res >= 0) {
+                    // Only the access log wants the address, which a
+                    // multishot accept does not return
+                    struct sockaddr_in cli = {0};
+                    socklen_t clilen = sizeof(cli);
+                    if (lp->log) getpeername(ev.res, (struct sockaddr *)&cli, &clilen);
+                    conn_new(lp, ev.res, cli.sin_addr.s_addr);
+                } else if (ev.res != -EAGAIN && ev.res != -ECANCELED) {
+                    errno = -ev.res;
+                    perror("accept");
+                }
+                if ((ev.flags & URING_F_MORE) || l->fd < 0) break;
+                if (lp->draining) {
+                    close(l->fd);
+                    l->fd = -1;
+                    lp->listening--;
+                } else if (keep_running && uring_accept(u, l->fd, UTAG(l, UOP_ACCEPT)) < 0) {
+                    perror("io_uring accept");
+                }
+                break;
+            }
+            case UOP_STOP:
+                // keep_running is already cleared
+                break;
+            case UOP_DRAIN:
+                loop_drain(lp);
+                break;
+            case UOP_BUS:
+                sse_deliver(lp);
+                ws_release(lp);
+                if (!(ev.flags & URING_F_MORE)) uring_poll(u, lp->sse_fd, POLLIN, 1, UTAG(lp, UOP_BUS));
+                break;
+            case UOP_RECV:
+                uring_on_recv(lp, p, &ev);
+                break;
+            case UOP_SEND:
+                uring_on_send(lp, p, &ev);
+                break;
+            case UOP_POLL:
+                uring_on_poll(lp, p, &ev);
+                break;
+            case UOP_SHUT:
+                conn_op_done(lp, p);
+                break;
+            }
+        }
+    }
+
+    // Closed connections are freed as the cancels of their requests come
+    // back; give that a moment before tearing the ring down
+    close_all(lp);
+    long long deadline = now_ms() + 1000;
+    while (lp->closing && now_ms() < deadline) {
+        if (uring_wait(u, 100) < 0 && errno != EINTR) break;
+        struct uring_event ev;
+        while (uring_next(u, &ev)) {
+            void *p = (void *)(uintptr_t)(ev.tag & ~(uint64_t)UOP_MASK);
+            unsigned op = ev.tag & UOP_MASK;
+            if (op == UOP_RECV && (ev.flags & URING_F_BUFFER)) uring_buf_put(u, ev.buf);
+            if (op >= UOP_RECV && !(ev.flags & URING_F_MORE)) {
+                if (op == UOP_SEND) {
+                    struct conn *c = p;
+                    if (c->u.send_out != c->out) free(c->u.send_out);
+                    c->u.send_out = NULL;
+                }
+                conn_op_done(lp, p);
+            }
+        }
+    }
+    // Submits the closes of the connections freed last
+    uring_wait(u, 0);
+    uring_free(u);
+    lp->uring = NULL;
+    while (lp->closing) {
+        struct conn *c = lp->closing;
+        lp->closing = c->closing_next;
+        conn_free(c);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct loop *lp = &w->lp;
+    if (cfg.pin) pin_worker(w);
+
+    // The ring is made here, as it may only be used by the thread that
+    // created it
+    if (cfg.uring) {
+        lp->uring = uring_new(URING_ENTRIES, URING_BUFS, URING_BUF_SIZE);
+        if (!lp->uring) fprintf(stderr, "worker %d: io_uring: %s; using epoll\n", w->id, strerror(errno));
+    }
+    if (lp->uring) uring_loop(lp);
+    else epoll_loop(lp);
+
+    arena_pool_destroy(&lp->pool);
+    close(lp->sse_fd);
+    close(lp->ep);
+    listeners_close(lp);
+    return NULL;
+}
+
+// Refreshes the clock slot just after every second boundary until shutdown
+static void *clock_main(void *arg) {
+    (void)arg;
+    struct pollfd pfd = {.fd = stop_fd, .events = POLLIN};
+    while (keep_running) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        int wait_ms = 1000 - (int)(ts.tv_nsec / 1000000);
+        if (poll(&pfd, 1, wait_ms) != 0) break;
+        clock_tick();
+    }
+    return NULL;
+}
+
+// Applies the changes inotify reports to the file cache until shutdown
+static void *cache_watch_main(void *arg) {
+    (void)arg;
+    struct pollfd pfd[2] = {{.fd = stop_fd, .events = POLLIN}, {.fd = file_cache.inotify_fd, .events = POLLIN}};
+    char buf[16384] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (keep_running) {
+        if (poll(pfd, 2, -1) < 0 && errno != EINTR) break;
+        if (pfd[0].revents) break;
+        ssize_t n = read(file_cache.inotify_fd, buf, sizeof(buf));
+        if (n > 0) file_cache_apply_events(buf, (size_t)n);
+    }
+    return NULL;
+}
+
+// Parses a CPU list such as "0-3,6" into cfg.cpus
+static int parse_cpu_list(const char *s) {
+    cfg.ncpus = 0;
+    while (*s) {
+        char *end;
+        long lo = strtol(s, &end, 10);
+        long hi = lo;
+        if (end == s || lo < 0) return -1;
+        if (*end == '-') {
+            s = end + 1;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo) return -1;
+        }
+        for (long cpu = lo; cpu <= hi; cpu++) {
+            if (cpu >= CPU_SETSIZE || cfg.ncpus == CPU_SETSIZE) return -1;
+            cfg.cpus[cfg.ncpus++] = (int)cpu;
+        }
+        s = end;
+        if (*s == ',') s++;
+        else if (*s) return -1;
+    }
+    return cfg.ncpus ? 0 : -1;
+}
+
+// SIGUSR2: starts the binary this server was started from, which may have
+// been replaced since, with the same arguments, and hands it the listeners.
+// Returns 0 once the successor is serving; otherwise this server carries on.
+static int upgrade(const char *exe, char **argv) {
+    int fds[HANDOFF_FDS_MAX];
+    int n = 0;
+    for (int i = 0; i < started; i++) {
+        for (int j = 0; j < workers[i].lp.nlisteners && n < HANDOFF_FDS_MAX; j++) fds[n++] = workers[i].lp.listeners[j].fd;
+    }
+    int sock;
+    pid_t pid = handoff_spawn(exe, argv, &sock);
+    if (pid < 0) {
+        perror(exe);
+        return -1;
+    }
+    if (handoff_send_fds(sock, fds, n) < 0 || handoff_wait_ready(sock, HANDOFF_READY_MS) < 0) {
+        fprintf(stderr, "Restart failed: process %d did not take over; still serving\n", (int)pid);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(sock);
+        return -1;
+    }
+    close(sock);
+    printf("Handed over to process %d; draining\n", (int)pid);
+    fflush(stdout);
     return 0;
 }
 
+// Has the workers stop accepting and waits until their connections are
+// gone, for at most cfg.drain_ms. SIGINT or SIGTERM cuts it short.
+static void drain(const sigset_t *sigs) {
+    atomic_store(&drain_pending, started);
+    draining = 1;
+    uint64_t one = 1;
+    if (write(drain_fd, &one, sizeof(one)) < 0) perror("write");
+    long long deadline = now_ms() + cfg.drain_ms;
+    while (atomic_load(&drain_pending) > 0) {
+        long long left = deadline - now_ms();
+        if (left <= 0) {
+            fprintf(stderr, "Drain deadline passed; closing the remaining connections\n");
+            return;
+        }
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = (left < 100 ? left : 100) * 1000000};
+        int sig = sigtimedwait(sigs, NULL, &ts);
+        if (sig == SIGHUP) access_log_reopen();
+        else if (sig == SIGINT || sig == SIGTERM) return;
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-w workers] [-c cpus] [-P] [-b backlog] [-d dir] [-l file] [-L format] [-i ms] [-r mb] [-u]\n"
+            "          [-m conns] [-q requests] [-S ms] [-C mb] [-g sec]\n"
+            "          [bind_ip] [port]\n"
+            "  -w N     worker threads, each with its own listener and event loop (default 1, 0 = one per CPU)\n"
+            "  -P       pin worker i to CPU i\n"
+            "  -c LIST  pin workers to the CPUs in LIST, e.g. 0-3,6 (implies -P)\n"
+            "  -b N     listen backlog per worker (default %d)\n"
+            "  -d DIR   serve the files in DIR under /static/\n"
+            "  -l FILE  write an access log to FILE ('-' for standard output); SIGHUP reopens it\n"
+            "  -L FMT   access log format: common (default) or json\n"
+            "  -i MS    access log flush interval (default 1000)\n"
+            "  -r MB    rotate the access log once it reaches MB megabytes\n"
+            "  -u       use io_uring instead of epoll (Linux 6.0 or later)\n"
+            "  -m N     most open connections; more get an immediate 503 (default no limit)\n"
+            "  -q N     most responses being sent at once; more requests get a 503 (default no limit)\n"
+            "  -S MS    under standing overload, answer requests queued longer than MS with 503\n"
+            "           (default %d, 0 = never)\n"
+            "  -C MB    memory for caching small static files (default %d, 0 = no cache)\n"
+            "  -g SEC   on SIGUSR2 a new server takes over the listeners; the old one finishes its\n"
+            "           connections for at most SEC seconds (default %d)\n",
+            prog, BACKLOG, SHED_TARGET_MS, FILE_CACHE_BYTES / (1024 * 1024), DRAIN_TIMEOUT_MS / 1000);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "w:c:Pb:d:l:L:i:r:um:q:S:C:g:h")) != -1) {
+        switch (opt) {
+        case 'w':
+            cfg.workers = atoi(optarg);
+            break;
+        case 'c':
+            if (parse_cpu_list(optarg) < 0) {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                return 1;
+            }
+            cfg.pin = 1;
+            break;
+        case 'P':
+            cfg.pin = 1;
+            break;
+        case 'b':
+            cfg.backlog = atoi(optarg);
+            break;
+        case 'd':
+            cfg.docroot = optarg;
+            break;
+        case 'l':
+            cfg.log_path = optarg;
+            break;
+        case 'L':
+            if (strcmp(optarg, "common") == 0) {
+                cfg.log_format = ACCESS_COMMON;
+            } else if (strcmp(optarg, "json") == 0) {
+                cfg.log_format = ACCESS_JSON;
+            } else {
+                fprintf(stderr, "Unknown log format: %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'i':
+            cfg.log_flush_ms = atoi(optarg);
+            break;
+        case 'r':
+            cfg.log_rotate_bytes = (uint64_t)atoll(optarg) * 1024 * 1024;
+            break;
+        case 'u':
+            cfg.uring = 1;
+            break;
+        case 'm':
+            cfg.max_conns = (unsigned)atoi(optarg);
+            break;
+        case 'q':
+            cfg.max_inflight = (unsigned)atoi(optarg);
+            break;
+        case 'S':
+            cfg.shed_target_ms = atoi(optarg);
+            if (cfg.shed_target_ms < 0) cfg.shed_target_ms = 0;
+            break;
+        case 'C':
+            cfg.file_cache_bytes = (size_t)strtoull(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'g':
+            cfg.drain_ms = atoi(optarg) * 1000;
+            if (cfg.drain_ms < 0) cfg.drain_ms = 0;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind < argc) cfg.bind_ip = argv[optind++];
+    if (optind < argc) cfg.port = atoi(argv[optind++]);
+    if (cfg.workers <= 0) cfg.workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (cfg.backlog <= 0) cfg.backlog = BACKLOG;
+    if (cfg.uring) {
+        // Tried once up front so that an unsupported kernel is reported once
+        struct uring *u = uring_new(URING_ENTRIES, URING_BUFS, URING_BUF_SIZE);
+        if (!u) {
+            fprintf(stderr, "io_uring unavailable (%s); using epoll\n", strerror(errno));
+            cfg.uring = 0;
+        }
+        uring_free(u);
+    }
+
+    // SCAN_IMPL=scalar|sse2|avx2 overrides the kernels picked for this CPU
+    const char *impl = getenv("SCAN_IMPL");
+    if (scan_init(impl) < 0) {
+        fprintf(stderr, "SCAN_IMPL=%s is not available on this CPU\n", impl);
+        return 1;
+    }
+
+    if (build_responses() < 0) {
+        fprintf(stderr, "Cannot build responses\n");
+        return 1;
+    }
+    if (build_router() < 0) return 1;
+
+    if (cfg.docroot) {
+        docroot_fd = open(cfg.docroot, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (docroot_fd < 0) {
+            perror(cfg.docroot);
+            return 1;
+        }
+    }
+
+    // Event streams hold their connections open; allow as many as the hard
+    // descriptor limit permits
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    // The binary a restart runs, resolved now: once it has been replaced
+    // on disk, this one's link names the deleted file
+    char exe[PATH_MAX];
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (exe_len > 0) exe[exe_len] = '\0';
+    else snprintf(exe, sizeof(exe), "%s", argv[0]);
+
+    // Started by a server handing over on SIGUSR2: its listeners are taken
+    // over instead of binding new ones. Exiting on failure tells it to
+    // carry on.
+    int handoff = handoff_inherited();
+    if (handoff >= 0) {
+        ninherited = handoff_recv_fds(handoff, inherited_fds, HANDOFF_FDS_MAX);
+        if (ninherited < 0) {
+            perror("handoff");
+            return 1;
+        }
+    }
+
+    // Workers inherit a mask with the shutdown signals blocked; the main
+    // thread takes them with sigwait and wakes the loops through stop_fd.
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    drain_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_fd < 0 || drain_fd < 0) {
+        perror("eventfd");
+        return 1;
+    }
+    if (cfg.log_path &&
+        access_log_open(cfg.log_path, cfg.log_format, cfg.log_flush_ms, cfg.log_rotate_bytes, cfg.workers) < 0) {
+        return 1;
+    }
+    if (metrics_init(cfg.workers, route_names, ROUTE_COUNT + 1) < 0) {
+        perror("metrics_init");
+        return 1;
+    }
+    clock_tick();
+    pthread_t clock_tid;
+    int err = pthread_create(&clock_tid, NULL, clock_main, NULL);
+    if (err) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return 1;
+    }
+    // Without inotify, cached files are checked with stat() on every hit
+    file_cache.capacity = cfg.file_cache_bytes;
+    file_cache.inotify_fd = -1;
+    pthread_t watch_tid;
+    int watching = 0;
+    if (docroot_fd >= 0 && file_cache.capacity > 0) {
+        file_cache.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (file_cache.inotify_fd < 0) {
+            perror("inotify_init1");
+        } else if ((err = pthread_create(&watch_tid, NULL, cache_watch_main, NULL)) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            close(file_cache.inotify_fd);
+            file_cache.inotify_fd = -1;
+        } else {
+            watching = 1;
+        }
+    }
+
+    workers = calloc((size_t)cfg.workers, sizeof(*workers));
+    if (!workers) {
+        perror("calloc");
+        return 1;
+    }
+    for (; started < cfg.workers; started++) {
+        struct worker *w = &workers[started];
+        w->id = started;
+        if (worker_init(w) < 0) break;
+        err = pthread_create(&w->tid, NULL, worker_main, w);
+        if (err) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(err));
+            close(w->lp.ep);
+            listeners_close(&w->lp);
+            break;
+        }
+    }
+
+    if (started == cfg.workers) {
+        printf("Server listening on http://%s:%d (%d worker%s, %s, %s scanning)\n", cfg.bind_ip, cfg.port,
+               cfg.workers, cfg.workers == 1 ? "" : "s", cfg.uring ? "io_uring" : "epoll", scan.name);
+        fflush(stdout);
+        if (handoff >= 0) {
+            if (handoff_ready(handoff) < 0) perror("handoff");
+            close(handoff);
+        }
+        int sig;
+        while (sigwait(&sigs, &sig) == 0) {
+            if (sig == SIGHUP) {
+                access_log_reopen();
+            } else if (sig == SIGUSR2) {
+                if (upgrade(exe, argv) < 0) continue;
+                drain(&sigs);
+                break;
+            } else {
+                break;
+            }
+        }
+    }
 
+    keep_running = 0;
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) < 0) perror("write");
+    // The clock publishes to the workers' eventfds, so it stops first
+    pthread_join(clock_tid, NULL);
+    if (watching) pthread_join(watch_tid, NULL);
+    for (int i = 0; i < started; i++) pthread_join(workers[i].tid, NULL);
+    sse_shutdown();
+    if (cfg.log_path) {
+        access_log_close();
+        struct access_log_stats st;
+        access_log_stats(&st);
+        if (st.dropped || st.write_errors) {
+            fprintf(stderr, "Access log: %llu records written, %llu dropped, %llu write errors\n",
+                    (unsigned long long)st.written, (unsigned long long)st.dropped,
+                    (unsigned long long)st.write_errors);
+        }
+    }
+    free(workers);
+    metrics_free();
+    close(stop_fd);
+    close(drain_fd);
+    if (file_cache.inotify_fd >= 0) close(file_cache.inotify_fd);
+    if (docroot_fd >= 0) close(docroot_fd);
+    printf("Shutting down.\n");
+    return started == cfg.workers ? 0 : 1;
+}
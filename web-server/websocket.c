@@ -0,0 +1,226 @@
+#include "websocket.h"
+
+#include <string.h>
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// SHA-1 (FIPS 180-4), only ever fed the handshake key: short and once per
+// connection, so a plain implementation does
+struct sha1 {
+    uint32_t h[5];
+    unsigned char block[64];
+    size_t used;
+    uint64_t total;
+};
+
+static uint32_t rol(uint32_t x, int n) {
+    return x << n | x >> (32 - n);
+}
+
+static void sha1_block(struct sha1 *s) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+        const unsigned char *b = s->block + 4 * i;
+        w[i] = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+    }
+    for (int i = 16; i < 80; i++) w[i] = rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    uint32_t a = s->h[0], b = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4];
+    for (int i = 0; i < 80; i++) {
+        uint32_t f, k;
+        if (i < 20) {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        } else if (i < 40) {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        } else if (i < 60) {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        } else {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+        uint32_t t = rol(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol(b, 30);
+        b = a;
+        a = t;
+    }
+    s->h[0] += a;
+    s->h[1] += b;
+    s->h[2] += c;
+    s->h[3] += d;
+    s->h[4] += e;
+}
+
+static void sha1_init(struct sha1 *s) {
+    static const uint32_t iv[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    memcpy(s->h, iv, sizeof(iv));
+    s->used = 0;
+    s->total = 0;
+}
+
+static void sha1_update(struct sha1 *s, const void *data, size_t len) {
+    const unsigned char *p = data;
+    s->total += len;
+    while (len > 0) {
+        size_t n = sizeof(s->block) - s->used;
+        if (n > len) n = len;
+        memcpy(s->block + s->used, p, n);
+        s->used += n;
+        p += n;
+        len -= n;
+        if (s->used == sizeof(s->block)) {
+            sha1_block(s);
+            s->used = 0;
+        }
+    }
+}
+
+static void sha1_final(struct sha1 *s, unsigned char out[20]) {
+    uint64_t bits = s->total * 8;
+    unsigned char pad = 0x80;
+    sha1_update(s, &pad, 1);
+    pad = 0;
+    while (s->used != 56) sha1_update(s, &pad, 1);
+    unsigned char len[8];
+    for (int i = 0; i < 8; i++) len[i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha1_update(s, len, 8);
+    for (int i = 0; i < 20; i++) out[i] = (unsigned char)(s->h[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+static size_t base64(const unsigned char *in, size_t len, char *out) {
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t o = 0;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t v = (uint32_t)in[i] << 16;
+        if (i + 1 < len) v |= (uint32_t)in[i + 1] << 8;
+        if (i + 2 < len) v |= in[i + 2];
+        out[o++] = digits[v >> 18 & 63];
+        out[o++] = digits[v >> 12 & 63];
+        out[o++] = i + 1 < len ? digits[v >> 6 & 63] : '=';
+        out[o++] = i + 2 < len ? digits[v & 63] : '=';
+    }
+    return o;
+}
+
+void ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_LEN + 1]) {
+    struct sha1 s;
+    unsigned char digest[20];
+    sha1_init(&s);
+    sha1_update(&s, key, key_len);
+    sha1_update(&s, WS_GUID, sizeof(WS_GUID) - 1);
+    sha1_final(&s, digest);
+    out[base64(digest, sizeof(digest), out)] = '\0';
+}
+
+int ws_frame_head_parse(const char *buf, size_t len, struct ws_frame_head *h) {
+    const unsigned char *b = (const unsigned char *)buf;
+    if (len < 2) return 0;
+    h->fin = b[0] >> 7;
+    h->opcode = (enum ws_opcode)(b[0] & 0x0f);
+    h->masked = b[1] >> 7;
+    if (b[0] & 0x70) return -1;     // no extension was negotiated
+    switch (h->opcode) {
+    case WS_CONTINUATION:
+    case WS_TEXT:
+    case WS_BINARY:
+        break;
+    case WS_CLOSE:
+    case WS_PING:
+    case WS_PONG:
+        if (!h->fin || (b[1] & 0x7f) > WS_CONTROL_MAX) return -1;
+        break;
+    default:
+        return -1;
+    }
+
+    size_t pos = 2;
+    uint64_t n = b[1] & 0x7f;
+    if (n == 126) {
+        if (len < 4) return 0;
+        n = (uint64_t)b[2] << 8 | b[3];
+        if (n < 126) return -1;
+        pos = 4;
+    } else if (n == 127) {
+        if (len < 10) return 0;
+        n = 0;
+        for (int i = 0; i < 8; i++) n = n << 8 | b[2 + i];
+        if (n >> 63 || n <= 0xffff) return -1;
+        pos = 10;
+    }
+    if (h->masked) {
+        if (len < pos + 4) return 0;
+        memcpy(h->mask, b + pos, 4);
+        pos += 4;
+    }
+    h->len = n;
+    h->head_len = pos;
+    return 1;
+}
+
+size_t ws_frame_head_build(char *out, enum ws_opcode opcode, uint64_t len) {
+    unsigned char *b = (unsigned char *)out;
+    b[0] = (unsigned char)(0x80 | opcode);
+    if (len < 126) {
+        b[1] = (unsigned char)len;
+        return 2;
+    }
+    if (len <= 0xffff) {
+        b[1] = 126;
+        b[2] = (unsigned char)(len >> 8);
+        b[3] = (unsigned char)len;
+        return 4;
+    }
+    b[1] = 127;
+    for (int i = 0; i < 8; i++) b[2 + i] = (unsigned char)(len >> (56 - 8 * i));
+    return 10;
+}
+
+int ws_utf8_valid(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    size_t i = 0;
+    while (i < len) {
+        // Chat text is mostly ASCII: skip it eight bytes at a time
+        if (i + 8 <= len) {
+            uint64_t v;
+            memcpy(&v, p + i, sizeof(v));
+            if (!(v & 0x8080808080808080ull)) {
+                i += 8;
+                continue;
+            }
+        }
+        unsigned char c = p[i];
+        if (c < 0x80) {
+            i++;
+            continue;
+        }
+        size_t n;
+        uint32_t cp;
+        if (c >= 0xc2 && c <= 0xdf) {
+            n = 1;
+            cp = c & 0x1f;
+        } else if (c >= 0xe0 && c <= 0xef) {
+            n = 2;
+            cp = c & 0x0f;
+        } else if (c >= 0xf0 && c <= 0xf4) {
+            n = 3;
+            cp = c & 0x07;
+        } else {
+            return 0;
+        }
+        if (i + n >= len) return 0;
+        for (size_t k = 1; k <= n; k++) {
+            if ((p[i + k] & 0xc0) != 0x80) return 0;
+            cp = cp << 6 | (p[i + k] & 0x3f);
+        }
+        // Overlong forms, surrogates, beyond U+10FFFF
+        if ((n == 2 && cp < 0x800) || (n == 3 && cp < 0x10000) || (cp >= 0xd800 && cp <= 0xdfff) ||
+            cp > 0x10ffff) {
+            return 0;
+        }
+        i += n + 1;
+    }
+    return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// RFC 6455 building blocks: the opening handshake key, frame headers and
+// UTF-8 checking of text messages. Payloads are unmasked with
+// scan.unmask(); message assembly and the connection itself belong to the
+// server loop.
+
+enum ws_opcode {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xa,
+};
+
+// Close status codes (RFC 6455 7.4.1)
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_GOING_AWAY 1001
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_INVALID_DATA 1007
+#define WS_CLOSE_TOO_BIG 1009
+
+#define WS_ACCEPT_LEN 28        // base64 of a SHA-1 digest
+#define WS_CONTROL_MAX 125      // longest control frame payload
+#define WS_FRAME_HEAD_MAX 14
+
+struct ws_frame_head {
+    int fin;
+    enum ws_opcode opcode;
+    int masked;
+    unsigned char mask[4];
+    uint64_t len;               // payload length
+    size_t head_len;            // bytes before the payload
+};
+
+// Sec-WebSocket-Accept for a client's Sec-WebSocket-Key; out gets
+// WS_ACCEPT_LEN characters and a terminator
+void ws_accept_key(const char *key, size_t key_len, char out[WS_ACCEPT_LEN + 1]);
+
+// Decodes the frame header at buf. Returns 1 when complete, 0 if more
+// bytes are needed, or -1 for a header no endpoint may send: reserved bits
+// or opcodes, a fragmented or oversized control frame, a non-minimal or
+// 64-bit-overflowing length.
+int ws_frame_head_parse(const char *buf, size_t len, struct ws_frame_head *h);
+
+// Writes an unmasked, final frame header for a server message and returns
+// its length (at most 10 bytes)
+size_t ws_frame_head_build(char *out, enum ws_opcode opcode, uint64_t len);
+
+// Whether s[0, len) is well-formed UTF-8: shortest forms only, no
+// surrogates, nothing above U+10FFFF
+int ws_utf8_valid(const char *s, size_t len);
+
+#endif // WEBSOCKET_H